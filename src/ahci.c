@@ -0,0 +1,571 @@
+#include <ata.h>
+#include <disk.h>
+#include <pci.h>
+#include <port.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Memory mapped registers */
+#define REG(base, ofs)        (*(volatile ULONG*)((CHAR*)(base) + (ofs)))
+
+/* HBA registers */
+#define HBA_CAP               0x00
+#define HBA_GHC               0x04
+#define HBA_PI                0x0C
+#define HBA_PORTS             0x100
+#define HBA_PORT_SIZE         0x80
+
+#define HBA_CAP_NCS(cap)      ((((cap) >> 8) & 0x1F) + 1)
+#define HBA_CAP_SNCQ          0x40000000
+#define HBA_GHC_AE            0x80000000
+
+/* Port registers */
+#define PORT_CLB              0x00
+#define PORT_CLBU             0x04
+#define PORT_FB               0x08
+#define PORT_FBU              0x0C
+#define PORT_IS               0x10
+#define PORT_CMD              0x18
+#define PORT_TFD              0x20
+#define PORT_SIG              0x24
+#define PORT_SSTS             0x28
+#define PORT_SERR             0x30
+#define PORT_SACT             0x34
+#define PORT_CI               0x38
+
+#define PORT_CMD_ST           0x0001
+#define PORT_CMD_FRE          0x0010
+#define PORT_CMD_FR           0x4000
+#define PORT_CMD_CR           0x8000
+
+#define PORT_IS_TFES          0x40000000
+#define PORT_IS_ERRORS        0x7D800010  /* TFES, HBFS, HBDS, IFS, OFS and the like */
+
+#define PORT_SSTS_PRESENT     0x3         /* Device present, communication established */
+#define PORT_SIG_ATA          0x00000101
+
+/* Register Host to Device FIS */
+#define FIS_TYPE_H2D          0x27
+#define FIS_H2D_COMMAND       0x80
+
+#define AHCI_CHUNK_SECTORS    256         /* Sectors per command                   */
+#define AHCI_MAX_PRD_BYTES    0x400000    /* Most bytes one PRD can describe       */
+#define AHCI_MAX_PRDS         8           /* Fills a command table to 256 bytes    */
+#define AHCI_TIMEOUT          0x1000000   /* Register polls before giving up       */
+
+typedef struct _AHCI_CMD_HEADER
+{
+    USHORT Flags;           /* Command FIS length in dwords, direction */
+    USHORT nPrds;
+    ULONG  ByteCount;
+    ULONG  Table;
+    ULONG  TableHigh;
+    ULONG  Reserved[4];
+} AHCI_CMD_HEADER;
+
+typedef struct _AHCI_PRD
+{
+    ULONG  Base;
+    ULONG  BaseHigh;
+    ULONG  Reserved;
+    ULONG  Count;           /* Bytes - 1 */
+} AHCI_PRD;
+
+typedef struct _AHCI_CMD_TABLE
+{
+    UCHAR    Fis[64];
+    UCHAR    Atapi[16];
+    UCHAR    Reserved[48];
+    AHCI_PRD Prd[ AHCI_MAX_PRDS ];
+} AHCI_CMD_TABLE;
+
+typedef struct _AHCI_PORT
+{
+    DISK             Disk;
+    CHAR*            Regs;
+    AHCI_CMD_HEADER* List;
+    AHCI_CMD_TABLE*  Tables;    /* One per slot */
+    ULONG            nSlots;
+    BOOL             useNcq;
+
+    /* What the BIOS had, restored by AhciRelease() */
+    AHCI_CMD_HEADER* Saved;     /* Its command headers, if we share its list */
+    ULONG            SavedClb;  /* Otherwise its registers                   */
+    ULONG            SavedFb;
+    ULONG            SavedCmd;
+
+    /* Submitted reads, by slot */
+    ULONG            Busy;
+    ULONG            Errors;
+    ULONG            Count[32];
+} AHCI_PORT;
+
+/* Polls until none of @Bits are set in port register @Reg. Returns FALSE on timeout */
+static BOOL WaitClear( AHCI_PORT* Port, ULONG Reg, ULONG Bits )
+{
+    ULONG i;
+
+    for (i = 0; i < AHCI_TIMEOUT; i++)
+    {
+        if ((REG( Port->Regs, Reg ) & Bits) == 0)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/* Stops the command engine and starts it again, which clears all outstanding commands */
+static VOID RestartPort( AHCI_PORT* Port )
+{
+    REG( Port->Regs, PORT_CMD ) &= ~PORT_CMD_ST;
+    WaitClear( Port, PORT_CMD, PORT_CMD_CR );
+
+    REG( Port->Regs, PORT_SERR ) = 0xFFFFFFFF;
+    REG( Port->Regs, PORT_IS )   = 0xFFFFFFFF;
+
+    WaitClear( Port, PORT_TFD, ATA_SR_BSY | ATA_SR_DRQ );
+    REG( Port->Regs, PORT_CMD ) |= PORT_CMD_ST;
+}
+
+/*
+ * Fills in command slot @Slot to transfer @nBytes into @Buffer. The FIS is
+ * left to the caller. Returns the FIS.
+ */
+static UCHAR* BuildCommand( AHCI_PORT* Port, ULONG Slot, VOID* Buffer, ULONG nBytes )
+{
+    AHCI_CMD_HEADER* Header = &Port->List[ Slot ];
+    AHCI_CMD_TABLE*  Table  = &Port->Tables[ Slot ];
+    ULONG            i;
+
+    memset( Table, 0, sizeof(AHCI_CMD_TABLE) );
+
+    /* The buffer is physically contiguous, so it only splits at the PRD size limit */
+    for (i = 0; nBytes > 0; i++)
+    {
+        ULONG Size = MIN( nBytes, AHCI_MAX_PRD_BYTES );
+
+        Table->Prd[i].Base  = (ULONG)Buffer;
+        Table->Prd[i].Count = Size - 1;
+
+        Buffer  = (CHAR*)Buffer + Size;
+        nBytes -= Size;
+    }
+
+    Header->Flags     = 5;      /* Register FIS length, device to host */
+    Header->nPrds     = i;
+    Header->ByteCount = 0;
+    Header->Table     = (ULONG)Table;
+    Header->TableHigh = 0;
+
+    Table->Fis[0] = FIS_TYPE_H2D;
+    Table->Fis[1] = FIS_H2D_COMMAND;
+    return Table->Fis;
+}
+
+/* Puts the 48-bit @Sector in the LBA fields of @Fis */
+static VOID SetLba( UCHAR* Fis, ULONGLONG Sector )
+{
+    Fis[4]  = (UCHAR)(Sector);
+    Fis[5]  = (UCHAR)(Sector >> 8);
+    Fis[6]  = (UCHAR)(Sector >> 16);
+    Fis[7]  = ATA_DEV_LBA;
+    Fis[8]  = (UCHAR)(Sector >> 24);
+    Fis[9]  = (UCHAR)(Sector >> 32);
+    Fis[10] = (UCHAR)(Sector >> 40);
+}
+
+/*
+ * Issues the commands in @Slots and waits for them. Returns the slots that
+ * completed successfully.
+ */
+static ULONG RunCommands( AHCI_PORT* Port, ULONG Slots )
+{
+    ULONG Pending = Slots;
+    ULONG i;
+
+    MemoryBarrier();
+    REG( Port->Regs, PORT_IS ) = 0xFFFFFFFF;
+    if (Port->useNcq)
+    {
+        REG( Port->Regs, PORT_SACT ) = Slots;
+    }
+    REG( Port->Regs, PORT_CI ) = Slots;
+
+    for (i = 0; (i < AHCI_TIMEOUT) && (Pending != 0); i++)
+    {
+        /* Queued commands complete out of order, through SActive */
+        Pending = REG( Port->Regs, Port->useNcq ? PORT_SACT : PORT_CI ) & Slots;
+
+        if (REG( Port->Regs, PORT_IS ) & PORT_IS_ERRORS)
+        {
+            break;
+        }
+    }
+
+    if (Pending != 0)
+    {
+        /* Something went wrong, outstanding commands are lost */
+        RestartPort( Port );
+    }
+
+    REG( Port->Regs, PORT_IS ) = 0xFFFFFFFF;
+    return Slots & ~Pending;
+}
+
+/* Fills in command slot @Slot to read @nSectors at @Sector into @Buffer */
+static VOID BuildRead( AHCI_PORT* Port, ULONG Slot, ULONGLONG Sector, ULONG nSectors, VOID* Buffer )
+{
+    UCHAR* Fis = BuildCommand( Port, Slot, Buffer, nSectors * Port->Disk.nBytesPerSector );
+
+    SetLba( Fis, Sector );
+    if (Port->useNcq)
+    {
+        /* The count goes in the features register, the tag in the count register */
+        Fis[2]  = ATA_CMD_FPDMA_QUEUED;
+        Fis[3]  = LOBYTE(nSectors);
+        Fis[11] = HIBYTE(nSectors);
+        Fis[12] = Slot << 3;
+    }
+    else
+    {
+        Fis[2]  = ATA_CMD_DMA_EXT;
+        Fis[12] = LOBYTE(nSectors);
+        Fis[13] = HIBYTE(nSectors);
+    }
+}
+
+/*
+ * Reads up to nSlots chunks at once; with NCQ the drive may serve them in any
+ * order it likes.
+ */
+static ULONG AhciRead( DISK* Disk, ULONGLONG Sector, ULONG nSectors, VOID* Buffer )
+{
+    AHCI_PORT* Port  = Disk->Data;
+    ULONG      Slots = 0;
+    ULONG      Done;
+    ULONG      Read  = 0;
+    ULONG      Slot;
+
+    if ((nSectors == 0) || (nSectors > Disk->MaxTransfer) || (Sector + nSectors > Disk->nTotalSectors))
+    {
+        return 0;
+    }
+
+    for (Slot = 0; Slot * AHCI_CHUNK_SECTORS < nSectors; Slot++)
+    {
+        BuildRead( Port, Slot, Sector + Slot * AHCI_CHUNK_SECTORS,
+                   MIN( nSectors - Slot * AHCI_CHUNK_SECTORS, AHCI_CHUNK_SECTORS ),
+                   (CHAR*)Buffer + Slot * AHCI_CHUNK_SECTORS * Disk->nBytesPerSector );
+        Slots |= 1UL << Slot;
+    }
+
+    Done = RunCommands( Port, Slots );
+
+    /* Only count the chunks up to the first one that failed */
+    for (Slot = 0; (Read < nSectors) && (Done & (1UL << Slot)); Slot++)
+    {
+        Read += MIN( nSectors - Read, AHCI_CHUNK_SECTORS );
+    }
+
+    return Read;
+}
+
+/* Issues a read in a free slot, which is also its tag */
+static INT AhciSubmit( DISK* Disk, ULONGLONG Sector, ULONG nSectors, VOID* Buffer )
+{
+    AHCI_PORT* Port = Disk->Data;
+    ULONG      Slot;
+
+    if ((nSectors == 0) || (nSectors > Disk->MaxSubmit) || (Sector + nSectors > Disk->nTotalSectors))
+    {
+        return -1;
+    }
+
+    for (Slot = 0; (Slot < Port->nSlots) && (Port->Busy & (1UL << Slot)); Slot++);
+    if (Slot == Port->nSlots)
+    {
+        return -1;
+    }
+
+    BuildRead( Port, Slot, Sector, nSectors, Buffer );
+
+    MemoryBarrier();
+    if (Port->Busy == 0)
+    {
+        REG( Port->Regs, PORT_IS ) = 0xFFFFFFFF;
+    }
+    if (Port->useNcq)
+    {
+        REG( Port->Regs, PORT_SACT ) = 1UL << Slot;
+    }
+    REG( Port->Regs, PORT_CI ) = 1UL << Slot;
+
+    Port->Busy          |= 1UL << Slot;
+    Port->Count[ Slot ]  = nSectors;
+    return Slot;
+}
+
+static INT AhciPoll( DISK* Disk, ULONG* nRead )
+{
+    AHCI_PORT* Port = Disk->Data;
+    ULONG      Finished;
+    ULONG      Slot;
+
+    if (Port->Busy == 0)
+    {
+        return -1;
+    }
+
+    if (REG( Port->Regs, PORT_IS ) & PORT_IS_ERRORS)
+    {
+        /* There's no telling which command failed, so they all did */
+        RestartPort( Port );
+        REG( Port->Regs, PORT_IS ) = 0xFFFFFFFF;
+        Port->Errors = Port->Busy;
+    }
+
+    Finished = Port->Busy & ~REG( Port->Regs, Port->useNcq ? PORT_SACT : PORT_CI );
+    if (Finished == 0)
+    {
+        return -1;
+    }
+
+    for (Slot = 0; ~Finished & (1UL << Slot); Slot++);
+
+    *nRead = (Port->Errors & (1UL << Slot)) ? 0 : Port->Count[ Slot ];
+    Port->Busy   &= ~(1UL << Slot);
+    Port->Errors &= ~(1UL << Slot);
+    return Slot;
+}
+
+static VOID AhciAbort( DISK* Disk )
+{
+    AHCI_PORT* Port = Disk->Data;
+
+    if (Port->Busy != 0)
+    {
+        RestartPort( Port );
+        REG( Port->Regs, PORT_IS ) = 0xFFFFFFFF;
+    }
+
+    Port->Busy   = 0;
+    Port->Errors = 0;
+}
+
+/*
+ * Gives the port back to the BIOS: the command headers we overwrote get its
+ * command tables back, or it gets its own command list and FIS area back.
+ */
+static VOID AhciRelease( DISK* Disk )
+{
+    AHCI_PORT* Port = Disk->Data;
+
+    AhciAbort( Disk );
+
+    if (Port->Saved != NULL)
+    {
+        memcpy( Port->List, Port->Saved, 32 * sizeof(AHCI_CMD_HEADER) );
+        return;
+    }
+
+    REG( Port->Regs, PORT_CMD ) &= ~(PORT_CMD_ST | PORT_CMD_FRE);
+    if (WaitClear( Port, PORT_CMD, PORT_CMD_CR | PORT_CMD_FR ))
+    {
+        REG( Port->Regs, PORT_CLB ) = Port->SavedClb;
+        REG( Port->Regs, PORT_FB )  = Port->SavedFb;
+        REG( Port->Regs, PORT_CMD ) |= Port->SavedCmd & PORT_CMD_FRE;
+        REG( Port->Regs, PORT_CMD ) |= Port->SavedCmd & PORT_CMD_ST;
+    }
+}
+
+/* Reads the IDENTIFY DEVICE data into @Id through slot 0 */
+static BOOL Identify( AHCI_PORT* Port, USHORT* Id )
+{
+    UCHAR* Fis = BuildCommand( Port, 0, Id, 512 );
+
+    /* Not a queued command, so this must be done before NCQ is turned on */
+    Fis[2] = ATA_CMD_IDENTIFY;
+    return (RunCommands( Port, 1 ) == 1);
+}
+
+/*
+ * Gets the port ready to take our commands. A port the BIOS already runs
+ * keeps its command list; we point its headers at our own command tables,
+ * and AhciRelease() puts the BIOS' headers back. Any other port gets a list
+ * of our own, and the BIOS' registers back on release.
+ */
+static BOOL StartPort( AHCI_PORT* Port )
+{
+    VOID* Fis;
+
+    if ((REG( Port->Regs, PORT_CMD ) & PORT_CMD_ST) && (REG( Port->Regs, PORT_CLB ) != 0) &&
+        (REG( Port->Regs, PORT_CLBU ) == 0))
+    {
+        Port->List  = (AHCI_CMD_HEADER*)REG( Port->Regs, PORT_CLB );
+        Port->Saved = malloc( 32 * sizeof(AHCI_CMD_HEADER) );
+        if (Port->Saved == NULL)
+        {
+            return FALSE;
+        }
+        memcpy( Port->Saved, Port->List, 32 * sizeof(AHCI_CMD_HEADER) );
+        return TRUE;
+    }
+
+    if ((REG( Port->Regs, PORT_CLBU ) != 0) || (REG( Port->Regs, PORT_FBU ) != 0))
+    {
+        /* We couldn't give the BIOS its memory back */
+        return FALSE;
+    }
+
+    Port->SavedClb = REG( Port->Regs, PORT_CLB );
+    Port->SavedFb  = REG( Port->Regs, PORT_FB );
+    Port->SavedCmd = REG( Port->Regs, PORT_CMD );
+
+    /* Stop the engine and the FIS receiver before moving their memory */
+    REG( Port->Regs, PORT_CMD ) &= ~(PORT_CMD_ST | PORT_CMD_FRE);
+    if (!WaitClear( Port, PORT_CMD, PORT_CMD_CR | PORT_CMD_FR ))
+    {
+        return FALSE;
+    }
+
+    Port->List = memalign( 1024, 32 * sizeof(AHCI_CMD_HEADER) );
+    Fis        = memalign( 256, 256 );
+    if ((Port->List == NULL) || (Fis == NULL))
+    {
+        free( Port->List );
+        free( Fis );
+        return FALSE;
+    }
+
+    memset( Port->List, 0, 32 * sizeof(AHCI_CMD_HEADER) );
+    memset( Fis, 0, 256 );
+
+    REG( Port->Regs, PORT_CLB )  = (ULONG)Port->List;
+    REG( Port->Regs, PORT_CLBU ) = 0;
+    REG( Port->Regs, PORT_FB )   = (ULONG)Fis;
+    REG( Port->Regs, PORT_FBU )  = 0;
+    REG( Port->Regs, PORT_SERR ) = 0xFFFFFFFF;
+    REG( Port->Regs, PORT_IS )   = 0xFFFFFFFF;
+
+    REG( Port->Regs, PORT_CMD ) |= PORT_CMD_FRE;
+    if (!WaitClear( Port, PORT_TFD, ATA_SR_BSY | ATA_SR_DRQ ))
+    {
+        return FALSE;
+    }
+    REG( Port->Regs, PORT_CMD ) |= PORT_CMD_ST;
+
+    return TRUE;
+}
+
+static VOID ProbePort( PCI_DEVICE* Pci, CHAR* Abar, UINT iPort, USHORT* Id )
+{
+    AHCI_PORT* Port;
+    ULONG      Cap  = REG( Abar, HBA_CAP );
+    CHAR*      Regs = Abar + HBA_PORTS + iPort * HBA_PORT_SIZE;
+
+    if (((REG( Regs, PORT_SSTS ) & 0xF) != PORT_SSTS_PRESENT) || (REG( Regs, PORT_SIG ) != PORT_SIG_ATA))
+    {
+        /* No ATA disk on this port */
+        return;
+    }
+
+    Port = malloc( sizeof(AHCI_PORT) );
+    if (Port == NULL)
+    {
+        return;
+    }
+
+    memset( Port, 0, sizeof(AHCI_PORT) );
+    Port->Regs   = Regs;
+    Port->nSlots = HBA_CAP_NCS(Cap);
+    Port->Tables = memalign( 128, Port->nSlots * sizeof(AHCI_CMD_TABLE) );
+
+    Port->Disk.Data = Port;
+
+    if ((Port->Tables == NULL) || (!StartPort( Port )))
+    {
+        free( Port->Saved );
+        free( Port->Tables );
+        free( Port );
+        return;
+    }
+
+    if ((!Identify( Port, Id )) ||
+        (!AtaGetCapacity( Id, &Port->Disk.nTotalSectors, &Port->Disk.nBytesPerSector )))
+    {
+        /* Not a disk we can drive, give the port back */
+        AhciRelease( &Port->Disk );
+        free( Port->Saved );
+        free( Port->Tables );
+        free( Port );
+        return;
+    }
+
+    if ((Cap & HBA_CAP_SNCQ) && (Id[ID_SATA_CAPABILITIES] & ID_SATA_NCQ))
+    {
+        /* Keep as many commands queued as both ends allow */
+        Port->useNcq = TRUE;
+        Port->nSlots = MIN( Port->nSlots, (Id[ID_QUEUE_DEPTH] & 0x1F) + 1 );
+    }
+
+    Port->Disk.Read        = AhciRead;
+    Port->Disk.Submit      = AhciSubmit;
+    Port->Disk.Poll        = AhciPoll;
+    Port->Disk.Abort       = AhciAbort;
+    Port->Disk.Release     = AhciRelease;
+    Port->Disk.MaxTransfer = Port->nSlots * AHCI_CHUNK_SECTORS;
+    Port->Disk.MaxSubmit   = AHCI_CHUNK_SECTORS;
+    Port->Disk.Alignment   = 2;     /* Data base addresses must be even */
+    Port->Disk.Pci         = *Pci;
+
+    RegisterDisk( &Port->Disk );
+}
+
+/*
+ * Registers the SATA disks on an AHCI controller. The BIOS keeps ownership
+ * of the HBA; we share its ports and hand them back before leaving.
+ */
+static BOOL AhciStart( PCI_DEVICE* Pci, BOOL* isReset )
+{
+    CHAR*   Abar = (CHAR*)PciGetBar( Pci, 5 );
+    USHORT* Id   = malloc( 512 );
+    UINT    iPort;
+
+    if (Id == NULL)
+    {
+        return FALSE;
+    }
+
+    PciEnable( Pci, PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER );
+    REG( Abar, HBA_GHC ) |= HBA_GHC_AE;
+
+    for (iPort = 0; iPort < 32; iPort++)
+    {
+        if (REG( Abar, HBA_PI ) & (1UL << iPort))
+        {
+            ProbePort( Pci, Abar, iPort, Id );
+        }
+    }
+
+    free( Id );
+    return TRUE;
+}
+
+/*
+ * Finds all AHCI controllers.
+ */
+VOID AhciProbe( VOID )
+{
+    PCI_DEVICE Pci;
+    ULONG      Index;
+
+    for (Index = 0; PciFindClass( PCI_CLASS_STORAGE, PCI_STORAGE_SATA, Index, &Pci ); Index++)
+    {
+        if ((Pci.ProgIf == PCI_SATA_AHCI) && (PciGetBar( &Pci, 5 ) != 0))
+        {
+            RegisterController( &Pci, AhciStart );
+        }
+    }
+}
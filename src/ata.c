@@ -0,0 +1,462 @@
+#include <ata.h>
+#include <disk.h>
+#include <pci.h>
+#include <port.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Command block registers */
+#define ATA_DATA          0
+#define ATA_ERROR         1
+#define ATA_COUNT         2
+#define ATA_LBA_LOW       3
+#define ATA_LBA_MID       4
+#define ATA_LBA_HIGH      5
+#define ATA_DEVICE        6
+#define ATA_STATUS        7
+#define ATA_COMMAND       7
+
+/* Device control register (the control block) */
+#define ATA_CTL_SRST      0x04
+
+/* Device register */
+#define ATA_DEV_MASTER    0xA0
+#define ATA_DEV_SLAVE     0xB0
+
+/* Bus master IDE registers, per channel */
+#define BM_COMMAND        0
+#define BM_STATUS         2
+#define BM_PRDT           4
+#define BM_CHANNEL_SIZE   8
+
+#define BM_CMD_START      0x01
+#define BM_CMD_READ       0x08  /* The device writes to memory */
+
+#define BM_SR_ACTIVE      0x01
+#define BM_SR_ERROR       0x02
+#define BM_SR_IRQ         0x04
+
+/* Programming interface bits of the IDE class */
+#define IDE_NATIVE(ch)    (1 << (2 * (ch)))
+#define IDE_BUS_MASTER    0x80
+
+/* Physical Region Descriptor */
+typedef struct _ATA_PRD
+{
+    ULONG  Base;
+    USHORT Count;       /* 0 means 64 kB */
+    USHORT Flags;
+} PACKED ATA_PRD;
+
+#define PRD_END_OF_TABLE  0x8000
+
+#define ATA_MAX_BYTES     0x20000   /* Most bytes per command                    */
+#define ATA_MAX_PRDS      4         /* ATA_MAX_BYTES spans this many 64 kB pages */
+#define ATA_TIMEOUT       0x400000  /* Status polls before giving up             */
+
+typedef struct _ATA_CHANNEL
+{
+    USHORT   Base;      /* Command block                      */
+    USHORT   Control;   /* Alternate status or device control */
+    USHORT   BusMaster; /* Bus master registers, or 0         */
+    ATA_PRD* Prdt;
+} ATA_CHANNEL;
+
+typedef struct _ATA_DRIVE
+{
+    DISK         Disk;
+    ATA_CHANNEL* Channel;
+    UCHAR        Select;    /* ATA_DEV_MASTER or ATA_DEV_SLAVE */
+    BOOL         isLba48;
+    BOOL         useDma;
+} ATA_DRIVE;
+
+/* Gives the device 400ns to put its status on the bus */
+static VOID Delay( ATA_CHANNEL* Channel )
+{
+    INT i;
+
+    for (i = 0; i < 4; i++)
+    {
+        inb( Channel->Control );
+    }
+}
+
+/* Waits for BSY to clear. Returns the status, which still has BSY set on timeout */
+static UCHAR WaitNotBusy( ATA_CHANNEL* Channel )
+{
+    ULONG i;
+    UCHAR Status = ATA_SR_BSY;
+
+    for (i = 0; (i < ATA_TIMEOUT) && (Status & ATA_SR_BSY); i++)
+    {
+        Status = inb( Channel->Control );
+    }
+
+    return Status;
+}
+
+/* Soft resets both devices on the channel, used after a failed command */
+static VOID ResetChannel( ATA_CHANNEL* Channel )
+{
+    outb( Channel->Control, ATA_CTL_SRST );
+    Delay( Channel );
+    outb( Channel->Control, 0 );
+    Delay( Channel );
+    WaitNotBusy( Channel );
+}
+
+/* Sends a read command for @nSectors (at most 256) sectors at @Sector */
+static BOOL IssueCommand( ATA_DRIVE* Drive, UCHAR Command, ULONGLONG Sector, ULONG nSectors )
+{
+    ATA_CHANNEL* Channel = Drive->Channel;
+    UCHAR        Device  = Drive->Select | ATA_DEV_LBA;
+
+    if (!Drive->isLba48)
+    {
+        /* LBA28 keeps the top four address bits in the device register */
+        Device |= (Sector >> 24) & 0x0F;
+    }
+
+    if (WaitNotBusy( Channel ) & (ATA_SR_BSY | ATA_SR_DRQ))
+    {
+        return FALSE;
+    }
+
+    outb( Channel->Base + ATA_DEVICE, Device );
+    Delay( Channel );
+    if (WaitNotBusy( Channel ) & (ATA_SR_BSY | ATA_SR_DRQ))
+    {
+        return FALSE;
+    }
+
+    if (Drive->isLba48)
+    {
+        /* High order bytes first */
+        outb( Channel->Base + ATA_COUNT,    nSectors >> 8 );
+        outb( Channel->Base + ATA_LBA_LOW,  Sector >> 24 );
+        outb( Channel->Base + ATA_LBA_MID,  Sector >> 32 );
+        outb( Channel->Base + ATA_LBA_HIGH, Sector >> 40 );
+    }
+
+    outb( Channel->Base + ATA_COUNT,    nSectors );
+    outb( Channel->Base + ATA_LBA_LOW,  Sector );
+    outb( Channel->Base + ATA_LBA_MID,  Sector >> 8 );
+    outb( Channel->Base + ATA_LBA_HIGH, Sector >> 16 );
+    outb( Channel->Base + ATA_COMMAND,  Command );
+
+    return TRUE;
+}
+
+static ULONG PioRead( ATA_DRIVE* Drive, ULONGLONG Sector, ULONG nSectors, VOID* Buffer )
+{
+    ATA_CHANNEL* Channel = Drive->Channel;
+    ULONG        Read;
+
+    if (!IssueCommand( Drive, Drive->isLba48 ? ATA_CMD_READ_EXT : ATA_CMD_READ, Sector, nSectors ))
+    {
+        return 0;
+    }
+
+    for (Read = 0; Read < nSectors; Read++)
+    {
+        UCHAR Status;
+
+        Delay( Channel );
+        Status = WaitNotBusy( Channel );
+        if ((Status & (ATA_SR_BSY | ATA_SR_ERR | ATA_SR_DF)) || (~Status & ATA_SR_DRQ))
+        {
+            ResetChannel( Channel );
+            break;
+        }
+
+        insw( Channel->Base + ATA_DATA, Buffer, Drive->Disk.nBytesPerSector / 2 );
+        Buffer = (CHAR*)Buffer + Drive->Disk.nBytesPerSector;
+    }
+
+    /* Acknowledge the interrupt */
+    inb( Channel->Base + ATA_STATUS );
+    return Read;
+}
+
+static ULONG DmaRead( ATA_DRIVE* Drive, ULONGLONG Sector, ULONG nSectors, VOID* Buffer )
+{
+    ATA_CHANNEL* Channel = Drive->Channel;
+    ULONG        Address = (ULONG)Buffer;
+    ULONG        Left    = nSectors * Drive->Disk.nBytesPerSector;
+    ULONG        i;
+    UCHAR        Status;
+    UCHAR        BmStatus = 0;
+
+    /* Describe the buffer, no region may cross a 64 kB boundary */
+    for (i = 0; Left > 0; i++)
+    {
+        ULONG Size = MIN( Left, 0x10000 - (Address & 0xFFFF) );
+
+        Channel->Prdt[i].Base  = Address;
+        Channel->Prdt[i].Count = Size & 0xFFFF;
+        Channel->Prdt[i].Flags = (Size == Left) ? PRD_END_OF_TABLE : 0;
+
+        Address += Size;
+        Left    -= Size;
+    }
+
+    outb( Channel->BusMaster + BM_COMMAND, 0 );
+    outl( Channel->BusMaster + BM_PRDT,    (ULONG)Channel->Prdt );
+    outb( Channel->BusMaster + BM_COMMAND, BM_CMD_READ );
+    outb( Channel->BusMaster + BM_STATUS,  inb( Channel->BusMaster + BM_STATUS ) | BM_SR_ERROR | BM_SR_IRQ );
+
+    if (!IssueCommand( Drive, Drive->isLba48 ? ATA_CMD_DMA_EXT : ATA_CMD_DMA, Sector, nSectors ))
+    {
+        return 0;
+    }
+
+    outb( Channel->BusMaster + BM_COMMAND, BM_CMD_READ | BM_CMD_START );
+
+    /* Poll until the engine has run out of descriptors or the device is done */
+    for (i = 0; i < ATA_TIMEOUT; i++)
+    {
+        BmStatus = inb( Channel->BusMaster + BM_STATUS );
+        if ((BmStatus & (BM_SR_ERROR | BM_SR_IRQ)) || (~BmStatus & BM_SR_ACTIVE))
+        {
+            break;
+        }
+    }
+
+    Status   = WaitNotBusy( Channel );
+    BmStatus = inb( Channel->BusMaster + BM_STATUS );
+    outb( Channel->BusMaster + BM_COMMAND, 0 );
+
+    /* Acknowledge the interrupt */
+    inb( Channel->Base + ATA_STATUS );
+    outb( Channel->BusMaster + BM_STATUS, BmStatus | BM_SR_ERROR | BM_SR_IRQ );
+
+    if ((Status & (ATA_SR_BSY | ATA_SR_ERR | ATA_SR_DF | ATA_SR_DRQ)) ||
+        (BmStatus & (BM_SR_ERROR | BM_SR_ACTIVE)))
+    {
+        ResetChannel( Channel );
+        return 0;
+    }
+
+    return nSectors;
+}
+
+static ULONG AtaRead( DISK* Disk, ULONGLONG Sector, ULONG nSectors, VOID* Buffer )
+{
+    ATA_DRIVE* Drive = Disk->Data;
+    ULONG      Read;
+
+    if ((nSectors == 0) || (nSectors > Disk->MaxTransfer) || (Sector + nSectors > Disk->nTotalSectors))
+    {
+        return 0;
+    }
+
+    if ((Drive->useDma) && (~(ULONG)Buffer & 1))
+    {
+        if (DmaRead( Drive, Sector, nSectors, Buffer ) == nSectors)
+        {
+            return nSectors;
+        }
+
+        Read = PioRead( Drive, Sector, nSectors, Buffer );
+        if (Read == nSectors)
+        {
+            /* It's the DMA engine that fails, don't use it again */
+            Drive->useDma = FALSE;
+        }
+        return Read;
+    }
+
+    return PioRead( Drive, Sector, nSectors, Buffer );
+}
+
+BOOL AtaGetCapacity( USHORT* Id, ULONGLONG* nTotalSectors, ULONG* nBytesPerSector )
+{
+    if (~Id[49] & 0x0200)
+    {
+        /* No LBA */
+        return FALSE;
+    }
+
+    *nBytesPerSector = 512;
+    if ((Id[106] & 0xD000) == 0x5000)
+    {
+        /* Logical sectors are larger than 512 bytes */
+        *nBytesPerSector = (((ULONG)Id[118] << 16) | Id[117]) * 2;
+    }
+
+    *nTotalSectors = ((ULONG)Id[61] << 16) | Id[60];
+    if (Id[ID_FEATURES] & ID_FEATURES_LBA48)
+    {
+        *nTotalSectors = ((ULONGLONG)Id[103] << 48) | ((ULONGLONG)Id[102] << 32) |
+                         ((ULONGLONG)Id[101] << 16) | Id[100];
+    }
+
+    return (*nBytesPerSector != 0) && (*nTotalSectors != 0);
+}
+
+/* Reads the IDENTIFY DEVICE data into @Id. Returns FALSE if there's no ATA device */
+static BOOL Identify( ATA_DRIVE* Drive, USHORT* Id )
+{
+    ATA_CHANNEL* Channel = Drive->Channel;
+    UCHAR        Status;
+
+    outb( Channel->Base + ATA_DEVICE, Drive->Select );
+    Delay( Channel );
+    if (inb( Channel->Control ) == 0xFF)
+    {
+        /* Floating bus */
+        return FALSE;
+    }
+
+    outb( Channel->Base + ATA_COUNT,    0 );
+    outb( Channel->Base + ATA_LBA_LOW,  0 );
+    outb( Channel->Base + ATA_LBA_MID,  0 );
+    outb( Channel->Base + ATA_LBA_HIGH, 0 );
+    outb( Channel->Base + ATA_COMMAND,  ATA_CMD_IDENTIFY );
+    Delay( Channel );
+
+    if (inb( Channel->Control ) == 0)
+    {
+        /* No device */
+        return FALSE;
+    }
+
+    Status = WaitNotBusy( Channel );
+    if ((inb( Channel->Base + ATA_LBA_MID ) != 0) || (inb( Channel->Base + ATA_LBA_HIGH ) != 0))
+    {
+        /* ATAPI or SATA signature, this is not a plain ATA device */
+        inb( Channel->Base + ATA_STATUS );
+        return FALSE;
+    }
+
+    if ((Status & (ATA_SR_BSY | ATA_SR_ERR)) || (~Status & ATA_SR_DRQ))
+    {
+        inb( Channel->Base + ATA_STATUS );
+        return FALSE;
+    }
+
+    insw( Channel->Base + ATA_DATA, Id, 256 );
+    inb( Channel->Base + ATA_STATUS );
+    return TRUE;
+}
+
+/* Registers the drive selected by @Select if it's there. Returns TRUE if it is */
+static BOOL ProbeDrive( PCI_DEVICE* Pci, ATA_CHANNEL* Channel, UCHAR Select, USHORT* Id )
+{
+    ATA_DRIVE* Drive = malloc( sizeof(ATA_DRIVE) );
+
+    if (Drive == NULL)
+    {
+        return FALSE;
+    }
+
+    memset( Drive, 0, sizeof(ATA_DRIVE) );
+    Drive->Channel = Channel;
+    Drive->Select  = Select;
+
+    if ((!Identify( Drive, Id )) ||
+        (!AtaGetCapacity( Id, &Drive->Disk.nTotalSectors, &Drive->Disk.nBytesPerSector )))
+    {
+        /* No drive, or one we can't address */
+        free( Drive );
+        return FALSE;
+    }
+
+    Drive->isLba48 = (Id[ID_FEATURES] & ID_FEATURES_LBA48) != 0;
+    Drive->useDma  = (Channel->Prdt != NULL) && ((Id[88] & 0x7F00) || (Id[63] & 0x0700));
+
+    Drive->Disk.Read        = AtaRead;
+    Drive->Disk.MaxTransfer = MIN( 256, ATA_MAX_BYTES / Drive->Disk.nBytesPerSector );
+    Drive->Disk.Alignment   = 1;    /* Odd buffers are read with PIO */
+    Drive->Disk.Pci         = *Pci;
+    Drive->Disk.Data        = Drive;
+
+    RegisterDisk( &Drive->Disk );
+    return TRUE;
+}
+
+static VOID ProbeChannel( PCI_DEVICE* Pci, UINT iChannel, USHORT* Id )
+{
+    ATA_CHANNEL* Channel = malloc( sizeof(ATA_CHANNEL) );
+
+    if (Channel == NULL)
+    {
+        return;
+    }
+
+    if (Pci->ProgIf & IDE_NATIVE(iChannel))
+    {
+        Channel->Base    = PciGetBar( Pci, 2 * iChannel );
+        Channel->Control = PciGetBar( Pci, 2 * iChannel + 1 ) + 2;
+    }
+    else
+    {
+        /* Compatibility mode, the legacy ISA ports */
+        Channel->Base    = (iChannel == 0) ? 0x1F0 : 0x170;
+        Channel->Control = (iChannel == 0) ? 0x3F6 : 0x376;
+    }
+
+    Channel->BusMaster = 0;
+    Channel->Prdt      = NULL;
+    if ((Pci->ProgIf & IDE_BUS_MASTER) && (PciGetBar( Pci, 4 ) != 0))
+    {
+        /* The PRD table may not cross a 64 kB boundary, which the heap ensures */
+        Channel->Prdt = memalign( sizeof(ATA_PRD), ATA_MAX_PRDS * sizeof(ATA_PRD) );
+        if (Channel->Prdt != NULL)
+        {
+            Channel->BusMaster = PciGetBar( Pci, 4 ) + iChannel * BM_CHANNEL_SIZE;
+        }
+    }
+
+    if ((Channel->Base != 0) && (Channel->Control != 2))
+    {
+        BOOL Master = ProbeDrive( Pci, Channel, ATA_DEV_MASTER, Id );
+        BOOL Slave  = ProbeDrive( Pci, Channel, ATA_DEV_SLAVE,  Id );
+
+        if (Master || Slave)
+        {
+            return;
+        }
+    }
+
+    /* Nothing to drive on this channel */
+    free( Channel->Prdt );
+    free( Channel );
+}
+
+/*
+ * Registers the ATA hard disks on a PCI IDE controller. The channels aren't
+ * reset, so the BIOS can still use them.
+ */
+static BOOL AtaStart( PCI_DEVICE* Pci, BOOL* isReset )
+{
+    USHORT* Id = malloc( 512 );
+
+    if (Id == NULL)
+    {
+        return FALSE;
+    }
+
+    PciEnable( Pci, PCI_COMMAND_IO | PCI_COMMAND_MASTER );
+
+    ProbeChannel( Pci, 0, Id );
+    ProbeChannel( Pci, 1, Id );
+
+    free( Id );
+    return TRUE;
+}
+
+/*
+ * Finds all PCI IDE controllers.
+ */
+VOID AtaProbe( VOID )
+{
+    PCI_DEVICE Pci;
+    ULONG      Index;
+
+    for (Index = 0; PciFindClass( PCI_CLASS_STORAGE, PCI_STORAGE_IDE, Index, &Pci ); Index++)
+    {
+        RegisterController( &Pci, AtaStart );
+    }
+}
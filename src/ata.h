@@ -0,0 +1,37 @@
+#ifndef ATA_H
+#define ATA_H
+
+#include <types.h>
+
+/* Commands shared by the ATA and SATA drivers */
+#define ATA_CMD_READ           0x20
+#define ATA_CMD_READ_EXT       0x24
+#define ATA_CMD_DMA            0xC8
+#define ATA_CMD_DMA_EXT        0x25
+#define ATA_CMD_FPDMA_QUEUED   0x60
+#define ATA_CMD_IDENTIFY       0xEC
+
+/* Status register */
+#define ATA_SR_ERR             0x01
+#define ATA_SR_DRQ             0x08
+#define ATA_SR_DF              0x20
+#define ATA_SR_BSY             0x80
+
+/* Device register */
+#define ATA_DEV_LBA            0x40
+
+/* IDENTIFY DEVICE words */
+#define ID_QUEUE_DEPTH         75
+#define ID_SATA_CAPABILITIES   76
+#define ID_FEATURES            83
+
+#define ID_SATA_NCQ            0x0100   /* In ID_SATA_CAPABILITIES */
+#define ID_FEATURES_LBA48      0x0400   /* In ID_FEATURES          */
+
+/*
+ * Reads the capacity from the IDENTIFY DEVICE data in @Id. Returns FALSE if
+ * the device can't be addressed by LBA or reports no sectors.
+ */
+BOOL AtaGetCapacity( USHORT* Id, ULONGLONG* nTotalSectors, ULONG* nBytesPerSector );
+
+#endif
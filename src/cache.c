@@ -0,0 +1,157 @@
+#include <cache.h>
+#include <stdlib.h>
+
+/*
+ * Sector cache
+ *
+ * The cache is set-associative: a sector hashes to one set of CACHE_WAYS
+ * entries, so lookups and replacements never scan more than a single set.
+ */
+
+typedef struct _CACHE_ENTRY
+{
+    ULONG     Key;
+    ULONGLONG Sector;
+    ULONG     Time;
+    BOOL      IsMetadata;
+    VOID*     Data;         /* NULL if the entry is unused */
+} CACHE_ENTRY;
+
+static CACHE_ENTRY* Entries;
+static ULONG        SetMask;
+static ULONG        Time;
+
+/* Current slab of unused sector frames */
+static CHAR*        Slab;
+static ULONG        nSlabFrames;
+
+VOID CacheInitialize( ULONG MemorySize )
+{
+    ULONG nSets = 1;
+    ULONG i;
+
+    /* Use the largest power of two number of sets that fits */
+    while ((nSets < CACHE_MAX_SETS) && (2 * nSets * CACHE_WAYS * CACHE_FRAME_SIZE <= MemorySize))
+    {
+        nSets *= 2;
+    }
+
+    Slab        = NULL;
+    nSlabFrames = 0;
+    Time        = 0;
+    SetMask     = nSets - 1;
+    Entries     = malloc( nSets * CACHE_WAYS * sizeof(CACHE_ENTRY) );
+    if (Entries != NULL)
+    {
+        for (i = 0; i < nSets * CACHE_WAYS; i++)
+        {
+            Entries[i].Data = NULL;
+        }
+    }
+}
+
+static CACHE_ENTRY* GetSet( ULONG Key, ULONGLONG Sector )
+{
+    ULONG Hash = (ULONG)Sector ^ (ULONG)(Sector >> 32) ^ (Key * 0x9E3779B1);
+
+    return &Entries[ (Hash & SetMask) * CACHE_WAYS ];
+}
+
+VOID* CacheLookup( ULONG Key, ULONGLONG Sector )
+{
+    CACHE_ENTRY* Set;
+    ULONG        i;
+
+    if (Entries == NULL)
+    {
+        return NULL;
+    }
+
+    Set = GetSet( Key, Sector );
+    for (i = 0; i < CACHE_WAYS; i++)
+    {
+        if ((Set[i].Data != NULL) && (Set[i].Sector == Sector) && (Set[i].Key == Key))
+        {
+            /* Update access time */
+            Set[i].Time = Time++;
+            return Set[i].Data;
+        }
+    }
+
+    /* Sector not cached */
+    return NULL;
+}
+
+static VOID* AllocateFrame( VOID )
+{
+    if (nSlabFrames == 0)
+    {
+        /* Carve frames from a new slab */
+        Slab = malloc( CACHE_SLAB_FRAMES * CACHE_FRAME_SIZE );
+        if (Slab == NULL)
+        {
+            return NULL;
+        }
+        nSlabFrames = CACHE_SLAB_FRAMES;
+    }
+
+    nSlabFrames--;
+    return Slab + nSlabFrames * CACHE_FRAME_SIZE;
+}
+
+VOID* CacheInsert( ULONG Key, ULONGLONG Sector, BOOL IsMetadata )
+{
+    CACHE_ENTRY* Set;
+    CACHE_ENTRY* Entry = NULL;
+    ULONG        i;
+
+    if (Entries == NULL)
+    {
+        return NULL;
+    }
+
+    Set = GetSet( Key, Sector );
+    for (i = 0; i < CACHE_WAYS; i++)
+    {
+        if ((Set[i].Data != NULL) && (Set[i].Sector == Sector) && (Set[i].Key == Key))
+        {
+            /* Already cached, overwrite it */
+            Set[i].Time       = Time++;
+            Set[i].IsMetadata = Set[i].IsMetadata || IsMetadata;
+            return Set[i].Data;
+        }
+    }
+
+    for (i = 0; i < CACHE_WAYS; i++)
+    {
+        if (Set[i].Data == NULL)
+        {
+            /* Unused entry, give it a frame */
+            Set[i].Data = AllocateFrame();
+            if (Set[i].Data != NULL)
+            {
+                Entry = &Set[i];
+                break;
+            }
+        }
+        else if ((Entry == NULL) ||
+                 (Set[i].IsMetadata < Entry->IsMetadata) ||
+                 ((Set[i].IsMetadata == Entry->IsMetadata) && (Set[i].Time < Entry->Time)))
+        {
+            /* Least Recently Used; data sectors are replaced before metadata */
+            Entry = &Set[i];
+        }
+    }
+
+    if ((Entry == NULL) || ((Entry->IsMetadata) && (!IsMetadata)))
+    {
+        /* Nothing we may replace */
+        return NULL;
+    }
+
+    Entry->Key        = Key;
+    Entry->Sector     = Sector;
+    Entry->Time       = Time++;
+    Entry->IsMetadata = IsMetadata;
+    return Entry->Data;
+}
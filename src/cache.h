@@ -0,0 +1,30 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <types.h>
+
+#define CACHE_FRAME_SIZE  512   /* Bytes per cached sector                */
+#define CACHE_WAYS        8     /* Sectors per set                        */
+#define CACHE_SLAB_FRAMES 64    /* Frames allocated from the heap at once */
+#define CACHE_MAX_SETS    256   /* Keeps the set table in one heap block  */
+
+/*
+ * Sets up the sector cache. At most @MemorySize bytes will be used for
+ * sector frames; they are allocated from the heap as the cache fills up.
+ */
+VOID CacheInitialize( ULONG MemorySize );
+
+/*
+ * Returns the cached contents of sector @Sector of drive @Key, or NULL if
+ * the sector isn't cached.
+ */
+VOID* CacheLookup( ULONG Key, ULONGLONG Sector );
+
+/*
+ * Returns the frame that will hold sector @Sector of drive @Key. The caller
+ * fills it with CACHE_FRAME_SIZE bytes. Metadata is only ever replaced by
+ * other metadata. NULL is returned if no frame can be spared.
+ */
+VOID* CacheInsert( ULONG Key, ULONGLONG Sector, BOOL IsMetadata );
+
+#endif
@@ -0,0 +1,127 @@
+#include <clock.h>
+#include <port.h>
+
+/* PIT channel 2 can be gated and read back through the keyboard controller's port B */
+#define PIT_FREQUENCY       1193182
+#define PIT_CHANNEL2        0x42
+#define PIT_CONTROL         0x43
+#define PIT_PORT_B          0x61
+#define PORT_B_GATE2        0x01
+#define PORT_B_SPEAKER      0x02
+#define PORT_B_OUT2         0x20
+
+#define CALIBRATE_COUNT     11932       /* PIT ticks, 10 ms           */
+#define CALIBRATE_TIMEOUT   0x1000000   /* Port polls before giving up */
+
+/* Without a TSC, fall back to the BIOS timer tick count, which wraps at midnight */
+#define BIOS_TICKS          0x46C
+#define BIOS_TICKS_PER_DAY  0x1800B0
+#define BIOS_TICK_US        54925
+
+static ULONG           Frequency;  /* Ticks per ms                         */
+static ULONGLONG       Epoch;      /* Time stamp at calibration            */
+static volatile ULONG* BiosTicks;
+static ULONG           LastTicks;  /* BIOS tick count at the last read     */
+static ULONGLONG       Days;       /* Midnight wraps seen, in BIOS ticks   */
+static ULONG           Origin;     /* BIOS tick count at initialization    */
+static BOOL            Started;    /* Origin has been read                 */
+
+VOID ClockInitialize( VOID )
+{
+    ULONGLONG Start;
+    ULONGLONG End;
+    UCHAR     PortB;
+    ULONG     i;
+
+    Frequency = 0;
+    Epoch     = 0;
+    BiosTicks = (volatile ULONG*)BIOS_TICKS;
+    LastTicks = 0;
+    Origin    = 0;
+    Started   = FALSE;
+    Days      = 0;
+    if (~GetCpuFeatures() & CPU_FEATURE_TSC)
+    {
+        /* Pre-Pentium CPU; the BIOS tick count starts from here */
+        GetClockNs();
+        return;
+    }
+
+    /* Count down once on channel 2 with the speaker off; OUT2 goes high at zero */
+    PortB = inb( PIT_PORT_B );
+    outb( PIT_PORT_B, (PortB & ~PORT_B_SPEAKER) | PORT_B_GATE2 );
+    outb( PIT_CONTROL, 0xB0 );      /* Channel 2, low and high byte, mode 0 */
+    outb( PIT_CHANNEL2, LOBYTE(CALIBRATE_COUNT) );
+    outb( PIT_CHANNEL2, HIBYTE(CALIBRATE_COUNT) );
+
+    Start = ReadTimeStamp();
+    for (i = 0; (i < CALIBRATE_TIMEOUT) && (~inb( PIT_PORT_B ) & PORT_B_OUT2); i++);
+    End = ReadTimeStamp();
+
+    outb( PIT_PORT_B, PortB );
+
+    if (i < CALIBRATE_TIMEOUT)
+    {
+        Frequency = (ULONG)((End - Start) * PIT_FREQUENCY / CALIBRATE_COUNT / 1000);
+        Epoch     = Start;
+    }
+    else
+    {
+        /* The PIT never counted down; use the BIOS tick count */
+        GetClockNs();
+    }
+}
+
+ULONG GetClockFrequency( VOID )
+{
+    return Frequency;
+}
+
+ULONGLONG ReadClock( VOID )
+{
+    return (Frequency != 0) ? ReadTimeStamp() : 0;
+}
+
+ULONGLONG GetClockNs( VOID )
+{
+    ULONGLONG Ticks;
+    ULONG     Now;
+
+    if (Frequency != 0)
+    {
+        /* Split the division so the multiplication can't overflow */
+        Ticks = ReadTimeStamp() - Epoch;
+        return (Ticks / Frequency) * 1000000 + (Ticks % Frequency) * 1000000 / Frequency;
+    }
+
+    /* The BIOS count only advances while interrupts are serviced in real mode */
+    Now = *BiosTicks;
+    if (!Started)
+    {
+        /* First read, from ClockInitialize() */
+        Origin    = Now;
+        LastTicks = Now;
+        Started   = TRUE;
+    }
+    if (Now < LastTicks)
+    {
+        Days += BIOS_TICKS_PER_DAY;
+    }
+    LastTicks = Now;
+    return (Days + Now - Origin) * BIOS_TICK_US * 1000;
+}
+
+ULONG GetClockMs( VOID )
+{
+    return (ULONG)(GetClockNs() / 1000000);
+}
+
+ULONGLONG SetTimeout( ULONG Milliseconds )
+{
+    return GetClockNs() + (ULONGLONG)Milliseconds * 1000000;
+}
+
+BOOL HasTimedOut( ULONGLONG Deadline )
+{
+    return GetClockNs() >= Deadline;
+}
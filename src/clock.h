@@ -0,0 +1,51 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <types.h>
+
+/*
+ * Name of the module that passes the clock frequency on to the kernel, if the
+ * image asks for it; it holds the text "tsc_khz=<ticks per ms>\n".
+ */
+#define CLOCK_MODULE_NAME "osldr.clock"
+
+/*
+ * Calibrates the clock, the CPU's time stamp counter, against the PIT.
+ * Must be called before the other functions.
+ */
+VOID ClockInitialize( VOID );
+
+/*
+ * Returns the clock frequency in ticks per millisecond, or 0 if there is no
+ * usable clock.
+ */
+ULONG GetClockFrequency( VOID );
+
+/*
+ * Returns the current clock tick, or 0 if there is no usable clock.
+ */
+ULONGLONG ReadClock( VOID );
+
+/*
+ * Returns the nanoseconds since ClockInitialize(); the value never goes back.
+ * Without a usable clock this falls back to the BIOS timer tick count, which
+ * only advances while the loader waits in real mode, in steps of about 55 ms.
+ */
+ULONGLONG GetClockNs( VOID );
+
+/*
+ * Returns GetClockNs() in milliseconds.
+ */
+ULONG GetClockMs( VOID );
+
+/*
+ * Returns a deadline @Milliseconds from now, for HasTimedOut().
+ */
+ULONGLONG SetTimeout( ULONG Milliseconds );
+
+/*
+ * Returns TRUE once the clock has passed @Deadline.
+ */
+BOOL HasTimedOut( ULONGLONG Deadline );
+
+#endif
@@ -1,4 +1,5 @@
 #include <ctype.h>
+#include <serial.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -39,6 +40,40 @@ static BOOL ParseDirective( CONFIG* config, CHAR* name, CHAR* value, BOOL inHead
 
         config->Timeout = timeout;
     }
+    else if (stricmp(name, "Serial") == 0)
+    {
+        /* COM1 - COM4 or an I/O port, optionally followed by the baud rate */
+        CHAR* endptr;
+
+        if (inHeader)
+        {
+            PrintMessage( MSG_CONF_DIR_INSIDE_SECTION, name );
+            return FALSE;
+        }
+
+        if ((toupper(value[0]) == 'C') && (toupper(value[1]) == 'O') && (toupper(value[2]) == 'M'))
+        {
+            config->SerialPort = GetComPort( strtoul( value + 3, &endptr, 10 ) );
+        }
+        else
+        {
+            config->SerialPort = strtoul( value, &endptr, 0 );
+        }
+
+        while (isspace(*endptr)) endptr++;
+        if (*endptr == ',')
+        {
+            value = endptr + 1;
+            config->SerialBaud = strtoul( value, &endptr, 0 );
+            if (endptr == value) config->SerialBaud = 0;
+        }
+
+        if ((config->SerialPort == 0) || (config->SerialBaud == 0))
+        {
+            PrintMessage( MSG_CONF_INVALID_SERIAL, name );
+            return FALSE;
+        }
+    }
     else if (!inHeader)
     {
         PrintError( MSG_CONF_DIR_OUTSIDE_SECTION, name );
@@ -113,6 +148,14 @@ static BOOL ParseDirective( CONFIG* config, CHAR* name, CHAR* value, BOOL inHead
         img->Modules[ img->nModules ].Reserved = 0;
         img->nModules++;
     }
+    else if (stricmp(name, "BootLog") == 0)
+    {
+        img->BootLog = (stricmp( value, "Yes" ) == 0);
+    }
+    else if (stricmp(name, "PassClock") == 0)
+    {
+        img->PassClock = (stricmp( value, "Yes" ) == 0);
+    }
     else if (stricmp(name, "Type") == 0)
     {
         if      (stricmp(value, "Binary")      == 0) img->Type = IT_BINARY;
@@ -193,6 +236,8 @@ static IMAGE* CreateImage( CHAR* name )
     image->Type        = IT_AUTO;
     image->Address     = 0;
     image->Drive       = 0xFFFFFFFF;
+    image->BootLog     = FALSE;
+    image->PassClock   = FALSE;
     image->Command     = NULL;
     image->Modules     = NULL;
     image->nModules    = 0;
@@ -226,6 +271,8 @@ BOOL ParseConfigFile( FILE* file, CONFIG* config )
     config->Default = NULL;
     config->Images  = NULL;
     config->Timeout = 120;      /* Default to two minutes */
+    config->SerialPort = 0;
+    config->SerialBaud = SERIAL_DEFAULT_BAUD;
 
     size = ReadFile( file, buffer, size );
     if (size == 0)
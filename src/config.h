@@ -20,6 +20,8 @@ struct _IMAGE
     UINT   Type;      /* Type of the image (ignored for devices)  */
     ULONG  Address;   /* Only valid if Type is IT_BINARY          */
     ULONG  Drive;     /* Only valid is Type is IT_BOOTSECTOR      */
+    BOOL   BootLog;   /* Pass the boot log as the last module     */
+    BOOL   PassClock; /* Pass the clock frequency as a module     */
 
     ULONG   nModules;
     MODULE* Modules;  /* Modules */
@@ -34,9 +36,11 @@ struct _IMAGE
 
 typedef struct _CONFIG
 {
-    ULONG  Timeout;   /* Wait this many seconds before booting default */
-    IMAGE* Default;   /* Default image    */
-    ULONG  nImages;   /* Number of images */
+    ULONG  Timeout;    /* Wait this many seconds before booting default */
+    USHORT SerialPort; /* Serial console I/O port, 0 for none */
+    ULONG  SerialBaud; /* Serial console baud rate */
+    IMAGE* Default;    /* Default image    */
+    ULONG  nImages;    /* Number of images */
 
     IMAGE* Images;
 } CONFIG;
@@ -1,10 +1,144 @@
 #include <bios.h>
+#include <clock.h>
+#include <conio.h>
+#include <console.h>
+#include <keyboard.h>
+#include <stdlib.h>
 #include <types.h>
 
+/*
+ * Keys come from the keyboard controller, or the BIOS if there is none, and
+ * from terminals on the console (a serial console), whose VT100/ANSI key
+ * sequences are turned into the same codes.
+ */
+
+#define SEQUENCE_TIMEOUT_MS    50      /* Longest gap within an escape sequence */
+#define SEQUENCE_TIMEOUT_LOOPS 0x40000 /* The same, without a clock            */
+
+/* A key read from the keyboard or a terminal, or -1 */
+static INT Pending = -1;
+
+/* Key codes for "ESC [ n ~" sequences, by n */
+static CONST UCHAR TildeKeys[] =
+{
+    0,       VK_HOME, VK_INSERT, VK_DELETE, VK_END,  VK_PREV, VK_NEXT, VK_HOME,
+    VK_END,  0,       0,         VK_F1,     VK_F2,   VK_F3,   VK_F4,   VK_F5,
+    0,       VK_F6,   VK_F7,     VK_F8,     VK_F9,   VK_F10,  0,       VK_F11,
+    VK_F12
+};
+
+/* Returns the next byte of an escape sequence, or -1 if none follows soon */
+static INT ReadSequenceByte( VOID )
+{
+    ULONGLONG Deadline = SetTimeout( SEQUENCE_TIMEOUT_MS );
+    ULONG     i;
+    INT       c;
+
+    for (i = 0; ; i++)
+    {
+        if ((c = ReadConsole()) >= 0)
+        {
+            return c;
+        }
+
+        /* The fallback clock doesn't run here, so count polls instead */
+        if ((GetClockFrequency() != 0) ? HasTimedOut( Deadline ) : (i >= SEQUENCE_TIMEOUT_LOOPS))
+        {
+            return -1;
+        }
+    }
+}
+
+/* Decodes the final byte of "ESC [ x" and "ESC O x" sequences */
+static INT DecodeFinal( INT c )
+{
+    switch (c)
+    {
+        case 'A': return VK_UP;
+        case 'B': return VK_DOWN;
+        case 'C': return VK_RIGHT;
+        case 'D': return VK_LEFT;
+        case 'H': return VK_HOME;
+        case 'F': return VK_END;
+        case 'P': return VK_F1;
+        case 'Q': return VK_F2;
+        case 'R': return VK_F3;
+        case 'S': return VK_F4;
+    }
+    return -1;
+}
+
+/* Reads a key from a terminal on the console. Returns -1 if there is none. */
+static INT ReadTerminalKey( VOID )
+{
+    INT   c = ReadConsole();
+    ULONG Param;
+
+    if ((c == '\r') || (c == '\n')) return VK_ENTER;
+    if ((c >= '1') && (c <= '9'))   return VK_1 + (c - '1');
+    if (c == '0')                   return VK_0;
+    if (c != 0x1B)                  return -1;
+
+    c = ReadSequenceByte();
+    if (c < 0)
+    {
+        /* A lone escape */
+        return VK_ESC;
+    }
+
+    if (c == 'O')
+    {
+        return DecodeFinal( ReadSequenceByte() );
+    }
+
+    if (c != '[')
+    {
+        return -1;
+    }
+
+    /* Control sequence: a number, maybe modifiers, and a final byte */
+    Param = 0;
+    while (((c = ReadSequenceByte()) >= '0') && (c <= '9'))
+    {
+        Param = Param * 10 + (c - '0');
+    }
+    while ((c == ';') || ((c >= '0') && (c <= '9')))
+    {
+        c = ReadSequenceByte();
+    }
+
+    if (c == '~')
+    {
+        return ((Param < sizeof(TildeKeys)) && (TildeKeys[ Param ] != 0)) ? TildeKeys[ Param ] : -1;
+    }
+    return DecodeFinal( c );
+}
+
 INT kbhit( VOID )
 {
     REGS regs;
 
+    if (Pending < 0)
+    {
+        Pending = ReadKeyboard();
+    }
+
+    if ((Pending < 0) && (HasConsoleInput()))
+    {
+        Pending = ReadTerminalKey();
+    }
+
+    if (Pending >= 0)
+    {
+        return TRUE;
+    }
+
+    if (IsKeyboardNative())
+    {
+        /* The BIOS doesn't get any keys */
+        return FALSE;
+    }
+
     regs.h.ah = 0x11;
     int86( 0x16, &regs, &regs );
 
@@ -15,10 +149,24 @@ INT kbhit( VOID )
 INT getch( VOID )
 {
     REGS regs;
+    INT  c;
+
+    /* Unless only the BIOS has keys, wait for one here */
+    while (((IsKeyboardNative()) || (HasConsoleInput())) && (!kbhit()))
+    {
+        WaitForInterrupt();
+    }
+
+    if (Pending >= 0)
+    {
+        c       = Pending;
+        Pending = -1;
+        return c;
+    }
 
     regs.h.ah = 0x10;
     int86( 0x16, &regs, &regs );
 
-    /* Return scan code (!) */
-    return regs.h.ah;
+    /* Return scan code (!), the same set as ReadKeyboard() */
+    return TranslateBiosKey( regs.x.ax );
 }
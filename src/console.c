@@ -0,0 +1,215 @@
+#include <console.h>
+#include <port.h>
+#include <video.h>
+
+/*
+ * Console layer
+ *
+ * Collects output in a line buffer and hands it to each console driver in
+ * one piece: the screen, a serial terminal if one was set up, the debug
+ * console of emulators, and the boot log.
+ */
+
+#define LINE_SIZE      128
+
+#define DEBUGCON_PORT  0xE9     /* Bochs and QEMU; reads back as 0xE9 */
+
+static CONSOLE* Consoles;
+static UCHAR    Attr;
+static CHAR     Line[ LINE_SIZE ];
+static ULONG    LineLength;
+static BOOL     DebugconAtLineStart;
+
+/*
+ * The debug console is a plain stream, so cursor moves just start a new line
+ */
+static VOID DebugconWrite( CONSOLE* Console, CONST CHAR* s, ULONG Length, UCHAR Attr )
+{
+    while (Length-- > 0)
+    {
+        if (*s != '\r')
+        {
+            outb( DEBUGCON_PORT, *s );
+            DebugconAtLineStart = (*s == '\n');
+        }
+        s++;
+    }
+}
+
+static VOID DebugconGotoXY( CONSOLE* Console, ULONG X, ULONG Y )
+{
+    if (!DebugconAtLineStart)
+    {
+        DebugconWrite( Console, "\n", 1, 0 );
+    }
+}
+
+static VOID DebugconClear( CONSOLE* Console, UCHAR Attr )
+{
+    DebugconGotoXY( Console, 0, 0 );
+}
+
+static VOID DebugconShowCursor( CONSOLE* Console, BOOL Show )
+{
+}
+
+static CONSOLE DebugconConsole = { DebugconWrite, DebugconGotoXY, DebugconClear, DebugconShowCursor, NULL, NULL, NULL };
+
+VOID ConsoleInitialize( VOID )
+{
+    Consoles   = NULL;
+    Attr       = 7;
+    LineLength = 0;
+
+    VideoInitialize();
+
+    if (inb( DEBUGCON_PORT ) == DEBUGCON_PORT)
+    {
+        DebugconAtLineStart = TRUE;
+        AddConsole( &DebugconConsole );
+    }
+}
+
+VOID AddConsole( CONSOLE* Console )
+{
+    CONSOLE** Last = &Consoles;
+
+    while (*Last != NULL)
+    {
+        if (*Last == Console)
+        {
+            return;
+        }
+        Last = &(*Last)->Next;
+    }
+
+    Console->Next = NULL;
+    *Last         = Console;
+}
+
+VOID UpdateConsole( VOID )
+{
+    CONSOLE* Console;
+
+    if (LineLength > 0)
+    {
+        for (Console = Consoles; Console != NULL; Console = Console->Next)
+        {
+            Console->Write( Console, Line, LineLength, Attr );
+        }
+        LineLength = 0;
+    }
+}
+
+BOOL HasConsoleInput( VOID )
+{
+    CONSOLE* Console;
+
+    for (Console = Consoles; Console != NULL; Console = Console->Next)
+    {
+        if (Console->Read != NULL)
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+INT ReadConsole( VOID )
+{
+    CONSOLE* Console;
+    INT      c;
+
+    UpdateConsole();
+
+    for (Console = Consoles; Console != NULL; Console = Console->Next)
+    {
+        if ((Console->Read != NULL) && ((c = Console->Read( Console )) >= 0))
+        {
+            return c;
+        }
+    }
+    return -1;
+}
+
+VOID FlushConsole( VOID )
+{
+    CONSOLE* Console;
+
+    UpdateConsole();
+
+    for (Console = Consoles; Console != NULL; Console = Console->Next)
+    {
+        if (Console->Flush != NULL)
+        {
+            Console->Flush( Console );
+        }
+    }
+}
+
+INT WriteChar( CHAR c )
+{
+    Line[ LineLength++ ] = c;
+
+    if ((c == '\n') || (LineLength == LINE_SIZE))
+    {
+        UpdateConsole();
+    }
+    return c;
+}
+
+VOID ShowCursor( BOOL Show )
+{
+    CONSOLE* Console;
+
+    UpdateConsole();
+
+    for (Console = Consoles; Console != NULL; Console = Console->Next)
+    {
+        Console->ShowCursor( Console, Show );
+    }
+}
+
+VOID GotoXY( ULONG X, ULONG Y )
+{
+    CONSOLE* Console;
+
+    UpdateConsole();
+
+    for (Console = Consoles; Console != NULL; Console = Console->Next)
+    {
+        Console->GotoXY( Console, X, Y );
+    }
+}
+
+VOID ClearScreen( VOID )
+{
+    CONSOLE* Console;
+
+    UpdateConsole();
+
+    for (Console = Consoles; Console != NULL; Console = Console->Next)
+    {
+        Console->Clear( Console, Attr );
+    }
+}
+
+/* The line buffer holds text of one attribute */
+static VOID SetAttribute( UCHAR NewAttr )
+{
+    if (NewAttr != Attr)
+    {
+        UpdateConsole();
+        Attr = NewAttr;
+    }
+}
+
+VOID SetBkColor( UCHAR color )
+{
+    SetAttribute( (Attr & 0x0F) | (color << 4) );
+}
+
+VOID SetTextColor( UCHAR color )
+{
+    SetAttribute( (Attr & 0xF0) | (color & 0x0F) );
+}
@@ -0,0 +1,79 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <types.h>
+
+#define COLOR_BLACK         0
+#define COLOR_BLUE          1
+#define COLOR_GREEN         2
+#define COLOR_CYAN          3
+#define COLOR_RED           4
+#define COLOR_MAGENTA       5
+#define COLOR_BROWN         6
+#define COLOR_LIGHTGRAY     7
+#define COLOR_DARKGRAY      8
+#define COLOR_LIGHTBLUE     9
+#define COLOR_LIGHTGREEN   10
+#define COLOR_LIGHTCYAN    11
+#define COLOR_LIGHTRED     12
+#define COLOR_LIGHTMAGENTA 13
+#define COLOR_YELLOW       14
+#define COLOR_WHITE        15
+
+typedef struct _CONSOLE CONSOLE;
+
+/*
+ * A console driver. Everything written to the console goes to all of them,
+ * a line or less at a time. Attributes are VGA text attributes: background
+ * in the high nibble, foreground in the low one.
+ */
+struct _CONSOLE
+{
+    VOID (*Write)(CONSOLE*, CONST CHAR* s, ULONG Length, UCHAR Attr);
+    VOID (*GotoXY)(CONSOLE*, ULONG X, ULONG Y);
+    VOID (*Clear)(CONSOLE*, UCHAR Attr);    /* Also moves the cursor home */
+    VOID (*ShowCursor)(CONSOLE*, BOOL Show);
+
+    /* Optional */
+    INT  (*Read)(CONSOLE*);                 /* Received byte, or -1 if none    */
+    VOID (*Flush)(CONSOLE*);                /* Waits until all output is shown */
+
+    CONSOLE* Next;
+};
+
+/*
+ * Resets the console to just the screen, plus the debug console port of
+ * emulators that have one.
+ */
+VOID ConsoleInitialize( VOID );
+
+/* Adds @Console to the console. Adding a console again has no effect. */
+VOID AddConsole( CONSOLE* Console );
+
+/* Returns TRUE if a console driver takes input */
+BOOL HasConsoleInput( VOID );
+
+/* Returns the next byte received by a console driver, or -1 if none */
+INT  ReadConsole( VOID );
+
+/*
+ * Hands buffered output to the console drivers. The C library does this at
+ * the end of every call; output is only buffered in between.
+ */
+VOID UpdateConsole( VOID );
+
+/* Waits until all output has been shown; call before leaving osldr */
+VOID FlushConsole( VOID );
+
+/*
+ * Writes @c at the cursor. Output is buffered until a newline, a cursor
+ * move, a color change or UpdateConsole().
+ */
+INT  WriteChar( CHAR c );
+VOID ShowCursor( BOOL Show );
+VOID GotoXY( ULONG X, ULONG Y );
+VOID ClearScreen( VOID );
+VOID SetBkColor( UCHAR color );
+VOID SetTextColor( UCHAR color );
+
+#endif
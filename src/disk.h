@@ -0,0 +1,71 @@
+#ifndef DISK_H
+#define DISK_H
+
+#include <types.h>
+#include <pci.h>
+
+/*
+ * A disk that is driven natively from protected mode instead of through the
+ * BIOS. Disk drivers register their disks when their controller is started;
+ * the drive layer then binds each one to the BIOS drive it backs.
+ */
+typedef struct _DISK DISK;
+
+struct _DISK
+{
+    /*
+     * Reads at most MaxTransfer sectors into @Buffer, which may lie anywhere
+     * in memory but must be a multiple of Alignment.
+     * The number of read sectors is returned.
+     */
+    ULONG (*Read)( DISK* Disk, ULONGLONG Sector, ULONG nSectors, VOID* Buffer );
+
+    /*
+     * Asynchronous reads, optional. Submit queues a read of at most MaxSubmit
+     * sectors and returns its tag, or -1 if no more reads can be queued.
+     * Poll returns the tag of a finished read and the number of read sectors
+     * in @nRead, or -1 if none has finished yet. Abort gives up on all queued
+     * reads. Read is only called while no reads are queued.
+     */
+    INT  (*Submit)( DISK* Disk, ULONGLONG Sector, ULONG nSectors, VOID* Buffer );
+    INT  (*Poll)( DISK* Disk, ULONG* nRead );
+    VOID (*Abort)( DISK* Disk );
+
+    /*
+     * Optional. Undoes what the driver changed in a controller the BIOS still
+     * uses, before control passes on. The disk may still be read afterwards.
+     */
+    VOID (*Release)( DISK* Disk );
+
+    ULONGLONG  nTotalSectors;
+    ULONG      nBytesPerSector;
+    ULONG      MaxTransfer;     /* Most sectors per Read call         */
+    ULONG      MaxSubmit;       /* Most sectors per Submit call       */
+    ULONG      Alignment;       /* Required buffer alignment in bytes */
+    PCI_DEVICE Pci;             /* The controller                     */
+    BOOL       isBound;         /* Backs a BIOS drive                 */
+    VOID*      Data;            /* Driver specific data               */
+    DISK*      Next;
+};
+
+/*
+ * Adds @Disk to the native disks. Called by the disk drivers.
+ */
+VOID RegisterDisk( DISK* Disk );
+
+/*
+ * Takes the controller at @Pci from the BIOS and registers its disks.
+ * Returns FALSE if that failed. Drivers that reset the controller set
+ * @isReset once they did, whether starting it fails afterwards or not,
+ * since the BIOS can't reach its disks anymore.
+ */
+typedef BOOL (*DISKSTARTFUNC)( PCI_DEVICE* Pci, BOOL* isReset );
+
+/*
+ * Adds the controller at @Pci to the ones the native drivers can take over.
+ * Called by the disk drivers while probing, which must leave the controller
+ * alone: @Start is only called once a BIOS drive is known to live on it.
+ */
+VOID RegisterController( PCI_DEVICE* Pci, DISKSTARTFUNC Start );
+
+#endif
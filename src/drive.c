@@ -1,8 +1,10 @@
 #include <bios.h>
+#include <stdlib.h>
 #include <string.h>
 #include <drive.h>
-
-#define DRIVE_INFO_LENGTH    16    /* Wise to make it a power of 2 */
+#include <errno.h>
+#include <log.h>
+#include <messages.h>
 
 /* BIOS Disk base table (for Int 13h) */
 typedef struct _DISK_BASE_TABLE
@@ -20,188 +22,697 @@ typedef struct _DISK_BASE_TABLE
     UCHAR MotorStartupTime;
 } PACKED DISK_BASE_TABLE;
 
-static USHORT     DriveParametersCount = 0;
-static DRIVE_INFO DriveParameters[ DRIVE_INFO_LENGTH ];
+/* INT 13h/AH=48h Drive Parameters, up to EDD 3.0 */
+typedef struct _EDD_PARAMETERS
+{
+    USHORT    Size;
+    USHORT    Flags;
+    ULONG     nCylinders;
+    ULONG     nHeads;
+    ULONG     nSectors;
+    ULONGLONG nTotalSectors;
+    USHORT    nBytesPerSector;
+
+    /* EDD 2.0 */
+    ULONG     Dpte;
+
+    /* EDD 3.0 */
+    USHORT    Signature;
+    UCHAR     PathLength;
+    UCHAR     Reserved1[3];
+    CHAR      HostBus[4];
+    CHAR      Interface[8];
+    UCHAR     InterfacePath[8];
+    UCHAR     DevicePath[8];
+    UCHAR     Reserved2;
+    UCHAR     Checksum;
+} PACKED EDD_PARAMETERS;
+
+#define EDD_PATH_SIGNATURE   0xBEDD
+
+/* INT 13h/AH=42h Disk Address Packet */
+typedef struct _DISK_ADDRESS_PACKET
+{
+    UCHAR     Size;
+    UCHAR     Reserved;
+    USHORT    nBlocks;
+    ULONG     Buffer;
+    ULONGLONG StartBlock;
+    ULONGLONG FlatBuffer;   /* EDD 3.0, used if Size is 24 and Buffer is FFFF:FFFF */
+} PACKED DISK_ADDRESS_PACKET;
+
+#define FLAT_BUFFER_POINTER  0xFFFFFFFF
+
+/* Most sectors that every EDD BIOS can read at once */
+#define MAX_EDD_BLOCKS       127
+
+/* The linear address a BIOS writes to when it ignores the flat buffer address */
+#define FLAT_BUFFER_ALIAS    ((CHAR*)0x10FFEF)
+
+/* Flat buffers are tested here; nothing is loaded above 1 MB yet at that time */
+#define FLAT_TEST_BUFFER     ((CHAR*)LOW_MEMORY_END)
+
+/* Native disk drivers */
+VOID AhciProbe( VOID );
+VOID AtaProbe( VOID );
+VOID NvmeProbe( VOID );
+VOID VirtioProbe( VOID );
+VOID XhciProbe( VOID );
+
+typedef VOID (*DISKPROBEFUNC)( VOID );
+
+/* Alter this when adding or removing a disk driver to OSLDR */
+static DISKPROBEFUNC DiskProbeFunctions[] = {
+    AhciProbe,
+    AtaProbe,
+    NvmeProbe,
+    VirtioProbe,
+    XhciProbe,
+    NULL
+};
+
+/* Drive information, indexed by BIOS drive number */
+static DRIVE_INFO* Drives[ 256 ];
+
+/* Marks drives that failed to probe in Drives[] */
+static DRIVE_INFO  NoDrive;
+
+/* A controller a native driver can take over, see RegisterController() */
+typedef struct _CONTROLLER CONTROLLER;
+
+struct _CONTROLLER
+{
+    PCI_DEVICE    Pci;
+    DISKSTARTFUNC Start;
+    CONTROLLER*   Next;
+};
 
-BOOL ResetDrive( UCHAR Drive )
+/* Native disks and controllers, and whether the drivers have been probed */
+static DISK*       Disks;
+static CONTROLLER* Controllers;
+static BOOL        DisksProbed;
+
+/* Number of BIOS hard disks, -1 until asked */
+static INT         nHardDisks;
+
+VOID DriveInitialize( VOID )
+{
+    UINT i;
+
+    for (i = 0; i < 256; i++)
+    {
+        Drives[i] = NULL;
+    }
+
+    Disks       = NULL;
+    Controllers = NULL;
+    DisksProbed = FALSE;
+    nHardDisks  = -1;
+}
+
+UINT GetHardDiskCount( VOID )
 {
     REGS regs;
 
-    regs.h.ah = 0x00;
-    regs.h.dl = Drive;
+    if (nHardDisks < 0)
+    {
+        nHardDisks = 0;
 
-    int86( 0x13, &regs, &regs );
+        regs.h.ah = 0x08;
+        regs.h.dl = 0x80;
+        regs.x.es = 0;
+        regs.x.di = 0;
+        int86( 0x13, &regs, &regs );
+        if (!regs.x.cflag)
+        {
+            nHardDisks = MIN( regs.h.dl, 0x80 );
+        }
+    }
 
-    return (regs.x.cflag == 0);
+    return nHardDisks;
 }
 
-DRIVE_INFO* GetDriveParameters( UCHAR Drive )
+VOID RegisterController( PCI_DEVICE* Pci, DISKSTARTFUNC Start )
+{
+    CONTROLLER* Ctrl = malloc( sizeof(CONTROLLER) );
+
+    if (Ctrl != NULL)
+    {
+        Ctrl->Pci   = *Pci;
+        Ctrl->Start = Start;
+        Ctrl->Next  = Controllers;
+        Controllers = Ctrl;
+    }
+}
+
+VOID RegisterDisk( DISK* Disk )
+{
+    Disk->isBound = FALSE;
+    Disk->Next    = Disks;
+    Disks         = Disk;
+}
+
+/* Returns TRUE if the BIOS places @pdi on the PCI function @Pci */
+static BOOL IsOnController( DRIVE_INFO* pdi, PCI_DEVICE* Pci )
 {
-    DRIVE_INFO* pdi;
-    REGS        regs;
+    return (pdi->Flags & DIF_DEVICE_PATH) && (memcmp( pdi->HostBus, "PCI", 3 ) == 0) &&
+           (pdi->InterfacePath[0] == Pci->Bus) &&
+           (pdi->InterfacePath[1] == Pci->Device) &&
+           (pdi->InterfacePath[2] == Pci->Function);
+}
+
+/*
+ * Binds @pdi to the native disk that backs it, if there's exactly one.
+ * @First holds the first sector of the drive, as read through the BIOS.
+ */
+static VOID BindDisk( DRIVE_INFO* pdi, CHAR* First )
+{
+    DISK* Disk;
+    DISK* Match    = NULL;
+    ULONG nMatches = 0;
+    CHAR* Native   = malloc( pdi->nBytesPerSector );
+
+    if (Native == NULL)
+    {
+        return;
+    }
+
+    for (Disk = Disks; Disk != NULL; Disk = Disk->Next)
+    {
+        /* The BIOS may report less sectors than there are, never more */
+        if ((!Disk->isBound) &&
+            (Disk->nBytesPerSector == pdi->nBytesPerSector) &&
+            (Disk->nTotalSectors >= pdi->nTotalSectors) &&
+            (IsOnController( pdi, &Disk->Pci )) &&
+            (Disk->Read( Disk, 0, 1, Native ) == 1) &&
+            (memcmp( First, Native, pdi->nBytesPerSector ) == 0))
+        {
+            Match = Disk;
+            nMatches++;
+        }
+    }
+
+    if (nMatches == 1)
+    {
+        Match->isBound   = TRUE;
+        pdi->Disk        = Match;
+        pdi->MaxTransfer = Match->MaxTransfer;
+        pdi->Alignment   = Match->Alignment;
+
+        LogEvent( "Drive %02X: native driver, %u sectors per call", pdi->Drive, pdi->MaxTransfer );
+    }
+
+    free( Native );
+}
+
+VOID AttachNativeDisks( VOID )
+{
+    CHAR*       First[ 0x80 ];
+    UINT        nDisks = GetHardDiskCount();
     UINT        i;
+    CONTROLLER* Ctrl;
+
+    if (DisksProbed)
+    {
+        return;
+    }
+    DisksProbed = TRUE;
 
-    /* First check if information was retrieved earlier */
-    for (i = 0; i < DriveParametersCount; i++)
+    /*
+     * Some drivers reset their controller, after which the BIOS can't reach
+     * its disks anymore. So read what we need from the BIOS first.
+     */
+    for (i = 0; i < nDisks; i++)
     {
-        if (Drive == DriveParameters[i].Drive)
+        DRIVE_INFO* pdi = GetDriveParameters( 0x80 + i );
+
+        First[i] = (pdi != NULL) ? malloc( pdi->nBytesPerSector ) : NULL;
+        if ((First[i] != NULL) && (ReadDrive( 0x80 + i, 0, 1, First[i] ) != 1))
         {
-            /* Yes, return that one.
-             * By moving it to the front we create an LRU administration.
-             */
-            DRIVE_INFO di = DriveParameters[i];
-            memmove( &DriveParameters[1], &DriveParameters[0], i * sizeof(DRIVE_INFO) );
-            DriveParameters[0] = di;
-            return &DriveParameters[0];
+            free( First[i] );
+            First[i] = NULL;
         }
+
+        /* The kernel is told whether the BIOS takes flat buffers */
+        IsFlatBufferSupported( 0x80 + i, FLAT_TEST_BUFFER );
     }
 
-    /* Not cached, read */
-    if (DriveParametersCount == DRIVE_INFO_LENGTH)
+    /* This only finds the controllers, they are left alone for now */
+    for (i = 0; DiskProbeFunctions[i] != NULL; i++)
     {
-        /* Static buffer is full, throw out LRU info */
-        DriveParametersCount--;
+        DiskProbeFunctions[i]();
     }
 
-    /* We add the new info at the beginning */
-    memmove( &DriveParameters[1], &DriveParameters[0], DriveParametersCount++ * sizeof(DRIVE_INFO) );
-    pdi = &DriveParameters[0];
+    /*
+     * A controller is only taken over if the BIOS places exactly one of its
+     * hard disks on it. Any other disk on it would be cut off from the BIOS.
+     */
+    for (Ctrl = Controllers; Ctrl != NULL; Ctrl = Ctrl->Next)
+    {
+        UINT nOnController = 0;
+        UINT iDrive        = 0;
+
+        for (i = 0; i < nDisks; i++)
+        {
+            if ((Drives[ 0x80 + i ] != NULL) && (Drives[ 0x80 + i ] != &NoDrive) &&
+                (IsOnController( Drives[ 0x80 + i ], &Ctrl->Pci )))
+            {
+                nOnController++;
+                iDrive = i;
+            }
+        }
 
-    pdi->Drive = Drive;
+        if ((nOnController == 1) && (First[ iDrive ] != NULL))
+        {
+            DRIVE_INFO* pdi     = Drives[ 0x80 + iDrive ];
+            BOOL        isReset = FALSE;
+
+            if (Ctrl->Start( &Ctrl->Pci, &isReset ))
+            {
+                BindDisk( pdi, First[ iDrive ] );
+            }
+
+            if ((isReset) && (pdi->Disk == NULL))
+            {
+                /* The BIOS can't reach the drive anymore, and neither can we */
+                pdi->Flags |= DIF_LOST;
+                errno = ENODEV;
+                PrintError( MSG_DRIVE_LOST, pdi->Drive );
+            }
+        }
+    }
+
+    for (i = 0; i < nDisks; i++)
+    {
+        free( First[i] );
+    }
+}
+
+VOID ReleaseNativeDisks( VOID )
+{
+    DISK* Disk;
+
+    for (Disk = Disks; Disk != NULL; Disk = Disk->Next)
+    {
+        if (Disk->Release != NULL)
+        {
+            Disk->Release( Disk );
+        }
+    }
+}
+
+BOOL ResetDrive( UCHAR Drive )
+{
+    REGS regs;
+
+    if ((Drives[ Drive ] != NULL) && (Drives[ Drive ]->Disk != NULL))
+    {
+        /* Native drivers recover by themselves */
+        return TRUE;
+    }
+
+    regs.h.ah = 0x00;
+    regs.h.dl = Drive;
+
+    int86( 0x13, &regs, &regs );
+
+    return (regs.x.cflag == 0);
+}
+
+/* Fills in @pdi from INT 13h/AH=48h. Returns FALSE if that isn't supported */
+static BOOL GetEddParameters( DRIVE_INFO* pdi )
+{
+    EDD_PARAMETERS edd;
+    REGS           regs;
 
     /* Check for INT13h Extensions */
     regs.h.ah = 0x41;
     regs.x.bx = 0x55aa;
-    regs.h.dl = Drive;
+    regs.h.dl = pdi->Drive;
     int86( 0x13, &regs, &regs );
 
-    if ((!regs.x.cflag) && (regs.x.bx == 0xaa55))
+    if ((regs.x.cflag) || (regs.x.bx != 0xaa55) || (~regs.x.cx & 1))
     {
-        /* INT 13h extensions supported */
-        pdi->EddVersion      = regs.h.ah;
-        pdi->ControllerFlags = regs.x.cx;
-        if (regs.x.cx & 1)
-        {
-            /* ControllerFlags temporarily acts as var for INT 13h/AH=48h */
-            USHORT Flags = pdi->ControllerFlags;
+        /* INT 13h extensions NOT supported or no INT13h/AH=48h */
+        return FALSE;
+    }
+
+    pdi->EddVersion      = regs.h.ah;
+    pdi->ControllerFlags = regs.x.cx;
 
-            pdi->ControllerFlags = 0x1A; /* We just want v1.x info */
-            regs.h.ah = 0x48;
-            regs.h.dl = Drive;
-            regs.x.ds = SEG( &pdi->ControllerFlags );
-            regs.x.si = OFS( &pdi->ControllerFlags );
-            int86( 0x13, &regs, &regs );
+    /* Only ask for the device path if the BIOS claims EDD 3.0 */
+    memset( &edd, 0, sizeof(edd) );
+    edd.Size  = (pdi->EddVersion >= 0x30) ? sizeof(EDD_PARAMETERS) : 0x1A;
+    regs.h.ah = 0x48;
+    regs.h.dl = pdi->Drive;
+    regs.x.ds = SEG( &edd );
+    regs.x.si = OFS( &edd );
+    int86( 0x13, &regs, &regs );
 
-            /* Restore flags */
-            pdi->ControllerFlags = Flags;
+    if ((regs.x.cflag) || (edd.nBytesPerSector == 0))
+    {
+        return FALSE;
+    }
 
-            if (!regs.x.cflag)
-            {
-                return pdi;
-            }
-        }
+    pdi->DriveFlags      = edd.Flags;
+    pdi->nCylinders      = edd.nCylinders;
+    pdi->nHeads          = edd.nHeads;
+    pdi->nSectors        = edd.nSectors;
+    pdi->nTotalSectors   = edd.nTotalSectors;
+    pdi->nBytesPerSector = edd.nBytesPerSector;
+    pdi->MaxTransfer     = MIN( MAX_EDD_BLOCKS, MAX_TRANSFER_SIZE / pdi->nBytesPerSector );
+
+    if (edd.Flags & EDD_REMOVABLE)
+    {
+        pdi->Flags |= DIF_REMOVABLE;
     }
 
-    /* INT 13h extensions NOT supported or no INT13h/AH=48h */
+    if ((edd.Size >= sizeof(EDD_PARAMETERS)) && (edd.Signature == EDD_PATH_SIGNATURE))
+    {
+        /* The BIOS told us where the drive lives */
+        memcpy( pdi->HostBus,       edd.HostBus,       sizeof(pdi->HostBus) );
+        memcpy( pdi->Interface,     edd.Interface,     sizeof(pdi->Interface) );
+        memcpy( pdi->InterfacePath, edd.InterfacePath, sizeof(pdi->InterfacePath) );
+        memcpy( pdi->DevicePath,    edd.DevicePath,    sizeof(pdi->DevicePath) );
+        pdi->Flags |= DIF_DEVICE_PATH;
+    }
+
+    return TRUE;
+}
+
+/* Fills in @pdi from INT 13h/AH=08h. Returns FALSE if the drive doesn't exist */
+static BOOL GetChsParameters( DRIVE_INFO* pdi )
+{
+    DISK_BASE_TABLE* dbt;
+    REGS             regs;
+
     pdi->EddVersion      = 0;
     pdi->ControllerFlags = 0;
     pdi->DriveFlags      = 0;
     pdi->nBytesPerSector = 512;
 
     regs.h.ah = 8;
-    regs.h.dl = Drive;
+    regs.h.dl = pdi->Drive;
     regs.x.es = 0;
     regs.x.di = 0;
     int86( 0x13, &regs, &regs );
-    if (!regs.x.cflag)
+    if (regs.x.cflag)
     {
-        /* Success */
-        DISK_BASE_TABLE* dbt = PTR( regs.x.es, regs.x.di );
+        return FALSE;
+    }
 
-        pdi->nHeads        = (ULONG)regs.h.dh + 1;
-        pdi->nSectors      = (ULONG)regs.h.cl & 0x3F;
-        pdi->nCylinders    = (((ULONG)(regs.h.cl & 0xC0) << 2) | regs.h.ch) + 1;
-        pdi->nTotalSectors = pdi->nHeads * pdi->nSectors * pdi->nCylinders;
+    dbt = PTR( regs.x.es, regs.x.di );
 
-        if (dbt->BytesPerSector < 4)
-        {
-            /* Use BytesPerSector from BIOS Disk base table if valid */
-            pdi->nBytesPerSector = 128 << dbt->BytesPerSector;
-        }
+    pdi->nHeads        = (ULONG)regs.h.dh + 1;
+    pdi->nSectors      = (ULONG)regs.h.cl & 0x3F;
+    pdi->nCylinders    = (((ULONG)(regs.h.cl & 0xC0) << 2) | regs.h.ch) + 1;
+    pdi->nTotalSectors = pdi->nHeads * pdi->nSectors * pdi->nCylinders;
 
-        return pdi;
+    if ((dbt != NULL) && (dbt->BytesPerSector < 4))
+    {
+        /* Use BytesPerSector from BIOS Disk base table if valid */
+        pdi->nBytesPerSector = 128 << dbt->BytesPerSector;
     }
 
-    /* Failure */
-    DriveParametersCount--;
-    return NULL;
+    /* INT 13h/AH=02h can't read past the end of a track */
+    pdi->MaxTransfer = MIN( pdi->nSectors, MAX_TRANSFER_SIZE / pdi->nBytesPerSector );
+
+    return (pdi->nSectors > 0);
 }
 
-ULONGLONG ReadDrive( UCHAR Drive, ULONGLONG Sector, ULONGLONG nSectors, VOID* Buffer )
+DRIVE_INFO* GetDriveParameters( UCHAR Drive )
 {
-    ULONG       Read = 0;
-    REGS        regs;
-    DRIVE_INFO* pdi  = GetDriveParameters( Drive );
+    DRIVE_INFO* pdi = Drives[ Drive ];
 
+    if (pdi != NULL)
+    {
+        /* Probed before */
+        return (pdi != &NoDrive) ? pdi : NULL;
+    }
+
+    pdi = malloc( sizeof(DRIVE_INFO) );
     if (pdi == NULL)
     {
-        return 0;
+        /* Try again next time */
+        return NULL;
     }
 
-    if (pdi->ControllerFlags & 1)
+    memset( pdi, 0, sizeof(DRIVE_INFO) );
+    pdi->Drive     = Drive;
+    pdi->Alignment = 1;     /* The BIOS copes with any buffer */
+    if (Drive < 0x80)
     {
-        /* EDD Supported */
-        struct DISK_ADDRESS_PACKET
-        {
-            UCHAR     Size;
-            UCHAR     Reserved;
-            USHORT    nBlocks;
-            ULONG     Buffer;
-            ULONGLONG StartBlock;
-        } PACKED addrpack;
+        /* Floppy drives */
+        pdi->Flags |= DIF_REMOVABLE;
+    }
+
+    if ((!GetEddParameters( pdi )) && (!GetChsParameters( pdi )))
+    {
+        /* Failure, don't ask again */
+        free( pdi );
+        Drives[ Drive ] = &NoDrive;
+        return NULL;
+    }
+
+    /* Until the drive is calibrated */
+    pdi->BiosMaxTransfer = pdi->MaxTransfer;
+    pdi->TransferSize    = pdi->MaxTransfer;
+    pdi->ReadAlignment   = 1;
+
+    Drives[ Drive ] = pdi;
+    return pdi;
+}
 
+/*
+ * Reads sectors with INT 13h/AH=42h. Buffers that do not fit below 1 MB are
+ * passed as an EDD 3.0 64-bit flat address.
+ */
+static ULONG ExtendedRead( DRIVE_INFO* pdi, ULONGLONG Sector, ULONG nSectors, VOID* Buffer )
+{
+    DISK_ADDRESS_PACKET addrpack;
+    REGS                regs;
+
+    addrpack.Reserved   = 0;
+    addrpack.nBlocks    = nSectors;
+    addrpack.StartBlock = Sector;
+
+    if ((ULONG)Buffer + nSectors * pdi->nBytesPerSector > LOW_MEMORY_END)
+    {
+        addrpack.Size       = 24;
+        addrpack.Buffer     = FLAT_BUFFER_POINTER;
+        addrpack.FlatBuffer = (ULONG)Buffer;
+    }
+    else
+    {
         addrpack.Size       = 16;
-        addrpack.Reserved   = 0;
-        addrpack.nBlocks    = nSectors;
         addrpack.Buffer     = MAKELONG( SEG(Buffer), OFS(Buffer) );
-        addrpack.StartBlock = Sector;
+    }
 
-        regs.h.ah = 0x42;
-        regs.h.dl = Drive;
-        regs.x.ds = SEG( &addrpack );
-        regs.x.si = OFS( &addrpack );
-        int86( 0x13, &regs, &regs );
+    regs.h.ah = 0x42;
+    regs.h.dl = pdi->Drive;
+    regs.x.ds = SEG( &addrpack );
+    regs.x.si = OFS( &addrpack );
+    int86( 0x13, &regs, &regs );
+
+    if ((regs.x.cflag) || (regs.h.ah != 0))
+    {
+        return 0;
+    }
+
+    return addrpack.nBlocks;
+}
+
+/*
+ * Reads the first sector of the drive into a low buffer and into @Buffer (as
+ * a flat address) and compares the two. A BIOS that silently ignores the flat
+ * address either leaves @Buffer alone or writes to FFFF:FFFF, so we check and
+ * restore that area as well.
+ */
+static BOOL TestFlatBuffer( DRIVE_INFO* pdi, VOID* Buffer )
+{
+    ULONG i;
+    BOOL  Works = FALSE;
+    CHAR* Low   = malloc( pdi->nBytesPerSector );
+    CHAR* Saved = malloc( pdi->nBytesPerSector );
+
+    if ((Low != NULL) && (Saved != NULL))
+    {
+        memcpy( Saved, FLAT_BUFFER_ALIAS, pdi->nBytesPerSector );
 
-        if ((regs.x.cflag) || (regs.h.ah != 0))
+        if (ExtendedRead( pdi, 0, 1, Low ) == 1)
         {
-            return 0;
+            /* Make sure @Buffer differs from the expected data */
+            for (i = 0; i < pdi->nBytesPerSector; i++)
+            {
+                ((CHAR*)Buffer)[i] = ~Low[i];
+            }
+
+            if ((ExtendedRead( pdi, 0, 1, Buffer ) == 1) &&
+                (memcmp( Buffer, Low, pdi->nBytesPerSector ) == 0) &&
+                (memcmp( FLAT_BUFFER_ALIAS, Saved, pdi->nBytesPerSector ) == 0))
+            {
+                Works = TRUE;
+            }
         }
 
-        return addrpack.nBlocks;
+        memcpy( FLAT_BUFFER_ALIAS, Saved, pdi->nBytesPerSector );
     }
 
-    /* EDD NOT Supported */
-    while (nSectors > 0)
+    free( Saved );
+    free( Low );
+    return Works;
+}
+
+BOOL IsFlatBufferSupported( UCHAR Drive, VOID* Buffer )
+{
+    DRIVE_INFO* pdi = GetDriveParameters( Drive );
+
+    if ((pdi != NULL) && (pdi->Disk != NULL))
     {
-        UINT iCylinder =  Sector / (pdi->nHeads * pdi->nSectors);
-        UINT iHead     = (Sector / pdi->nSectors) % pdi->nHeads;
-        UINT iSector   = (Sector % pdi->nSectors);
-        UINT count     = pdi->nSectors - iSector;
+        /* Native drivers address all memory */
+        return TRUE;
+    }
 
-        if (count > nSectors) count = nSectors;
+    if ((pdi == NULL) || (~pdi->ControllerFlags & 1) || (pdi->EddVersion < 0x30))
+    {
+        /* No EDD 3.0 */
+        return FALSE;
+    }
 
-        regs.h.cl = (UCHAR)(((iSector + 1) & 0x3f) | ((iCylinder >> 2) & 0xC0));
-        regs.h.ch = (UCHAR)iCylinder;
-        regs.h.dh = (UCHAR)iHead;
-        regs.h.dl = Drive;
-        regs.h.al = count;
-        regs.h.ah = 2;
-        regs.x.es = SEG( Buffer );
-        regs.x.bx = OFS( Buffer );
+    if (~pdi->Flags & DIF_FLAT_TESTED)
+    {
+        if (((CHAR*)Buffer + pdi->nBytesPerSector > FLAT_BUFFER_ALIAS) &&
+            ((CHAR*)Buffer < FLAT_BUFFER_ALIAS + pdi->nBytesPerSector))
+        {
+            /* We can't test with this buffer, try again next time */
+            return FALSE;
+        }
 
-        int86( 0x13, &regs, &regs );
+        pdi->Flags |= DIF_FLAT_TESTED;
+        if (TestFlatBuffer( pdi, Buffer ))
+        {
+            pdi->Flags |= DIF_FLAT_BUFFER;
+        }
+    }
+
+    return (pdi->Flags & DIF_FLAT_BUFFER) != 0;
+}
+
+/*
+ * Reads sectors with INT 13h/AH=02h. The sectors must lie on one track.
+ */
+static ULONG ChsRead( DRIVE_INFO* pdi, ULONGLONG Sector, ULONG nSectors, VOID* Buffer )
+{
+    REGS regs;
+    UINT iCylinder =  Sector / (pdi->nHeads * pdi->nSectors);
+    UINT iHead     = (Sector / pdi->nSectors) % pdi->nHeads;
+    UINT iSector   = (Sector % pdi->nSectors);
+
+    regs.h.cl = (UCHAR)(((iSector + 1) & 0x3f) | ((iCylinder >> 2) & 0xC0));
+    regs.h.ch = (UCHAR)iCylinder;
+    regs.h.dh = (UCHAR)iHead;
+    regs.h.dl = pdi->Drive;
+    regs.h.al = nSectors;
+    regs.h.ah = 2;
+    regs.x.es = SEG( Buffer );
+    regs.x.bx = OFS( Buffer );
+
+    int86( 0x13, &regs, &regs );
+
+    if ((regs.x.cflag) || (regs.h.ah != 0))
+    {
+        return 0;
+    }
+
+    return nSectors;
+}
 
-        if ((regs.x.cflag) || (regs.h.ah != 0))
+ULONG GetTransferSize( DRIVE_INFO* pdi, ULONGLONG Sector, ULONGLONG nSectors, VOID* Buffer )
+{
+    ULONG count = MIN( nSectors, pdi->MaxTransfer );
+
+    if (pdi->Disk != NULL)
+    {
+        /* The native driver has no other limits */
+        return count;
+    }
+
+    count = MIN( count, pdi->TransferSize );
+    if ((pdi->ReadAlignment > 1) && (count > pdi->ReadAlignment))
+    {
+        /* End on a boundary, so the next call starts on one */
+        count -= (ULONG)((Sector + count) % pdi->ReadAlignment);
+    }
+
+    if (~pdi->ControllerFlags & 1)
+    {
+        /* Stop at the end of the track */
+        count = MIN( count, pdi->nSectors - Sector % pdi->nSectors );
+    }
+
+    if ((ULONG)Buffer < LOW_MEMORY_END)
+    {
+        /* Don't cross a 64 kB boundary, ISA DMA can't handle that */
+        ULONG room = (0x10000 - ((ULONG)Buffer & 0xFFFF)) / pdi->nBytesPerSector;
+        count = MIN( count, room );
+    }
+
+    return count;
+}
+
+ULONGLONG ReadDrive( UCHAR Drive, ULONGLONG Sector, ULONGLONG nSectors, VOID* Buffer )
+{
+    ULONGLONG   Read = 0;
+    DRIVE_INFO* pdi  = GetDriveParameters( Drive );
+
+    if (pdi == NULL)
+    {
+        return 0;
+    }
+
+    if (pdi->Flags & DIF_LOST)
+    {
+        errno = ENODEV;
+        return 0;
+    }
+
+    if (((ULONG)Buffer + nSectors * pdi->nBytesPerSector > LOW_MEMORY_END) &&
+        (pdi->Disk == NULL) && (~pdi->Flags & DIF_FLAT_BUFFER))
+    {
+        /* The BIOS can't address this buffer */
+        return 0;
+    }
+
+    /* Split the request into chunks the BIOS can handle */
+    while (nSectors > 0)
+    {
+        ULONG count = GetTransferSize( pdi, Sector, nSectors, Buffer );
+        ULONG done;
+
+        if (count == 0)
+        {
+            /* The next sector would cross a 64 kB boundary */
+            break;
+        }
+
+        if (pdi->Disk != NULL)
+        {
+            /* Native driver */
+            done = pdi->Disk->Read( pdi->Disk, Sector, count, Buffer );
+        }
+        else if (pdi->ControllerFlags & 1)
+        {
+            /* EDD Supported */
+            done = ExtendedRead( pdi, Sector, count, Buffer );
+        }
+        else
+        {
+            /* EDD NOT Supported */
+            done = ChsRead( pdi, Sector, count, Buffer );
+        }
+
+        Read += done;
+        if (done != count)
         {
             break;
         }
@@ -209,9 +720,38 @@ ULONGLONG ReadDrive( UCHAR Drive, ULONGLONG Sector, ULONGLONG nSectors, VOID* Bu
         /* Update counts */
         nSectors -= count;
         Sector   += count;
-        Read     += count;
         Buffer    = (CHAR*)Buffer + count * pdi->nBytesPerSector;
     }
 
     return Read;
 }
+
+INT SubmitDrive( DRIVE_INFO* pdi, ULONGLONG Sector, ULONG nSectors, VOID* Buffer )
+{
+    if ((pdi->Disk == NULL) || (pdi->Disk->Submit == NULL) || (nSectors > pdi->Disk->MaxSubmit) ||
+        ((ULONG)Buffer % pdi->Alignment != 0))
+    {
+        /* Not a read we can queue */
+        return -1;
+    }
+
+    return pdi->Disk->Submit( pdi->Disk, Sector, nSectors, Buffer );
+}
+
+INT PollDrive( DRIVE_INFO* pdi, ULONG* nRead )
+{
+    if ((pdi->Disk == NULL) || (pdi->Disk->Poll == NULL))
+    {
+        return -1;
+    }
+
+    return pdi->Disk->Poll( pdi->Disk, nRead );
+}
+
+VOID AbortDrive( DRIVE_INFO* pdi )
+{
+    if ((pdi->Disk != NULL) && (pdi->Disk->Abort != NULL))
+    {
+        pdi->Disk->Abort( pdi->Disk );
+    }
+}
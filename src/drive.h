@@ -2,19 +2,91 @@
 #define DRIVE_H
 
 #include <types.h>
+#include <disk.h>
+
+/* Most transfer sizes a drive is calibrated with */
+#define MAX_RATES 8
 
 typedef struct _DRIVE_INFO
 {
     USHORT    Drive;           /* 0 - 255 are valid */
     USHORT    EddVersion;
-    USHORT    ControllerFlags;
-    USHORT    DriveFlags;
+    USHORT    ControllerFlags; /* INT 13h/AH=41h API support bitmap  */
+    USHORT    DriveFlags;      /* INT 13h/AH=48h information flags   */
     ULONG     nCylinders;
     ULONG     nHeads;
     ULONG     nSectors;
     ULONGLONG nTotalSectors;
     USHORT    nBytesPerSector;
-} PACKED DRIVE_INFO;
+    ULONG     Flags;
+    ULONG     MaxTransfer;     /* Most sectors to read per call      */
+    ULONG     BiosMaxTransfer; /* Most sectors per BIOS call         */
+    ULONG     Alignment;       /* Required buffer alignment in bytes */
+    ULONG     TransferSize;    /* Sectors per call, at most MaxTransfer    */
+    ULONG     ReadAlignment;   /* Calls end on multiples of these sectors  */
+
+    /* Measured transfer rates, valid if Flags & DIF_CALIBRATED */
+    ULONG     nRates;
+    ULONG     RateSize[ MAX_RATES ];   /* Sectors per call                 */
+    ULONG     Rate[ MAX_RATES ];       /* kB/s, 0 if the data was wrong    */
+
+    /* EDD 3.0 device path, valid if Flags & DIF_DEVICE_PATH */
+    CHAR      HostBus[4];      /* "PCI " or "ISA "                   */
+    CHAR      Interface[8];    /* "ATA     ", "SATA    ", "USB     " */
+    UCHAR     InterfacePath[8];
+    UCHAR     DevicePath[8];
+
+    DISK*     Disk;            /* Native driver for the drive, or NULL */
+} DRIVE_INFO;
+
+/* Values for DRIVE_INFO.Flags */
+#define DIF_FLAT_TESTED  0x0001  /* EDD 3.0 flat buffer addressing was probed */
+#define DIF_FLAT_BUFFER  0x0002  /* EDD 3.0 flat buffer addressing works      */
+#define DIF_REMOVABLE    0x0004  /* Drive has removable media                 */
+#define DIF_DEVICE_PATH  0x0008  /* The EDD 3.0 device path is valid          */
+#define DIF_CALIBRATED   0x0010  /* TransferSize was picked by CalibrateDrive */
+#define DIF_LOST         0x0020  /* Reset by a native driver that can't read it */
+
+/* Values for DRIVE_INFO.DriveFlags */
+#define EDD_DMA_BOUNDARY 0x0001  /* DMA boundary errors handled transparently */
+#define EDD_GEOMETRY     0x0002  /* CHS information is valid                  */
+#define EDD_REMOVABLE    0x0004  /* Removable drive                           */
+
+/* Buffers ending above this address cannot be passed as real-mode pointers */
+#define LOW_MEMORY_END    0x100000
+
+/* Most bytes read per BIOS call; this fits behind a single real-mode segment */
+#define MAX_TRANSFER_SIZE 0xFE00
+
+/*
+ * Initializes the drive table. Must be called before any other function.
+ */
+VOID DriveInitialize( VOID );
+
+/*
+ * Probes the native disk drivers and binds the disks they find to the BIOS
+ * hard disks they back, so those are read without leaving protected mode.
+ * A controller is only started if the EDD 3.0 device paths place exactly one
+ * BIOS hard disk on it, and a disk on it is only bound if it is the single
+ * one whose size and first sector match. Does nothing when called again.
+ * Started controllers may be lost to the BIOS, so this should only be called
+ * when we're about to load an image. EDD 3.0 flat buffers are
+ * tested on every BIOS hard disk first, in the first sector above 1 MB, so
+ * the A20 gate must be enabled.
+ */
+VOID AttachNativeDisks( VOID );
+
+/*
+ * Hands the controllers the BIOS still uses back to it as they were. Call
+ * before leaving osldr.
+ */
+VOID ReleaseNativeDisks( VOID );
+
+/*
+ * Returns the number of BIOS hard disks, as INT 13h/AH=08h reports it. The
+ * disks are numbered from 80h on without gaps.
+ */
+UINT GetHardDiskCount( VOID );
 
 /*
  * Resets the drive system.
@@ -26,17 +98,56 @@ BOOL ResetDrive( UCHAR Drive );
 /*
  * Returns the drive parameters of @Drive.
  * Bit 7 of @Drive must be set when querying HDDs (BIOS Convention).
- * NULL is returned on failure. The returned pointer points to a static
- * buffer and should not be used other then to read from and may be
- * invalid after a next call.
+ * NULL is returned on failure. Every drive is probed only once; the
+ * returned information stays valid and should only be read from.
  */
 DRIVE_INFO* GetDriveParameters( UCHAR Drive );
 
+/*
+ * Returns TRUE if ReadDrive() can read straight into @Buffer, which lies
+ * (partially) above 1 MB. This requires EDD 3.0 64-bit flat buffer addresses,
+ * which not every BIOS that claims EDD 3.0 honours, so it is verified on first
+ * use. @Buffer must be large enough to hold one sector; its contents may be
+ * overwritten.
+ */
+BOOL IsFlatBufferSupported( UCHAR Drive, VOID* Buffer );
+
+/*
+ * Returns how many of the @nSectors sectors starting at @Sector can be read
+ * into @Buffer with a single BIOS call. BIOS drives read TransferSize sectors
+ * per call, ending on a multiple of ReadAlignment if possible. Returns 0 if
+ * not even one sector fits in @Buffer before a 64 kB boundary.
+ */
+ULONG GetTransferSize( DRIVE_INFO* pdi, ULONGLONG Sector, ULONGLONG nSectors, VOID* Buffer );
+
 /*
  * Reads several sectors from a drive into Buffer.
  * Bit 7 of @Drive must be set when reading HDDs (BIOS Convention).
+ * @Buffer must lie below 1 MB, unless IsFlatBufferSupported() says otherwise,
+ * and be a multiple of the drive's Alignment. Drives bound to a native disk
+ * are read by its driver, others by the BIOS.
+ * The request is split into as few calls as possible.
  * The number of read sectors is returned.
  */
 ULONGLONG ReadDrive( UCHAR Drive, ULONGLONG Sector, ULONGLONG nSectors, VOID* Buffer );
 
+/*
+ * Queues a read of @nSectors sectors at @Sector into @Buffer, on drives whose
+ * native driver reads asynchronously. Returns a tag for PollDrive(), or -1 if
+ * the read can't be queued, in which case it should be done with ReadDrive().
+ * Queued reads must be finished before ReadDrive() is called on the drive.
+ */
+INT SubmitDrive( DRIVE_INFO* pdi, ULONGLONG Sector, ULONG nSectors, VOID* Buffer );
+
+/*
+ * Returns the tag of a queued read of @pdi that finished, or -1 if none did.
+ * @nRead receives the number of sectors it read.
+ */
+INT PollDrive( DRIVE_INFO* pdi, ULONG* nRead );
+
+/*
+ * Gives up on all queued reads of @pdi.
+ */
+VOID AbortDrive( DRIVE_INFO* pdi );
+
 #endif
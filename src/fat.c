@@ -8,8 +8,6 @@
 #define FAT_VERSION_HIGH    0
 #define FAT_VERSION_LOW     0
 
-#define MAX_READ_TRY        8
-
 typedef struct _BPB
 {
     UCHAR  BS_jmpBoot[3];
@@ -60,22 +58,58 @@ typedef struct _BPB
 
 } PACKED BPB;
 
+#define FAT_TABLE_MAX   0xF000  /* Largest FAT12/16 that is loaded as a whole     */
+#define FAT_WINDOW_SIZE 4096    /* Bytes of FAT per window                       */
+#define FAT_WINDOWS     8       /* Windows kept in memory for large FATs         */
+#define NO_WINDOW       0xFFFFFFFF
+
+/* A cached part of a large FAT */
+typedef struct _FAT_WINDOW
+{
+    ULONG  Index;       /* Offset in the FAT / FAT_WINDOW_SIZE, or NO_WINDOW */
+    ULONG  Time;
+    UCHAR* Data;
+} FAT_WINDOW;
+
+#define DIR_BUCKETS     64      /* Hash buckets per cached directory             */
+#define DIRS_BUCKETS    16      /* Hash buckets for the cached directories       */
+#define DIR_CACHE_MAX   0x8000  /* Most bytes of cached directories per mount     */
+
+typedef struct _DIRECTORY DIRECTORY;
+
+typedef struct _FAT_INFO FAT_INFO;
+
 /* FAT specific information */
-typedef struct _FAT_INFO
+struct _FAT_INFO
 {
     /* Some pre-calculated area offsets */
     ULONG  nDataSectors;
     ULONG  FatStart;
+    ULONG  FatSectors;
     ULONG  RootDirStart;
     ULONG  DataStart;
     ULONG  BytsPerClus;
     ULONG  FatType;
     ULONG  EndCluster;
+    ULONG  nEntries;
+
+    /* Determines the next cluster, depending on the FAT type */
+    ULONG  (*NextCluster)(DEVICE*, ULONG);
+
+    /* Entire, decoded FAT for small FATs */
+    USHORT* Table;
+
+    /* Recently used parts of large FATs */
+    FAT_WINDOW Windows[ FAT_WINDOWS ];
+    ULONG      Time;
+
+    /* Directories that have been looked into */
+    DIRECTORY* Directories[ DIRS_BUCKETS ];
+    ULONG      DirBytes;    /* Memory held by the cached directories */
 
     /* The BPB from the bootsector */
     BPB*   Bpb;
-
-} FAT_INFO;
+};
 
 typedef struct _DIR_ENTRY
 {
@@ -122,6 +156,49 @@ typedef struct _LDIR_ENTRY
 /* Maximum long filename length (though there are 63 entries allowed) */
 #define MAX_LONG_FILENAME_LENGTH 0xFF
 
+/* A cached directory entry, hashed by name */
+typedef struct _DENTRY DENTRY;
+
+struct _DENTRY
+{
+    DENTRY*   Next;         /* Next entry in the same bucket                */
+    BOOL      IsLongName;   /* Name is a long filename, else an 11-char name */
+    DIR_ENTRY Entry;
+    CHAR      Name[1];      /* Variable length                               */
+};
+
+/* A directory that has been parsed into the dentry cache */
+struct _DIRECTORY
+{
+    DIRECTORY* Next;        /* Next directory in the same bucket */
+    ULONG      Cluster;     /* First cluster, 0 for the FAT12/16 root */
+    ULONG      Time;        /* Last lookup, for eviction              */
+    ULONG      Bytes;       /* Memory held by the directory           */
+    DENTRY*    Buckets[ DIR_BUCKETS ];
+};
+
+/* Called by ScanDirectory() for each entry; returns FALSE to stop the scan */
+typedef BOOL (*DENTRYFUNC)(DEVICE*, VOID*, CONST CHAR*, ULONG, BOOL, DIR_ENTRY*);
+
+/* A name that is looked up without the directory cache */
+typedef struct _DIR_SEARCH
+{
+    CHAR*      Name;
+    CHAR*      OemName;     /* Empty if the name has no short form */
+    DIR_ENTRY* Entry;       /* Receives the entry when it's found  */
+    BOOL       Found;
+} DIR_SEARCH;
+
+/* A run of consecutive clusters in a file */
+typedef struct _EXTENT
+{
+    ULONG FileCluster;  /* Index of the run's first cluster in the file */
+    ULONG Cluster;      /* First cluster of the run on disk             */
+    ULONG Length;       /* Number of clusters in the run                */
+} EXTENT;
+
+#define EXTENT_MIN  16  /* Initial size of the extent list, which then doubles */
+
 /* File structure */
 typedef struct _FILE_INFO
 {
@@ -131,10 +208,23 @@ typedef struct _FILE_INFO
     /* File information */
     DIR_ENTRY  Info;
 
+    /* The file's cluster chain, as a list of runs */
+    EXTENT*    Extents;
+    ULONG      nExtents;
+    ULONG      nAllocated;
+
+    /*
+     * If the list couldn't grow, it covers the first nMapped clusters only
+     * and ChainCluster is the next one; it is 0 if the list is complete.
+     * Walk is the last run found by walking the chain past the list.
+     */
+    ULONG      nMapped;
+    ULONG      ChainCluster;
+    EXTENT     Walk;
+
     /* Current file cursor */
     ULONGLONG  Cursor;
-    ULONG      Cluster;
-    
+
 } FILE_INFO;
 
 /* Removes all leading and trailing spaces and periods */
@@ -262,118 +352,287 @@ static UCHAR CheckSum( CHAR* pFcbName )
     return Sum;
 }
 
-/* Determines the next cluster based on FAT contents */
-static ULONG GetNextCluster( DEVICE* Device, ULONG Cluster )
+/* Next cluster for FATs that were loaded and decoded as a whole */
+static ULONG NextClusterTable( DEVICE* Device, ULONG Cluster )
 {
-    FAT_INFO* pfi  = (FAT_INFO*)Device->Data;
-    ULONG     Res  = 0xFFFFFFFF;
-    ULONG     Clus = 0;
-    ULONG     Ofs;
-    UCHAR*    Buffer;
+    FAT_INFO* pfi = (FAT_INFO*)Device->Data;
+
+    return (Cluster < pfi->nEntries) ? pfi->Table[ Cluster ] : 0xFFFFFFFF;
+}
+
+/* Returns a pointer to the FAT entry at @Offset bytes, loading its window */
+static VOID* GetFatEntry( DEVICE* Device, ULONG Offset )
+{
+    FAT_INFO*   pfi    = (FAT_INFO*)Device->Data;
+    ULONG       Index  = Offset / FAT_WINDOW_SIZE;
+    FAT_WINDOW* Window = &pfi->Windows[ 0 ];
+    ULONG       Sector;
+    ULONG       nSectors;
+    ULONG       i;
+
+    for (i = 0; i < FAT_WINDOWS; i++)
+    {
+        if (pfi->Windows[ i ].Index == Index)
+        {
+            /* Window is loaded */
+            pfi->Windows[ i ].Time = pfi->Time++;
+            return pfi->Windows[ i ].Data + Offset % FAT_WINDOW_SIZE;
+        }
+
+        if (pfi->Windows[ i ].Time < Window->Time)
+        {
+            /* Least Recently Used */
+            Window = &pfi->Windows[ i ];
+        }
+    }
+
+    /* Load the window */
+    nSectors = FAT_WINDOW_SIZE / pfi->Bpb->BPB_BytsPerSec;
+    Sector   = Index * nSectors;
+    if (Sector >= pfi->FatSectors)
+    {
+        return NULL;
+    }
+    nSectors = MIN( nSectors, pfi->FatSectors - Sector );
 
-    /* Calculate cluster / offset */
-    switch (pfi->FatType)
+    if (Window->Data == NULL)
     {
-        case 12: Clus = Cluster + (Cluster / 2); break;
-        case 16: Clus = Cluster * 2;             break;
-        case 32: Clus = Cluster * 4;             break;
+        Window->Data = malloc( FAT_WINDOW_SIZE );
+        if (Window->Data == NULL)
+        {
+            return NULL;
+        }
     }
 
-    Ofs  = Clus % pfi->Bpb->BPB_BytsPerSec;
-    Clus = Clus / pfi->Bpb->BPB_BytsPerSec;
+    /* The window itself caches the FAT, keep it out of the sector cache */
+    Window->Index = NO_WINDOW;
+    if (ReadSector( Device, pfi->FatStart + Sector, nSectors, Window->Data, RS_NOCACHE ) != nSectors)
+    {
+        return NULL;
+    }
 
-    /* Read the FAT sector */
-    Buffer = malloc( pfi->Bpb->BPB_BytsPerSec );
+    Window->Index = Index;
+    Window->Time  = pfi->Time++;
+    return Window->Data + Offset % FAT_WINDOW_SIZE;
+}
+
+/* Next cluster for large FAT16s */
+static ULONG NextCluster16( DEVICE* Device, ULONG Cluster )
+{
+    USHORT* Entry = GetFatEntry( Device, Cluster * 2 );
+
+    return (Entry != NULL) ? *Entry : 0xFFFFFFFF;
+}
+
+/* Next cluster for FAT32s; the upper four bits are reserved */
+static ULONG NextCluster32( DEVICE* Device, ULONG Cluster )
+{
+    ULONG* Entry = GetFatEntry( Device, Cluster * 4 );
+
+    return (Entry != NULL) ? *Entry & 0x0FFFFFFF : 0xFFFFFFFF;
+}
+
+/*
+ * Reads a FAT12 or small FAT16 in one sweep and decodes it into a flat table.
+ * Returns FALSE and sets errno if it can't, in which case FAT16 uses windows
+ * instead.
+ */
+static BOOL LoadFatTable( DEVICE* Device )
+{
+    FAT_INFO* pfi      = (FAT_INFO*)Device->Data;
+    ULONG     nBytes   = (pfi->FatType == 12) ? pfi->nEntries + pfi->nEntries / 2 + 1 : pfi->nEntries * 2;
+    ULONG     nSectors = MIN( (nBytes + pfi->Bpb->BPB_BytsPerSec - 1) / pfi->Bpb->BPB_BytsPerSec, pfi->FatSectors );
+    UCHAR*    Buffer;
+    ULONG     i;
+
+    if (nSectors * pfi->Bpb->BPB_BytsPerSec > FAT_TABLE_MAX)
+    {
+        errno = ENOMEM;
+        return FALSE;
+    }
+
+    Buffer = malloc( nSectors * pfi->Bpb->BPB_BytsPerSec );
     if (Buffer == NULL)
     {
-        return Res;
+        errno = ENOMEM;
+        return FALSE;
     }
 
-    if (ReadSector( Device, pfi->FatStart + Clus, 1, Buffer ) == 1)
+    if (ReadSector( Device, pfi->FatStart, nSectors, Buffer, RS_NOCACHE ) != nSectors)
     {
-        switch (pfi->FatType)
-        {
-            case 12:
-                if (Ofs == pfi->Bpb->BPB_BytsPerSec - 1)
-                {
-                    /* FAT12 entry spans across cluster boundry */
-                    Res = Buffer[ Ofs ];
+        free( Buffer );
+        return FALSE;
+    }
 
-                    /* Read the next FAT sector */
-                    if (ReadSector( Device, pfi->FatStart + Clus + 1, 1, Buffer ) == 1)
-                    {
-                        Res |= (Buffer[ 0 ] << 8);
-                    }
-                    else
-                    {
-                        Res = 0xFFFF;
-                    }
-                }
-                else
-                {
-                    Res = *(USHORT*)(Buffer + Ofs);
-                }
-                Res = (Cluster & 1) ? (Res >> 4) : (Res & 0xFFF);
-                break;
+    if (pfi->FatType == 16)
+    {
+        /* FAT16 is already a flat table */
+        pfi->Table = (USHORT*)Buffer;
+        return TRUE;
+    }
 
-            case 16:
-                Res = *(USHORT*)(Buffer + Ofs);
-                break;
+    /* Unpack the 12-bit entries */
+    pfi->Table = malloc( pfi->nEntries * sizeof(USHORT) );
+    if (pfi->Table == NULL)
+    {
+        errno = ENOMEM;
+        free( Buffer );
+        return FALSE;
+    }
 
-            case 32:
-                Res = *(ULONG*)(Buffer + Ofs);
-                break;
-        }
+    for (i = 0; i < pfi->nEntries; i++)
+    {
+        USHORT Entry = *(USHORT*)(Buffer + i + i / 2);
+        pfi->Table[ i ] = (i & 1) ? (Entry >> 4) : (Entry & 0xFFF);
     }
 
     free( Buffer );
-    return Res;
+    return TRUE;
 }
 
-static BOOL FindDirEntry( DEVICE* Device, ULONG Cluster, CHAR* Path, DIR_ENTRY* entry )
+/* Case-insensitive hash of the first @Length characters of @Name */
+static ULONG HashName( CONST CHAR* Name, ULONG Length )
 {
-    CHAR      OemFilename[12];
-    CHAR      Filename[256];
-    FAT_INFO* pfi    = (FAT_INFO*)Device->Data;
-    UCHAR*    Buffer = NULL;
-    UINT      nRootEntries = 0;
-    ULONG     Sector = 0;
-    CHAR*     Name;
+    ULONG Hash = 0;
 
-    /* For parsing Long Filename Entries */
-    UINT  LastDirEntry = 0;
-    UINT  DirEntry     = 0;
-    UCHAR Checksum     = 0;
+    while ((Length-- > 0) && (*Name != '\0'))
+    {
+        CHAR ch = *Name++;
+        Hash = Hash * 31 + toupper( ch );
+    }
+    return Hash;
+}
+
+static VOID FreeDirectory( FAT_INFO* pfi, DIRECTORY* Dir )
+{
+    ULONG i;
 
-    /* Duplicate path */
-    Name = malloc( strlen( Path ) + 1 );
-    if (Name == NULL)
+    for (i = 0; i < DIR_BUCKETS; i++)
+    {
+        while (Dir->Buckets[ i ] != NULL)
+        {
+            DENTRY* Next = Dir->Buckets[ i ]->Next;
+            free( Dir->Buckets[ i ] );
+            Dir->Buckets[ i ] = Next;
+        }
+    }
+    pfi->DirBytes -= Dir->Bytes;
+    free( Dir );
+}
+
+/* Drops the least recently used cached directory; returns FALSE if there is none */
+static BOOL EvictDirectory( FAT_INFO* pfi )
+{
+    DIRECTORY** Oldest = NULL;
+    DIRECTORY** Link;
+    DIRECTORY*  Dir;
+    ULONG       i;
+
+    for (i = 0; i < DIRS_BUCKETS; i++)
+    {
+        for (Link = &pfi->Directories[ i ]; *Link != NULL; Link = &(*Link)->Next)
+        {
+            if ((Oldest == NULL) || ((*Link)->Time < (*Oldest)->Time))
+            {
+                Oldest = Link;
+            }
+        }
+    }
+
+    if (Oldest == NULL)
     {
-        errno = ENOMEM;
         return FALSE;
     }
-    strcpy( Name, Path );
 
-    /* Trim and validate long name */
-    Name = Trim( Name );
-    if (!ValidateFilename( Name ))
+    Dir     = *Oldest;
+    *Oldest = Dir->Next;
+    FreeDirectory( pfi, Dir );
+    return TRUE;
+}
+
+/*
+ * Allocates @Size bytes for the directory cache, evicting directories to stay
+ * within DIR_CACHE_MAX or when the heap is full.
+ */
+static VOID* AllocDirCache( FAT_INFO* pfi, ULONG Size )
+{
+    VOID* Block = NULL;
+
+    while ((pfi->DirBytes + Size > DIR_CACHE_MAX) || ((Block = malloc( Size )) == NULL))
     {
-        errno = ENOENT;
-        free( Name );
+        if (!EvictDirectory( pfi ))
+        {
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    pfi->DirBytes += Size;
+    return Block;
+}
+
+/* Adds an entry with name @Name of @Length characters to the cached directory @Context */
+static BOOL AddDentry( DEVICE* Device, VOID* Context, CONST CHAR* Name, ULONG Length, BOOL IsLongName, DIR_ENTRY* pde )
+{
+    DIRECTORY* Dir    = (DIRECTORY*)Context;
+    DENTRY**   Bucket = &Dir->Buckets[ HashName( Name, Length ) % DIR_BUCKETS ];
+    DENTRY*    Dentry = AllocDirCache( (FAT_INFO*)Device->Data, sizeof(DENTRY) + Length );
+
+    if (Dentry == NULL)
+    {
+        return FALSE;
+    }
+
+    strncpy( Dentry->Name, Name, Length );
+    Dentry->Name[ Length ] = '\0';
+    Dentry->IsLongName     = IsLongName;
+    Dentry->Entry          = *pde;
+    Dentry->Next           = *Bucket;
+    *Bucket                = Dentry;
+    Dir->Bytes            += sizeof(DENTRY) + Length;
+    return TRUE;
+}
+
+/* Stops the scan at the entry named like the DIR_SEARCH in @Context */
+static BOOL MatchDentry( DEVICE* Device, VOID* Context, CONST CHAR* Name, ULONG Length, BOOL IsLongName, DIR_ENTRY* pde )
+{
+    DIR_SEARCH* Search = (DIR_SEARCH*)Context;
+
+    if ((IsLongName) ? (stricmp( Name, Search->Name ) == 0)
+                     : ((Search->OemName[0] != '\0') && (strncmp( Search->OemName, Name, 11 ) == 0)))
+    {
+        *Search->Entry = *pde;
+        Search->Found  = TRUE;
         return FALSE;
     }
+    return TRUE;
+}
+
+/*
+ * Reads the directory starting at @Cluster in one pass and calls @Func for
+ * each of its entries, with its long name if it has one. Returns FALSE if
+ * @Func stopped the scan or there was no memory for it.
+ */
+static BOOL ScanDirectory( DEVICE* Device, ULONG Cluster, DENTRYFUNC Func, VOID* Context )
+{
+    CHAR       Filename[256];
+    FAT_INFO*  pfi    = (FAT_INFO*)Device->Data;
+    UCHAR*     Buffer = NULL;
+    UINT       nRootEntries = 0;
+    ULONG      Sector = 0;
+
+    /* For parsing Long Filename Entries */
+    UINT  LastDirEntry = 0;
+    UINT  DirEntry     = 0;
+    UCHAR Checksum     = 0;
 
     Buffer = malloc( pfi->BytsPerClus );
     if (Buffer == NULL)
     {
         errno = ENOMEM;
-        free( Name );
         return FALSE;
     }
 
-    /* Transform to OEM string for check with short filename */
-    UnicodeToOem( OemFilename, Name );
-
     /* The root dir start sector is set in BPB */
     if (Cluster < 2)
     {
@@ -392,7 +651,7 @@ static BOOL FindDirEntry( DEVICE* Device, ULONG Cluster, CHAR* Path, DIR_ENTRY*
         }
 
         /* Read the cluster */
-        if (ReadSector( Device, Sector, pfi->Bpb->BPB_SecPerClus, Buffer ) != pfi->Bpb->BPB_SecPerClus)
+        if (ReadSector( Device, Sector, pfi->Bpb->BPB_SecPerClus, Buffer, RS_METADATA ) != pfi->Bpb->BPB_SecPerClus)
         {
             break;
         }
@@ -485,39 +744,25 @@ static BOOL FindDirEntry( DEVICE* Device, ULONG Cluster, CHAR* Path, DIR_ENTRY*
             }
             else
             {
+                BOOL Added;
+
                 /* This is the short filename entry */
-                if (LastDirEntry != 0)
+                if ((LastDirEntry != 0) &&
+                    ((DirEntry != 0) || (CheckSum( pde->DIR_Name ) != Checksum)))
                 {
-                    /* Short name with long name entries */
-                    if ((DirEntry != 0) || (CheckSum( pde->DIR_Name ) != Checksum))
-                    {
-                        /* Invalid LFN entries, ignore them */
-                        LastDirEntry = 0;
-                    }
-                    else if (stricmp( Filename, Name ) != 0)
-                    {
-                        /* Not the entry we want */
-                        pde = NULL;
-                    }
+                    /* Invalid LFN entries, ignore them */
+                    LastDirEntry = 0;
                 }
 
-                if (LastDirEntry == 0)
-                {
-                    /* Short name without long name entries */
-                    if (strncmp(OemFilename, pde->DIR_Name, 11) != 0)
-                    {
-                        /* Not the entry we want */
-                        pde = NULL;
-                    }
-                }
+                /* Entries with a long name are only found by their long name */
+                Added = (LastDirEntry != 0)
+                      ? Func( Device, Context, Filename, strlen( Filename ), TRUE, pde )
+                      : Func( Device, Context, pde->DIR_Name, 11, FALSE, pde );
 
-                if (pde != NULL)
+                if (!Added)
                 {
-                    /* Found the right entry */
-                    *entry = *pde;
-                    free( Name );
                     free( Buffer );
-                    return TRUE;
+                    return FALSE;
                 }
 
                 /* Reset LFN vars on a short filename entry */
@@ -541,17 +786,286 @@ static BOOL FindDirEntry( DEVICE* Device, ULONG Cluster, CHAR* Path, DIR_ENTRY*
         else
         {
             /* Else, use the FAT */
-            Cluster = GetNextCluster( Device, Cluster );
+            Cluster = pfi->NextCluster( Device, Cluster );
+        }
+    }
+
+    free( Buffer );
+    return TRUE;
+}
+
+/* Parses the directory starting at @Cluster into a new cached directory */
+static DIRECTORY* ReadDirectory( DEVICE* Device, ULONG Cluster )
+{
+    FAT_INFO*  pfi = (FAT_INFO*)Device->Data;
+    DIRECTORY* Dir = AllocDirCache( pfi, sizeof(DIRECTORY) );
+
+    if (Dir == NULL)
+    {
+        return NULL;
+    }
+    memset( Dir->Buckets, 0, sizeof(Dir->Buckets) );
+    Dir->Cluster = Cluster;
+    Dir->Bytes   = sizeof(DIRECTORY);
+
+    if (!ScanDirectory( Device, Cluster, AddDentry, Dir ))
+    {
+        FreeDirectory( pfi, Dir );
+        return NULL;
+    }
+    return Dir;
+}
+
+/*
+ * Returns the cached directory starting at @Cluster, reading it if needed.
+ * Returns NULL if the directory doesn't fit in the cache.
+ */
+static DIRECTORY* GetDirectory( DEVICE* Device, ULONG Cluster )
+{
+    FAT_INFO*   pfi = (FAT_INFO*)Device->Data;
+    DIRECTORY** Bucket;
+    DIRECTORY*  Dir;
+
+    if (Cluster < 2)
+    {
+        Cluster = 0;
+    }
+
+    Bucket = &pfi->Directories[ Cluster % DIRS_BUCKETS ];
+    for (Dir = *Bucket; Dir != NULL; Dir = Dir->Next)
+    {
+        if (Dir->Cluster == Cluster)
+        {
+            Dir->Time = pfi->Time++;
+            return Dir;
+        }
+    }
+
+    /* First look into this directory */
+    Dir = ReadDirectory( Device, Cluster );
+    if (Dir != NULL)
+    {
+        Dir->Time = pfi->Time++;
+        Dir->Next = *Bucket;
+        *Bucket   = Dir;
+    }
+    return Dir;
+}
+
+static BOOL FindDirEntry( DEVICE* Device, ULONG Cluster, CHAR* Path, DIR_ENTRY* entry )
+{
+    CHAR       OemFilename[12];
+    CHAR       Filename[256];
+    CHAR*      Name;
+    DIRECTORY* Dir;
+    DENTRY*    Dentry;
+    DIR_SEARCH Search;
+
+    if (strlen( Path ) > MAX_LONG_FILENAME_LENGTH)
+    {
+        errno = ENOENT;
+        return FALSE;
+    }
+
+    /* Trim and validate long name */
+    Name = Trim( strcpy( Filename, Path ) );
+    if (!ValidateFilename( Name ))
+    {
+        errno = ENOENT;
+        return FALSE;
+    }
+
+    /* Transform to OEM string for check with short filename */
+    UnicodeToOem( OemFilename, Name );
+
+    Dir = GetDirectory( Device, Cluster );
+    if (Dir == NULL)
+    {
+        /* The directory can't be cached, look through it on disk instead */
+        Search.Name    = Name;
+        Search.OemName = OemFilename;
+        Search.Entry   = entry;
+        Search.Found   = FALSE;
+        ScanDirectory( Device, Cluster, MatchDentry, &Search );
+        if (!Search.Found)
+        {
+            errno = ENOENT;
+        }
+        return Search.Found;
+    }
+
+    /* Look for a long filename */
+    for (Dentry = Dir->Buckets[ HashName( Name, MAX_LONG_FILENAME_LENGTH ) % DIR_BUCKETS ]; Dentry != NULL; Dentry = Dentry->Next)
+    {
+        if ((Dentry->IsLongName) && (stricmp( Dentry->Name, Name ) == 0))
+        {
+            *entry = Dentry->Entry;
+            return TRUE;
+        }
+    }
+
+    if (OemFilename[0] != '\0')
+    {
+        /* Look for a short filename */
+        for (Dentry = Dir->Buckets[ HashName( OemFilename, 11 ) % DIR_BUCKETS ]; Dentry != NULL; Dentry = Dentry->Next)
+        {
+            if ((!Dentry->IsLongName) && (strncmp( OemFilename, Dentry->Name, 11 ) == 0))
+            {
+                *entry = Dentry->Entry;
+                return TRUE;
+            }
         }
     }
 
     /* Entry not found */
     errno = ENOENT;
-    free( Name );
-    free( Buffer );
     return FALSE;
 }
 
+/* Returns the number of clusters the file's size takes */
+static ULONG GetClusterCount( FAT_INFO* pfi, FILE_INFO* File )
+{
+    return (File->Info.DIR_FileSize + pfi->BytsPerClus - 1) / pfi->BytsPerClus;
+}
+
+/*
+ * Walks the file's cluster chain once and stores it as a list of runs, so
+ * reads and seeks don't have to consult the FAT anymore. If the list can't
+ * grow, it is left partial and the rest of the chain is walked when read.
+ */
+static VOID BuildExtents( DEVICE* Device, FILE_INFO* File )
+{
+    FAT_INFO* pfi       = (FAT_INFO*)Device->Data;
+    ULONG     nClusters = GetClusterCount( pfi, File );
+    ULONG     Cluster   = MAKELONG(File->Info.DIR_FstClusHI, File->Info.DIR_FstClusLO);
+    ULONG     Index;
+
+    for (Index = 0; (Index < nClusters) && (Cluster >= 2) && (Cluster < pfi->EndCluster); Index++)
+    {
+        EXTENT* Last = (File->nExtents > 0) ? &File->Extents[ File->nExtents - 1 ] : NULL;
+
+        if ((Last != NULL) && (Cluster == Last->Cluster + Last->Length))
+        {
+            /* Cluster continues the current run */
+            Last->Length++;
+        }
+        else
+        {
+            /* Start a new run */
+            if (File->nExtents == File->nAllocated)
+            {
+                /* If doubling the list doesn't fit, growing it a bit still may */
+                ULONG   nAllocated = MAX( File->nAllocated * 2, EXTENT_MIN );
+                EXTENT* tmp        = realloc( File->Extents, nAllocated * sizeof(EXTENT) );
+                if (tmp == NULL)
+                {
+                    nAllocated = File->nAllocated + EXTENT_MIN;
+                    tmp        = realloc( File->Extents, nAllocated * sizeof(EXTENT) );
+                }
+
+                if (tmp == NULL)
+                {
+                    File->ChainCluster = Cluster;
+                    break;
+                }
+                File->Extents    = tmp;
+                File->nAllocated = nAllocated;
+            }
+
+            Last = &File->Extents[ File->nExtents++ ];
+            Last->FileCluster = Index;
+            Last->Cluster     = Cluster;
+            Last->Length      = 1;
+        }
+
+        Cluster = pfi->NextCluster( Device, Cluster );
+    }
+
+    /* A broken chain is only noticed when reading past it */
+    File->nMapped = Index;
+}
+
+/* Returns the run containing the file's @Index'th cluster, or NULL */
+static EXTENT* FindExtent( FILE_INFO* File, ULONG Index )
+{
+    ULONG Low  = 0;
+    ULONG High = File->nExtents;
+
+    /* Binary search for the last run starting at or before Index */
+    while (High - Low > 1)
+    {
+        ULONG Mid = (Low + High) / 2;
+        if (File->Extents[ Mid ].FileCluster <= Index)
+        {
+            Low = Mid;
+        }
+        else
+        {
+            High = Mid;
+        }
+    }
+
+    if ((Low < File->nExtents) && (Index - File->Extents[ Low ].FileCluster < File->Extents[ Low ].Length))
+    {
+        return &File->Extents[ Low ];
+    }
+    return NULL;
+}
+
+/* Makes File->Walk the run that starts with @Cluster, the file's @Index'th */
+static VOID WalkRun( DEVICE* Device, FILE_INFO* File, ULONG Index, ULONG Cluster )
+{
+    FAT_INFO* pfi       = (FAT_INFO*)Device->Data;
+    ULONG     nClusters = GetClusterCount( pfi, File );
+    EXTENT*   Walk      = &File->Walk;
+
+    Walk->FileCluster = Index;
+    Walk->Cluster     = Cluster;
+    Walk->Length      = 1;
+    while ((Index + Walk->Length < nClusters) &&
+           (pfi->NextCluster( Device, Cluster + Walk->Length - 1 ) == Cluster + Walk->Length))
+    {
+        Walk->Length++;
+    }
+}
+
+/*
+ * Returns the run containing the file's @Index'th cluster, or NULL. Past a
+ * partial extent list the chain is walked, on from the last run found there
+ * when reading forward.
+ */
+static EXTENT* GetExtent( DEVICE* Device, FILE_INFO* File, ULONG Index )
+{
+    FAT_INFO* pfi  = (FAT_INFO*)Device->Data;
+    EXTENT*   Walk = &File->Walk;
+    ULONG     Next;
+
+    if ((File->ChainCluster == 0) || (Index < File->nMapped))
+    {
+        return FindExtent( File, Index );
+    }
+
+    if ((Walk->Length == 0) || (Index < Walk->FileCluster))
+    {
+        /* Start where the list ends */
+        WalkRun( Device, File, File->nMapped, File->ChainCluster );
+    }
+
+    while (Index - Walk->FileCluster >= Walk->Length)
+    {
+        Next = pfi->NextCluster( Device, Walk->Cluster + Walk->Length - 1 );
+        if ((Walk->FileCluster + Walk->Length >= GetClusterCount( pfi, File )) ||
+            (Next < 2) || (Next >= pfi->EndCluster))
+        {
+            /* Past the file's size, or the cluster chain ended early */
+            return NULL;
+        }
+        WalkRun( Device, File, Walk->FileCluster + Walk->Length, Next );
+    }
+
+    return Walk;
+}
+
 static FILE* _OpenFile(DEVICE* Device, CHAR* Path )
 {
     FAT_INFO*  pfi     = (FAT_INFO*)Device->Data;
@@ -595,10 +1109,15 @@ static FILE* _OpenFile(DEVICE* Device, CHAR* Path )
             return NULL;
         }
 
-        file->Info    = de;
-        file->Cursor  = 0;
-        file->Cluster = MAKELONG(de.DIR_FstClusHI, de.DIR_FstClusLO);
+        file->Info         = de;
+        file->Cursor       = 0;
+        file->Extents      = NULL;
+        file->nExtents     = 0;
+        file->nAllocated   = 0;
+        file->ChainCluster = 0;
+        file->Walk.Length  = 0;
 
+        BuildExtents( Device, file );
         return (FILE*)file;
     }
 
@@ -629,86 +1148,39 @@ static ULONGLONG _ReadFile(FILE* file, VOID* Buffer, ULONGLONG nBytes)
         nBytes = File->Info.DIR_FileSize - File->Cursor;
     }
 
-    while ((File->Cluster >= 2) && (File->Cluster < pfi->EndCluster) && (Read < nBytes))
+    while (Read < nBytes)
     {
-        ULONGLONG nextClus  = (File->Cursor % pfi->BytsPerClus) + nBytes;
-        ULONGLONG len       = (nextClus + pfi->BytsPerClus - 1) / pfi->BytsPerClus;
-        ULONGLONG nClusters = 0;
-
-        /* Find out how long this run of consecutive clusters is */
-        do
-        {
-            nextClus = GetNextCluster( file->Device, File->Cluster + nClusters++ );
-        } while ((nextClus >= 2) && (nextClus < pfi->EndCluster) && /* Valid cluster? */
-                 (nextClus == File->Cluster + nClusters) &&         /* Next cluster?  */
-                 (nextClus  < File->Cluster + len));                /* Stop after nBytes */
+        EXTENT*   Extent = GetExtent( file->Device, File, (ULONG)(File->Cursor / pfi->BytsPerClus) );
+        ULONGLONG Offset;
+        ULONGLONG Sector;
+        ULONGLONG count;
+        ULONGLONG len;
 
-        /* Read the entire run of clusters */
-        while (nClusters > 0)
+        if (Extent == NULL)
         {
-            ULONGLONG nClus  = nClusters;
-            ULONGLONG Sector = pfi->DataStart + (File->Cluster - 2) * pfi->Bpb->BPB_SecPerClus;
-            CHAR*     ClusBuf;
-            CHAR*     src;
-
-            /* If we can't allocate the entire run at once, break it up
-             * into smaller pieces. Hence the above while loop */
-            do
-            {
-                ClusBuf = malloc( nClus * pfi->BytsPerClus );
-                if (ClusBuf != NULL)
-                {
-                    break;
-                }
-                nClus /= 2;
-            } while (nClus > 1);
-
-            if (ClusBuf == NULL)
-            {
-                /* Error, return what we read so far */
-                errno = ENOMEM;
-                return Read;
-            }
-
-            if (ReadSector( file->Device, Sector, nClus * pfi->Bpb->BPB_SecPerClus, ClusBuf ) != nClus * pfi->Bpb->BPB_SecPerClus)
-            {
-                /* Error, return what we read so far */
-                errno = EIO;
-                free( ClusBuf );
-                return Read;
-            }
-
-            /* Copy the full clusters by default */
-            src = ClusBuf;
-            len = nClus * pfi->BytsPerClus;
-
-            if (File->Cursor % pfi->BytsPerClus != 0)
-            {
-                /* Read starting unaligned bytes */
-                src += File->Cursor % pfi->BytsPerClus;
-                len -= File->Cursor % pfi->BytsPerClus;
-            }
+            /* The cluster chain ended early */
+            errno = EIO;
+            break;
+        }
 
-            if (nBytes < len)
-            {
-                /* Read remaining unaligned bytes */
-                len = nBytes;
-            }
+        /*
+         * Read the part of the run that we need straight into the buffer.
+         * Reads of several clusters are streamed past the cache.
+         */
+        Offset = File->Cursor - (ULONGLONG)Extent->FileCluster * pfi->BytsPerClus;
+        Sector = pfi->DataStart + (Extent->Cluster - 2) * pfi->Bpb->BPB_SecPerClus;
+        len    = MIN( (ULONGLONG)Extent->Length * pfi->BytsPerClus - Offset, nBytes - Read );
 
-            memcpy( Buffer, src, len );
-            Buffer         = (CHAR*)Buffer + len;
-            Read          += len;
-            nBytes        -= len;
-            File->Cluster += (File->Cursor + len) / pfi->BytsPerClus - File->Cursor / pfi->BytsPerClus;
-            File->Cursor  += len;
-            nClusters     -= nClus;
+        count = ReadSectorBytes( file->Device, Sector, Offset, len, Buffer, (len > pfi->BytsPerClus) ? RS_NOCACHE : 0 );
 
-            free( ClusBuf );
-        }
+        Buffer        = (CHAR*)Buffer + count;
+        Read         += count;
+        File->Cursor += count;
 
-        if (File->Cursor % pfi->BytsPerClus == 0)
+        if (count != len)
         {
-            File->Cluster = nextClus;
+            /* Error, return what we read so far */
+            break;
         }
     }
 
@@ -723,7 +1195,6 @@ static ULONGLONG _GetFilePointer( FILE* File )
 static BOOL _SetFilePointer( FILE* file, LONGLONG offset, INT whence )
 {
     FILE_INFO* File = (FILE_INFO*)file;
-    FAT_INFO*  pfi  = file->Device->Data;
 
     LONGLONG Cursor = offset;
     if (whence == FILE_CURRENT)
@@ -741,42 +1212,80 @@ static BOOL _SetFilePointer( FILE* file, LONGLONG offset, INT whence )
         return FALSE;
     }
 
-    /* We need to find the cluster for the new cursor.
-     * If the new cursor comes after the current cursor, no problem, just read
-     * FAT chain from here on. If it comes before, we have to start from 0.
-     */
+    File->Cursor = Cursor;
+
+    return TRUE;
+}
+
+static VOID _CloseFile( FILE* File )
+{
+    free( ((FILE_INFO*)File)->Extents );
+}
 
-    /* Align old cursor to start of cluster for ease */
-    File->Cursor = File->Cursor & -pfi->BytsPerClus;
+static ULONG _GetFileExtents( FILE* file, ULONGLONG Offset, ULONGLONG nBytes, FILE_EXTENT* Extents, ULONG nExtents )
+{
+    FILE_INFO* File  = (FILE_INFO*)file;
+    FAT_INFO*  pfi   = (FAT_INFO*)file->Device->Data;
+    ULONG      Count = 0;
 
-    if (Cursor < File->Cursor)
+    if (Offset >= File->Info.DIR_FileSize)
     {
-        File->Cursor  = 0;
-        File->Cluster = File->Info.DIR_FstClusLO;
+        return 0;
     }
+    nBytes = MIN( nBytes, File->Info.DIR_FileSize - Offset );
 
-    while (File->Cursor + pfi->BytsPerClus <= Cursor)
+    /* Same walk as _ReadFile, but we only note where the data is */
+    while (nBytes > 0)
     {
-        File->Cluster = GetNextCluster( file->Device, File->Cluster );
-        File->Cursor += pfi->BytsPerClus;
-    }
+        EXTENT*   Extent = GetExtent( file->Device, File, (ULONG)(Offset / pfi->BytsPerClus) );
+        ULONGLONG Start;
+        ULONGLONG len;
 
-    /* We're in the correct cluster now */
-    File->Cursor = Cursor;
+        if (Extent == NULL)
+        {
+            /* The cluster chain ended early */
+            break;
+        }
 
-    return TRUE;
-}
+        Start = Offset - (ULONGLONG)Extent->FileCluster * pfi->BytsPerClus;
+        len   = MIN( (ULONGLONG)Extent->Length * pfi->BytsPerClus - Start, nBytes );
 
-static VOID _CloseFile( FILE* File )
-{
-    /* We have no FAT-specific stuff to free */
+        if (Count < nExtents)
+        {
+            Extents[ Count ].Sector = pfi->DataStart + (Extent->Cluster - 2) * pfi->Bpb->BPB_SecPerClus;
+            Extents[ Count ].Offset = Start;
+            Extents[ Count ].Length = len;
+        }
+        Count++;
+
+        Offset += len;
+        nBytes -= len;
+    }
+
+    return Count;
 }
 
 /* Destroys all FAT private data */
 static VOID _Release( DEVICE* Device )
 {
     FAT_INFO* pfi = (FAT_INFO*)Device->Data;
+    ULONG     i;
+
+    for (i = 0; i < FAT_WINDOWS; i++)
+    {
+        free( pfi->Windows[ i ].Data );
+    }
 
+    for (i = 0; i < DIRS_BUCKETS; i++)
+    {
+        while (pfi->Directories[ i ] != NULL)
+        {
+            DIRECTORY* Next = pfi->Directories[ i ]->Next;
+            FreeDirectory( pfi, pfi->Directories[ i ] );
+            pfi->Directories[ i ] = Next;
+        }
+    }
+    free( pfi->Table );
     free( pfi->Bpb );
     free( Device->Data );
 }
@@ -810,15 +1319,8 @@ BOOL FatMount( DEVICE* Device )
         return FALSE;
     }
 
-    for (i = 0; i < MAX_READ_TRY; i++)
-    {
-        if (ReadSector( Device, 0, 1, Buffer ) == 1)
-        {
-            break;
-        }
-        ResetDrive( Device->DeviceId >> 24 );
-    }
-    if (i == MAX_READ_TRY)
+    /* ReadSector retries by itself */
+    if (ReadSector( Device, 0, 1, Buffer, RS_METADATA ) != 1)
     {
         free( Buffer );
         return FALSE;
@@ -918,17 +1420,53 @@ BOOL FatMount( DEVICE* Device )
 
     fi->nDataSectors = DataSec;
     fi->FatStart     = pBpb->BPB_RsvdSecCnt;
+    fi->FatSectors   = FATSz;
     fi->RootDirStart = fi->FatStart + (pBpb->BPB_NumFATs * FATSz);
     fi->DataStart    = fi->RootDirStart + RootDirSectors;
     fi->BytsPerClus  = pBpb->BPB_BytsPerSec * pBpb->BPB_SecPerClus;
+    fi->nEntries     = nClusters + 2;
+    fi->Table        = NULL;
+    fi->Time         = 0;
     fi->Bpb          = pBpb;
 
+    for (i = 0; i < FAT_WINDOWS; i++)
+    {
+        fi->Windows[ i ].Index = NO_WINDOW;
+        fi->Windows[ i ].Time  = 0;
+        fi->Windows[ i ].Data  = NULL;
+    }
+    memset( fi->Directories, 0, sizeof(fi->Directories) );
+    fi->DirBytes = 0;
+    Device->Data = fi;
+
+    /* Pick the FAT decoder; FAT12 can't be read in windows */
+    if ((fi->FatType != 32) && (LoadFatTable( Device )))
+    {
+        fi->NextCluster = NextClusterTable;
+    }
+    else if (fi->FatType == 16)
+    {
+        fi->NextCluster = NextCluster16;
+    }
+    else if (fi->FatType == 32)
+    {
+        fi->NextCluster = NextCluster32;
+    }
+    else
+    {
+        /* Keep the errno LoadFatTable() set */
+        free( fi );
+        free( Buffer );
+        return FALSE;
+    }
+
     Device->OpenFile       = _OpenFile;
     Device->SetFilePointer = _SetFilePointer;
     Device->GetFilePointer = _GetFilePointer;
     Device->GetFileSize    = _GetFileSize;
     Device->ReadFile       = _ReadFile;
     Device->CloseFile      = _CloseFile;
+    Device->GetFileExtents = _GetFileExtents;
     Device->Release        = _Release;
     Device->Data           = fi;
 
@@ -1,10 +1,22 @@
+#include <cache.h>
+#include <clock.h>
 #include <drive.h>
 #include <errno.h>
 #include <io.h>
+#include <log.h>
+#include <messages.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define MAX_READ_TRY    8   /* Try to a read a sector this many times at most */
+#define MAX_READ_TRY    5   /* Try to a read a bad sector this many times at most */
+#define CACHE_SHARE     4   /* The sector cache may use 1/CACHE_SHARE of the heap */
+#define READ_AHEAD_MIN  8   /* Initial read-ahead window for sequential reads, in sectors */
+#define MAX_PIECES      64  /* Most reads queued on the drives at once */
+#define CALIBRATE_PASSES 2  /* Times each transfer size reads a calibration window */
+#define QUEUE_TIMEOUT   0x1000000   /* Polls for a queued read before giving up */
+
+/* Most sectors of @pdi that fit in the transfer buffer */
+#define BOUNCE_SECTORS(pdi) MIN( (pdi)->MaxTransfer, MAX_TRANSFER_SIZE / (pdi)->nBytesPerSector )
 
 /* Registered Filesystems */
 BOOL FatMount( DEVICE* Device );
@@ -21,10 +33,41 @@ static FSMOUNTFUNC FsMountFunctions[] = {
 static DEVICE* Devices;
 static ULONG   BootDevice;
 
-VOID IoInitialize( ULONG device )
+/*
+ * Low memory bounce buffer for all BIOS transfers. The heap never lets a block
+ * span a 64 kB boundary, so neither does this buffer.
+ */
+static VOID*   TransferBuffer;
+
+/* A read queued on a drive, for part of an asynchronous request */
+typedef struct _IO_PIECE
+{
+    IO_REQUEST* Request;    /* NULL if the entry is free             */
+    DEVICE*     Device;
+    DRIVE_INFO* pdi;
+    INT         Tag;        /* From SubmitDrive()                    */
+    ULONGLONG   Offset;     /* First sector, relative to the request */
+    ULONG       nSectors;
+} IO_PIECE;
+
+static IO_PIECE Pieces[ MAX_PIECES ];
+
+/* Transfer sizes to calibrate with; all are capped at what the transfer buffer holds */
+static CONST ULONG CalibrationSizes[] = { 1, 8, 16, 32, 64, 127 };
+
+/* Windows spread over the disk, one per pass of each size and of the alignment test */
+#define N_CALIBRATION_SIZES (sizeof(CalibrationSizes) / sizeof(ULONG))
+#define CALIBRATE_WINDOWS   ((N_CALIBRATION_SIZES + 2) * CALIBRATE_PASSES)
+
+VOID IoInitialize( ULONG device, ULONG HeapSize )
 {
-    BootDevice = device;
-    Devices    = NULL;
+    DriveInitialize();
+
+    BootDevice     = device;
+    Devices        = NULL;
+    TransferBuffer = malloc( MAX_TRANSFER_SIZE );
+    memset( Pieces, 0, sizeof(Pieces) );
+    CacheInitialize( HeapSize / CACHE_SHARE );
 }
 
 static CHAR* ParseDevice( CHAR *path, ULONG* Device )
@@ -96,6 +139,555 @@ static CHAR* ParseDevice( CHAR *path, ULONG* Device )
     return endptr;
 }
 
+/*
+ * Recovers from a failed read by splitting it in halves. A half that reads
+ * fine is read once at its full size; a failing half is split further until
+ * the bad sector is found. That sector is retried with an exponential backoff
+ * before the failure is reported.
+ * Returns the number of sectors that were read before the bad sector.
+ */
+static ULONG ReadRecover( DRIVE_INFO* pdi, ULONGLONG Sector, ULONG nSectors, VOID* Buffer )
+{
+    ULONG Half = nSectors / 2;
+    ULONG Read;
+    INT   i;
+
+    if (nSectors == 1)
+    {
+        for (i = 0; i < MAX_READ_TRY; i++)
+        {
+            ULONG Ticks;
+
+            /* Give the drive some time before trying again */
+            ResetDrive( pdi->Drive );
+            for (Ticks = 1 << i; Ticks > 0; Ticks--)
+            {
+                WaitForInterrupt();
+            }
+
+            if (ReadDrive( pdi->Drive, Sector, 1, Buffer ) == 1)
+            {
+                return 1;
+            }
+        }
+
+        errno = EIO;
+        PrintError( MSG_IO_BAD_SECTOR, Sector, pdi->Drive );
+        return 0;
+    }
+
+    Read = (ReadDrive( pdi->Drive, Sector, Half, Buffer ) == Half)
+         ? Half
+         : ReadRecover( pdi, Sector, Half, Buffer );
+
+    if (Read == Half)
+    {
+        Buffer = (CHAR*)Buffer + Half * pdi->nBytesPerSector;
+        Read  += (ReadDrive( pdi->Drive, Sector + Half, nSectors - Half, Buffer ) == nSectors - Half)
+               ? nSectors - Half
+               : ReadRecover( pdi, Sector + Half, nSectors - Half, Buffer );
+    }
+
+    return Read;
+}
+
+static ULONGLONG ReadBounced( DRIVE_INFO* pdi, ULONGLONG Sector, ULONGLONG nSectors, VOID* Buffer );
+
+/*
+ * Reads sectors from the drive into a buffer that ReadDrive() can address.
+ * Failed BIOS calls are narrowed down to the bad sector by ReadRecover().
+ */
+static ULONGLONG ReadDirect( DRIVE_INFO* pdi, ULONGLONG Sector, ULONGLONG nSectors, VOID* Buffer )
+{
+    ULONGLONG Read = 0;
+
+    while (nSectors > 0)
+    {
+        ULONG count = GetTransferSize( pdi, Sector, nSectors, Buffer );
+
+        if (count == 0)
+        {
+            /* The sector straddles a 64 kB boundary, read it elsewhere */
+            if (ReadBounced( pdi, Sector, 1, Buffer ) != 1)
+            {
+                break;
+            }
+            count = 1;
+        }
+        else if (ReadDrive( pdi->Drive, Sector, count, Buffer ) != count)
+        {
+            if (~pdi->Flags & DIF_LOST)
+            {
+                /* The read failed, salvage what we can */
+                ResetDrive( pdi->Drive );
+                Read += ReadRecover( pdi, Sector, count, Buffer );
+            }
+            break;
+        }
+
+        nSectors -= count;
+        Sector   += count;
+        Read     += count;
+        Buffer    = (CHAR*)Buffer + (count * pdi->nBytesPerSector);
+    }
+
+    return Read;
+}
+
+/*
+ * Reads sectors from the drive through the transfer buffer into any buffer.
+ */
+static ULONGLONG ReadBounced( DRIVE_INFO* pdi, ULONGLONG Sector, ULONGLONG nSectors, VOID* Buffer )
+{
+    ULONGLONG Read = 0;
+
+    if (TransferBuffer == NULL)
+    {
+        /* We couldn't reserve the transfer buffer */
+        errno = ENOMEM;
+        return 0;
+    }
+
+    while (nSectors > 0)
+    {
+        ULONG count = ReadDirect( pdi, Sector, MIN( nSectors, BOUNCE_SECTORS(pdi) ), TransferBuffer );
+
+        memcpy( Buffer, TransferBuffer, count * pdi->nBytesPerSector );
+        Read += count;
+
+        if (count != MIN( nSectors, BOUNCE_SECTORS(pdi) ))
+        {
+            /* The read failed */
+            break;
+        }
+
+        nSectors -= count;
+        Sector   += count;
+        Buffer    = (CHAR*)Buffer + (count * pdi->nBytesPerSector);
+    }
+
+    return Read;
+}
+
+/*
+ * Reads the cylinder holding @Sector into the transfer buffer, or only its
+ * track if the cylinder doesn't fit. Drives without EDD are read like this
+ * so every track passes under the head only once. @First receives the first
+ * sector that was read; the number of sectors read is returned.
+ * This is tried once without recovery and returns 0 unless the whole
+ * cylinder was read, so a bad sector the caller didn't ask for is neither
+ * retried nor reported.
+ */
+static ULONG ReadCylinder( DRIVE_INFO* pdi, ULONGLONG Sector, ULONGLONG* First )
+{
+    ULONG nCylinder = pdi->nHeads * pdi->nSectors;
+    ULONG n         = pdi->nSectors;
+
+    if (nCylinder <= MAX_TRANSFER_SIZE / pdi->nBytesPerSector)
+    {
+        n = nCylinder;
+    }
+
+    *First = Sector - Sector % n;
+    n      = MIN( n, pdi->nTotalSectors - *First );
+    return (ReadDrive( pdi->Drive, *First, n, TransferBuffer ) == n) ? n : 0;
+}
+
+/* Called when a piece of @Request is done, hands it to @Device after the last one */
+static VOID FinishPiece( DEVICE* Device, IO_REQUEST* Request )
+{
+    IO_REQUEST** Tail;
+
+    if (--Request->nPending == 0)
+    {
+        for (Tail = &Device->Completed; *Tail != NULL; Tail = &(*Tail)->Next);
+        Request->Next = NULL;
+        *Tail         = Request;
+    }
+}
+
+/* Ends @Piece after @nRead of its sectors were read */
+static VOID EndPiece( IO_PIECE* Piece, ULONG nRead )
+{
+    IO_REQUEST* Request = Piece->Request;
+
+    if (nRead < Piece->nSectors)
+    {
+        /* Only the sectors before the first failure count */
+        Request->nRead = MIN( Request->nRead, Piece->Offset + nRead );
+        errno = EIO;
+    }
+
+    Piece->Request = NULL;
+    FinishPiece( Piece->Device, Request );
+}
+
+/* Returns TRUE if reads are queued on @pdi */
+static BOOL IsDriveBusy( DRIVE_INFO* pdi )
+{
+    INT i;
+
+    for (i = 0; i < MAX_PIECES; i++)
+    {
+        if ((Pieces[i].Request != NULL) && (Pieces[i].pdi == pdi))
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/* Takes a finished read off @pdi. Returns FALSE if none has finished */
+static BOOL ReapPiece( DRIVE_INFO* pdi )
+{
+    ULONG nRead;
+    INT   Tag = PollDrive( pdi, &nRead );
+    INT   i;
+
+    if (Tag < 0)
+    {
+        return FALSE;
+    }
+
+    for (i = 0; i < MAX_PIECES; i++)
+    {
+        if ((Pieces[i].Request != NULL) && (Pieces[i].pdi == pdi) && (Pieces[i].Tag == Tag))
+        {
+            EndPiece( &Pieces[i], nRead );
+            break;
+        }
+    }
+
+    return TRUE;
+}
+
+/*
+ * Waits for a read queued on @pdi to finish. If none does in time, all of
+ * them are given up and FALSE is returned.
+ */
+static BOOL WaitPiece( DRIVE_INFO* pdi )
+{
+    ULONG i;
+
+    for (i = 0; i < QUEUE_TIMEOUT; i++)
+    {
+        if (ReapPiece( pdi ))
+        {
+            return TRUE;
+        }
+    }
+
+    AbortDrive( pdi );
+    for (i = 0; i < MAX_PIECES; i++)
+    {
+        if ((Pieces[i].Request != NULL) && (Pieces[i].pdi == pdi))
+        {
+            EndPiece( &Pieces[i], 0 );
+        }
+    }
+
+    return FALSE;
+}
+
+/*
+ * Returns the first sector of calibration window @Index. The windows lie far
+ * apart, so no timed read is served from a cache that an earlier one filled.
+ */
+static ULONGLONG GetCalibrationWindow( DRIVE_INFO* pdi, ULONG Index )
+{
+    ULONG     Align  = MAX( 4096 / pdi->nBytesPerSector, 1 );
+    ULONGLONG Sector = pdi->nTotalSectors / (CALIBRATE_WINDOWS + 1) * (Index + 1);
+
+    return Sector - Sector % Align;
+}
+
+/* Reads @nSectors sectors at @Sector into the transfer buffer, in calls of @Size sectors */
+static BOOL ReadWindow( DRIVE_INFO* pdi, ULONGLONG Sector, ULONG nSectors, ULONG Size )
+{
+    ULONG Offset;
+
+    for (Offset = 0; Offset < nSectors; Offset += Size)
+    {
+        ULONG count = MIN( Size, nSectors - Offset );
+
+        if (ReadDrive( pdi->Drive, Sector + Offset, count,
+                       (CHAR*)TransferBuffer + Offset * pdi->nBytesPerSector ) != count)
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/*
+ * Reads @nSectors sectors into the transfer buffer in calls of @Size sectors,
+ * from calibration window @Index on, one window per pass, each @Skew sectors
+ * in. Returns the clock ticks that took, or 0 if a read failed.
+ */
+static ULONGLONG TimeReads( DRIVE_INFO* pdi, ULONG Index, ULONG Skew, ULONG nSectors, ULONG Size )
+{
+    ULONGLONG Start = ReadClock();
+    INT       i;
+
+    for (i = 0; i < CALIBRATE_PASSES; i++)
+    {
+        if (!ReadWindow( pdi, GetCalibrationWindow( pdi, Index + i ) + Skew, nSectors, Size ))
+        {
+            return 0;
+        }
+    }
+
+    return MAX( ReadClock() - Start, 1 );
+}
+
+/* Returns a checksum of the first @nSectors sectors in the transfer buffer */
+static ULONG Checksum( DRIVE_INFO* pdi, ULONG nSectors )
+{
+    ULONG* Data = TransferBuffer;
+    ULONG  Sum  = 0;
+    ULONG  i;
+
+    for (i = 0; i < nSectors * pdi->nBytesPerSector / sizeof(ULONG); i++)
+    {
+        Sum = ((Sum << 1) | (Sum >> 31)) + Data[i];
+    }
+
+    return Sum;
+}
+
+BOOL CalibrateDrive( UCHAR Drive )
+{
+    DRIVE_INFO* pdi = GetDriveParameters( Drive );
+    ULONG       Window;
+    ULONG       Align;
+    ULONG       Best      = 0;
+    ULONG       i;
+
+    if ((pdi == NULL) || (pdi->Disk != NULL) || (~pdi->ControllerFlags & 1) || (TransferBuffer == NULL) ||
+        (GetClockFrequency() == 0))
+    {
+        /* Native, CHS-only, or nothing to time it with */
+        return FALSE;
+    }
+
+    /* Time with only the drive's own limits in place */
+    pdi->Flags        &= ~DIF_CALIBRATED;
+    pdi->nRates        = 0;
+    pdi->TransferSize  = pdi->MaxTransfer;
+    pdi->ReadAlignment = 1;
+
+    /* Leave a sector past each window for the alignment test */
+    Window = BOUNCE_SECTORS(pdi);
+    if (pdi->nTotalSectors / (CALIBRATE_WINDOWS + 1) < Window + 1)
+    {
+        /* Too small to spread the windows */
+        return FALSE;
+    }
+
+    for (i = 0; (i < N_CALIBRATION_SIZES) && (pdi->nRates < MAX_RATES); i++)
+    {
+        ULONG     Size  = MIN( CalibrationSizes[i], Window );
+        ULONGLONG Ticks = TimeReads( pdi, i * CALIBRATE_PASSES, 0, Window, Size );
+        ULONG     n     = pdi->nRates++;
+        ULONG     Sum   = Checksum( pdi, Window );
+        BOOL      Valid = (Ticks != 0);
+
+        if ((n == 0) && (Ticks == 0))
+        {
+            /* Not even single sectors can be read */
+            pdi->nRates = 0;
+            return FALSE;
+        }
+
+        pdi->RateSize[n] = Size;
+        pdi->Rate[n]     = 0;
+
+        if ((Valid) && (Size > 1))
+        {
+            /* The data must match untimed single sector reads of the last window */
+            Valid = (ReadWindow( pdi, GetCalibrationWindow( pdi, (i + 1) * CALIBRATE_PASSES - 1 ), Window, 1 )) &&
+                    (Checksum( pdi, Window ) == Sum);
+        }
+
+        if (Valid)
+        {
+            /* Bytes per ms is kB/s */
+            pdi->Rate[n] = (ULONG)((ULONGLONG)Window * CALIBRATE_PASSES * pdi->nBytesPerSector *
+                                   GetClockFrequency() / Ticks);
+        }
+
+        if (pdi->Rate[n] > pdi->Rate[ Best ])
+        {
+            Best = n;
+        }
+
+        if (Size == Window)
+        {
+            break;
+        }
+    }
+
+    pdi->TransferSize = pdi->RateSize[ Best ];
+
+    /* See if reads starting on a 4 kB boundary are faster than those that don't */
+    Align = 4096 / pdi->nBytesPerSector;
+    if ((Align > 1) && (pdi->TransferSize >= Align))
+    {
+        ULONGLONG Aligned   = TimeReads( pdi, N_CALIBRATION_SIZES * CALIBRATE_PASSES, 0, Window, pdi->TransferSize );
+        ULONGLONG Unaligned = TimeReads( pdi, (N_CALIBRATION_SIZES + 1) * CALIBRATE_PASSES, 1, Window, pdi->TransferSize );
+
+        if ((Aligned != 0) && (Aligned + Aligned / 10 < Unaligned))
+        {
+            pdi->ReadAlignment = Align;
+        }
+    }
+
+    pdi->Flags |= DIF_CALIBRATED;
+    LogEvent( "Drive %02X: BIOS, %u sectors per call, aligned to %u", pdi->Drive, pdi->TransferSize, pdi->ReadAlignment );
+    return TRUE;
+}
+
+/*
+ * Reads sectors from the drive, going through the sector cache. The cache is
+ * shared by all devices on the drive, so @Sector is an absolute LBA.
+ * When the read ends with a miss, up to @ReadAhead sectors past the request
+ * are read into the cache as well. Drives without EDD have whole cylinders
+ * read into the cache instead.
+ */
+static ULONGLONG ReadCached( DRIVE_INFO* pdi, ULONGLONG Sector, ULONGLONG nSectors, VOID* Buffer, ULONG Flags, ULONG ReadAhead )
+{
+    ULONGLONG Read = 0;
+
+    /* The drive can only be read directly when no reads are queued on it */
+    while (IsDriveBusy( pdi ))
+    {
+        WaitPiece( pdi );
+    }
+
+    if (pdi->nBytesPerSector != CACHE_FRAME_SIZE)
+    {
+        /* The cache can't hold these sectors */
+        if (((ULONG)Buffer + nSectors * pdi->nBytesPerSector > LOW_MEMORY_END) &&
+            ((ULONG)Buffer % pdi->Alignment == 0) &&
+            (IsFlatBufferSupported( pdi->Drive, Buffer )))
+        {
+            return ReadDirect( pdi, Sector, nSectors, Buffer );
+        }
+        return ReadBounced( pdi, Sector, nSectors, Buffer );
+    }
+
+    while (nSectors > 0)
+    {
+        VOID*     tmpbuf;
+        ULONGLONG count = nSectors;
+
+        /* See if the current sector is cached */
+        tmpbuf = CacheLookup( pdi->Drive, Sector );
+        if (tmpbuf != NULL)
+        {
+            /* Yes, copy contents */
+            memcpy( Buffer, tmpbuf, pdi->nBytesPerSector );
+            count = 1;
+        }
+        else
+        {
+            /* No, read sectors from disk and cache */
+            INT       i;
+            ULONGLONG end    = Sector + 1;
+            ULONGLONG nAhead = 0;
+            ULONGLONG First  = Sector;  /* First sector in Source   */
+            ULONGLONG nRead  = 0;       /* Number of sectors in it  */
+            CHAR*     Source = Buffer;
+
+            /* See how many consecutive sectors aren't cached */
+            for (count = 1; (end < Sector + nSectors) && (count < pdi->MaxTransfer); end++, count++)
+            {
+                if (CacheLookup( pdi->Drive, end ) != NULL)
+                {
+                    break;
+                }
+            }
+
+            if ((!(Flags & RS_NOCACHE)) && (~pdi->ControllerFlags & 1) && (pdi->Disk == NULL) &&
+                (TransferBuffer != NULL) && ((nRead = ReadCylinder( pdi, Sector, &First )) > Sector - First))
+            {
+                /* The whole cylinder (or track) is in the transfer buffer */
+                Source = TransferBuffer;
+                count  = MIN( count, First + nRead - Sector );
+                memcpy( Buffer, Source + (Sector - First) * pdi->nBytesPerSector, count * pdi->nBytesPerSector );
+            }
+            else
+            {
+                First = Sector;
+
+                if ((!(Flags & RS_NOCACHE)) && (end == Sector + nSectors) && (end < pdi->nTotalSectors) &&
+                    (count < BOUNCE_SECTORS(pdi)))
+                {
+                    /* This is the end of the request, read ahead in the same call */
+                    nAhead = MIN( MIN( ReadAhead, BOUNCE_SECTORS(pdi) - count ), pdi->nTotalSectors - end );
+                }
+
+                if ((nAhead > 0) && (TransferBuffer != NULL) &&
+                    (ReadDrive( pdi->Drive, Sector, count + nAhead, TransferBuffer ) == count + nAhead))
+                {
+                    /*
+                     * Request and read-ahead were read into the transfer buffer.
+                     * This is tried once without recovery; if it fails, only the
+                     * requested sectors are read below, so nobody hears of
+                     * errors in sectors they didn't ask for.
+                     */
+                    nRead  = count + nAhead;
+                    Source = TransferBuffer;
+                    memcpy( Buffer, TransferBuffer, count * pdi->nBytesPerSector );
+                }
+                else if (((ULONG)Buffer + count * pdi->nBytesPerSector > LOW_MEMORY_END) &&
+                         ((ULONG)Buffer % pdi->Alignment == 0) &&
+                         (IsFlatBufferSupported( pdi->Drive, Buffer )))
+                {
+                    /* Read straight into the caller's buffer */
+                    nRead = count = ReadDirect( pdi, Sector, count, Buffer );
+                }
+                else
+                {
+                    /* Read as much as the BIOS allows */
+                    nRead = count = ReadBounced( pdi, Sector, count, Buffer );
+                }
+            }
+
+            if (count == 0)
+            {
+                /* The read failed */
+                break;
+            }
+
+            if (!(Flags & RS_NOCACHE))
+            {
+                /* Write to cache; only the requested sectors can be metadata */
+                for (i = 0; i < nRead; i++)
+                {
+                    BOOL  Requested = (First + i >= Sector) && (First + i < Sector + count);
+                    VOID* frame     = CacheInsert( pdi->Drive, First + i, Requested && (Flags & RS_METADATA) );
+                    if (frame != NULL)
+                    {
+                        /* Only write to cache if a frame could be spared */
+                        memcpy( frame, Source + i * CACHE_FRAME_SIZE, CACHE_FRAME_SIZE );
+                    }
+                }
+            }
+        }
+
+        /* Adjust values */
+        nSectors -= count;
+        Sector   += count;
+        Read     += count;
+        Buffer    = (CHAR*)Buffer + (count * pdi->nBytesPerSector);
+    }
+
+    return Read;
+}
+
 #define PART_UNUSED     0x00
 #define PART_EXTENDED1  0x05
 #define PART_EXTENDED2  0x0F
@@ -163,7 +755,7 @@ static DEVICE* OpenDevice( ULONG Device, BOOL MountFS )
             return NULL;
         }
 
-        if (ReadDrive( Drive, 0, 1, MBR ) != 1)
+        if (ReadCached( pdi, 0, 1, MBR, RS_METADATA, 0 ) != 1)
         {
             free( MBR );
             errno = EIO;
@@ -216,7 +808,7 @@ static DEVICE* OpenDevice( ULONG Device, BOOL MountFS )
             /* Now we have to traverse the extended partition list */
             for (i = 4; part != NULL; i++)
             {
-                if (ReadDrive( Drive, part->StartLBA, 1, MBR ) != 1)
+                if (ReadCached( pdi, part->StartLBA, 1, MBR, RS_METADATA, 0 ) != 1)
                 {
                     free( MBR );
                     errno = EIO;
@@ -287,8 +879,13 @@ static DEVICE* OpenDevice( ULONG Device, BOOL MountFS )
     pdev->StartSector   = Start;
     pdev->nSectors      = Size;
     pdev->hasFileSystem = MountFS;
-    pdev->Cache.nItems  = 0;
-    pdev->Cache.Time    = 0;
+    pdev->StreamNext    = 0;
+    pdev->ReadAhead     = 0;
+    pdev->Completed     = NULL;
+    pdev->nQueued       = 0;
+
+    /* Optional file system entry points */
+    pdev->GetFileExtents = NULL;
 
     /* Mount device */
     if (MountFS)
@@ -322,61 +919,47 @@ static DEVICE* OpenDevice( ULONG Device, BOOL MountFS )
     return pdev;
 }
 
-static VOID* ReadCache( CACHE* Cache, ULONGLONG Tag )
+ULONGLONG ReadSector( DEVICE* Device, ULONGLONG Sector, ULONGLONG nSectors, VOID* Buffer, ULONG Flags )
 {
-    ULONG i;
+    DRIVE_INFO* pdi = GetDriveParameters( Device->DeviceId >> 24 );
 
-    /* Search cache */
-    for (i = 0; i < Cache->nItems; i++)
+    if (pdi == NULL)
     {
-        if (Cache->Items[i].Tag == Tag)
-        {
-            /* Update access time */
-            Cache->Items[i].Time = Cache->Time++;
-
-            /* Return data */
-            return Cache->Items[i].Data;
-        }
+        errno = EIO;
+        return 0;
     }
 
-    /* Entry not cached */
-    return NULL;
-}
-
-static VOID WriteCache( CACHE* Cache, ULONGLONG Tag, VOID* Data )
-{
-    ULONG i = 0;
-
-    if (Cache->nItems == CACHE_SIZE)
+    if (Sector + nSectors > Device->nSectors)
     {
-        /* Cache is full, replace least recently used */
-        ULONG j;
+        /* Invalid sector and/or count */
+        errno = EIO;
+        return 0;
+    }
 
-        /* Find and free Least Recently Used */
-        for (j = 1; j < CACHE_SIZE; j++)
-        {
-            if (Cache->Items[j].Time < Cache->Items[i].Time)
-            {
-               i = j;
-            }
-        }
-        free( Cache->Items[i].Data );
+    /*
+     * Detect sequential streams. Rereading the last sector counts as well,
+     * since that's what small reads through ReadSectorBytes do.
+     */
+    if ((Sector <= Device->StreamNext) && (Sector + 1 >= Device->StreamNext))
+    {
+        /* Sequential, grow the read-ahead window */
+        Device->ReadAhead = MIN( MAX( 2 * Device->ReadAhead, READ_AHEAD_MIN ), pdi->MaxTransfer );
     }
     else
     {
-        i = Cache->nItems++;
+        /* Random access, shrink the read-ahead window */
+        Device->ReadAhead /= 2;
     }
+    Device->StreamNext = Sector + nSectors;
 
-    Cache->Items[i].Tag  = Tag;
-    Cache->Items[i].Time = Cache->Time++;
-    Cache->Items[i].Data = Data;
+    return ReadCached( pdi, Device->StartSector + Sector, nSectors, Buffer, Flags, Device->ReadAhead );
 }
 
-ULONGLONG ReadSector( DEVICE* Device, ULONGLONG Sector, ULONGLONG nSectors, VOID* Buffer )
+ULONGLONG ReadSectorBytes( DEVICE* Device, ULONGLONG Sector, ULONGLONG Offset, ULONGLONG nBytes, VOID* Buffer, ULONG Flags )
 {
-    ULONGLONG   Read  = 0;
-    UCHAR       Drive = Device->DeviceId >> 24;
-    DRIVE_INFO* pdi   = GetDriveParameters( Drive );
+    ULONGLONG   Read   = 0;
+    CHAR*       SecBuf = NULL;
+    DRIVE_INFO* pdi    = GetDriveParameters( Device->DeviceId >> 24 );
 
     if (pdi == NULL)
     {
@@ -384,103 +967,155 @@ ULONGLONG ReadSector( DEVICE* Device, ULONGLONG Sector, ULONGLONG nSectors, VOID
         return 0;
     }
 
-    if (Sector + nSectors > Device->nSectors)
-    {
-        /* Invalid sector and/or count */
-        errno = EIO;
-        return 0;
-    }
+    Sector += Offset / pdi->nBytesPerSector;
+    Offset %= pdi->nBytesPerSector;
 
-    while (nSectors > 0)
+    while (nBytes > 0)
     {
-        VOID*     tmpbuf;
-        ULONGLONG count = nSectors;
+        ULONGLONG len;
 
-        /* See if the current sector is cached */
-        tmpbuf = ReadCache( &Device->Cache, Sector );
-        if (tmpbuf != NULL)
-        {
-            /* Yes, copy contents */
-            memcpy( Buffer, tmpbuf, pdi->nBytesPerSector );
-            count = 1;
-        }
-        else
+        if ((Offset == 0) && (nBytes >= pdi->nBytesPerSector))
         {
-            /* No, read sectors from disk and cache */
-            INT       i;
-            ULONGLONG end = Sector + 1;
+            /* Read all whole sectors straight into the buffer */
+            ULONGLONG nSectors = nBytes / pdi->nBytesPerSector;
+            ULONGLONG count    = ReadSector( Device, Sector, nSectors, Buffer, Flags );
 
-            /* See how many consecutive sectors aren't cached */
-            for (count = 1; end < Sector + nSectors; end++, count++)
+            len = count * pdi->nBytesPerSector;
+            if (count != nSectors)
             {
-                if (ReadCache( &Device->Cache, end ) != NULL)
-                {
-                    break;
-                }
+                Read += len;
+                break;
             }
-
-            /* Allocate as much sectors as possible */
-            do
-            {
-                tmpbuf = malloc( count * pdi->nBytesPerSector );
-                if (tmpbuf != NULL)
-                {
-                    break;
-                }
-
-                /* We can't allocate this much, try half as much */
-                count /= 2;
-            } while (count > 1);
-
-            if (tmpbuf == NULL)
+        }
+        else
+        {
+            /*
+             * Partial sector, go through a sector buffer. Always cache these,
+             * the next sequential read most likely needs the same sector.
+             */
+            if ((SecBuf == NULL) && ((SecBuf = malloc( pdi->nBytesPerSector )) == NULL))
             {
-                /* Not enough memory for even one sector */
                 errno = ENOMEM;
                 break;
             }
 
-            for (i = 0; i < MAX_READ_TRY; i++)
+            if (ReadSector( Device, Sector, 1, SecBuf, Flags & ~RS_NOCACHE ) != 1)
             {
-                if (ReadDrive( Drive, Device->StartSector + Sector, count, tmpbuf ) == count)
-                {
-                    break;
-                }
-                ResetDrive( Drive );
-            }
-
-            if (i == MAX_READ_TRY)
-            {
-                /* The read failed */
-                errno = EIO;
-                free( tmpbuf );
                 break;
             }
 
-            /* Write to cache */
-            for (i = 0; i < count; i++)
+            len = MIN( nBytes, pdi->nBytesPerSector - Offset );
+            memcpy( Buffer, SecBuf + Offset, len );
+        }
+
+        Buffer  = (CHAR*)Buffer + len;
+        Read   += len;
+        nBytes -= len;
+        Sector += (Offset + len) / pdi->nBytesPerSector;
+        Offset  = 0;
+    }
+
+    free( SecBuf );
+    return Read;
+}
+
+BOOL SubmitRead( DEVICE* Device, IO_REQUEST* Request )
+{
+    DRIVE_INFO* pdi = GetDriveParameters( Device->DeviceId >> 24 );
+    ULONGLONG   Offset;
+
+    if ((pdi == NULL) || (Request->Sector + Request->nSectors > Device->nSectors))
+    {
+        errno = EIO;
+        return FALSE;
+    }
+
+    /* The request is held until all its pieces are queued */
+    Request->nRead    = Request->nSectors;
+    Request->nPending = 1;
+    Device->nQueued++;
+
+    for (Offset = 0; Offset < Request->nSectors; )
+    {
+        ULONGLONG Remaining = Request->nSectors - Offset;
+        CHAR*     Buffer    = (CHAR*)Request->Buffer + Offset * pdi->nBytesPerSector;
+        IO_PIECE* Piece     = NULL;
+        ULONG     count     = 0;
+        INT       Tag       = -1;
+        INT       i;
+
+        for (i = 0; (i < MAX_PIECES) && (Piece == NULL); i++)
+        {
+            if (Pieces[i].Request == NULL)
             {
-                VOID* secbuf = malloc( pdi->nBytesPerSector );
-                if (secbuf != NULL)
-                {
-                    /* Only write to cache if we can allocate memory */
-                    memcpy( secbuf, (CHAR*)tmpbuf + i * pdi->nBytesPerSector, pdi->nBytesPerSector );
-                    WriteCache( &Device->Cache, Sector + i, secbuf );
-                }
+                Piece = &Pieces[i];
             }
+        }
 
-            /* Copy read data to user buffer */
-            memcpy( Buffer, tmpbuf, count * pdi->nBytesPerSector );
-            free( tmpbuf );
+        if ((Piece != NULL) && (pdi->Disk != NULL) && (pdi->Disk->MaxSubmit > 0))
+        {
+            count = MIN( Remaining, pdi->Disk->MaxSubmit );
+            Tag   = SubmitDrive( pdi, Device->StartSector + Request->Sector + Offset, count, Buffer );
         }
 
-        /* Adjust values */
-        nSectors -= count;
-        Sector   += count;
-        Read     += count;
-        Buffer    = (CHAR*)Buffer + (count * pdi->nBytesPerSector);
+        if (Tag >= 0)
+        {
+            Piece->Request  = Request;
+            Piece->Device   = Device;
+            Piece->pdi      = pdi;
+            Piece->Tag      = Tag;
+            Piece->Offset   = Offset;
+            Piece->nSectors = count;
+
+            Request->nPending++;
+            Offset += count;
+        }
+        else if (IsDriveBusy( pdi ))
+        {
+            /* Out of tags, wait for one to come free */
+            WaitPiece( pdi );
+        }
+        else
+        {
+            /* The drive can't queue reads, read the rest right away */
+            Remaining      = ReadSector( Device, Request->Sector + Offset, Remaining, Buffer, RS_NOCACHE );
+            Request->nRead = MIN( Request->nRead, Offset + Remaining );
+            break;
+        }
     }
 
-    return Read;
+    FinishPiece( Device, Request );
+    return TRUE;
+}
+
+IO_REQUEST* PollRead( DEVICE* Device )
+{
+    DRIVE_INFO* pdi = GetDriveParameters( Device->DeviceId >> 24 );
+    IO_REQUEST* Request;
+
+    while ((pdi != NULL) && (ReapPiece( pdi )));
+
+    Request = Device->Completed;
+    if (Request != NULL)
+    {
+        Device->Completed = Request->Next;
+        Device->nQueued--;
+    }
+
+    return Request;
+}
+
+IO_REQUEST* WaitRead( DEVICE* Device )
+{
+    DRIVE_INFO* pdi = GetDriveParameters( Device->DeviceId >> 24 );
+
+    /* Queued requests always have pieces on the drive until they complete */
+    while ((pdi != NULL) && (Device->nQueued > 0) && (Device->Completed == NULL))
+    {
+        WaitPiece( pdi );
+    }
+
+    return PollRead( Device );
 }
 
 BOOL IsDevice( FILE* file )
@@ -536,6 +1171,16 @@ ULONGLONG GetFilePointer( FILE* File )
     return File->Device->GetFilePointer( File );
 }
 
+ULONG GetFileExtents( FILE* File, ULONGLONG Offset, ULONGLONG nBytes, FILE_EXTENT* Extents, ULONG nExtents )
+{
+    if (File->Device->GetFileExtents == NULL)
+    {
+        errno = ENOFSYS;
+        return 0;
+    }
+    return File->Device->GetFileExtents( File, Offset, nBytes, Extents, nExtents );
+}
+
 VOID CloseFile( FILE* File )
 {
     File->Device->CloseFile( File );
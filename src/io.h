@@ -3,7 +3,9 @@
 
 #include <types.h>
 
-typedef struct _DEVICE DEVICE;
+typedef struct _DEVICE      DEVICE;
+typedef struct _IO_REQUEST  IO_REQUEST;
+typedef struct _FILE_EXTENT FILE_EXTENT;
 
 typedef struct _FILE
 {
@@ -13,30 +15,20 @@ typedef struct _FILE
     /* Followed by file-system specific data */
 } FILE;
 
-#define CACHE_SIZE  32  /* Remember this amount of sectors per device */
-
-typedef struct _CACHE_ITEM
-{
-    ULONGLONG Tag;
-    ULONG     Time;
-    VOID*     Data;
-} CACHE_ITEM;
-
-typedef struct _CACHE
-{
-    ULONG nItems;
-    ULONG Time;
-
-    CACHE_ITEM Items[ CACHE_SIZE ];
-} CACHE;
-
 struct _DEVICE
 {
     ULONG     DeviceId;
     ULONGLONG StartSector;
     ULONGLONG nSectors;
     BOOL      hasFileSystem;
-    CACHE     Cache;
+
+    /* Sequential stream detection for read-ahead */
+    ULONGLONG StreamNext;   /* Sector following the last read     */
+    ULONG     ReadAhead;    /* Current read-ahead window, sectors */
+
+    /* Asynchronous reads */
+    IO_REQUEST* Completed;  /* Finished, not yet handed back */
+    ULONG       nQueued;    /* Submitted, not yet handed back */
 
     /* File system information */
     FILE*     (*OpenFile)(DEVICE*, CHAR*);
@@ -45,6 +37,7 @@ struct _DEVICE
     BOOL      (*SetFilePointer)(FILE*, LONGLONG, INT);
     ULONGLONG (*GetFilePointer)(FILE*);
     VOID      (*CloseFile)(FILE*);
+    ULONG     (*GetFileExtents)(FILE*, ULONGLONG, ULONGLONG, FILE_EXTENT*, ULONG);
     VOID      (*Release)(DEVICE*);
     VOID*     Data;      /* Private File System data */
 
@@ -52,9 +45,84 @@ struct _DEVICE
     DEVICE* Next;
 };
 
-ULONGLONG ReadSector( DEVICE* Device, ULONGLONG Sector, ULONGLONG nSectors, VOID* Buffer );
+/* @Flags values for ReadSector and ReadSectorBytes */
+#define RS_NOCACHE   0x0001  /* Streaming read, don't add the sectors to the cache */
+#define RS_METADATA  0x0002  /* File system metadata, never replaced by data */
+
+ULONGLONG ReadSector( DEVICE* Device, ULONGLONG Sector, ULONGLONG nSectors, VOID* Buffer, ULONG Flags );
+
+/*
+ * Reads @nBytes bytes, starting @Offset bytes into sector @Sector of @Device.
+ * Whole sectors are read straight into @Buffer, only partial sectors at the
+ * start and end go through a sector buffer.
+ * The number of read bytes is returned.
+ */
+ULONGLONG ReadSectorBytes( DEVICE* Device, ULONGLONG Sector, ULONGLONG Offset, ULONGLONG nBytes, VOID* Buffer, ULONG Flags );
+
+/*
+ * An asynchronous read of whole sectors. The caller fills in the first four
+ * fields and keeps the request alive until PollRead() or WaitRead() hands it
+ * back; the rest belongs to the I/O Manager.
+ */
+struct _IO_REQUEST
+{
+    ULONGLONG   Sector;     /* First sector, relative to the device */
+    ULONGLONG   nSectors;
+    VOID*       Buffer;
+    VOID*       Context;    /* For the caller                        */
+
+    ULONGLONG   nRead;      /* Sectors read before the first failure */
+    ULONG       nPending;
+    IO_REQUEST* Next;
+};
 
-VOID IoInitialize( ULONG device );
+/*
+ * Queues @Request on @Device and returns without waiting for it, if the
+ * drive's native driver allows. Large requests are split over several queued
+ * reads, which may finish in any order. On other drives the request is read
+ * before this returns, but is still handed back by PollRead()/WaitRead().
+ * The read bypasses the sector cache. Returns FALSE if the request is invalid.
+ */
+BOOL SubmitRead( DEVICE* Device, IO_REQUEST* Request );
+
+/*
+ * Returns a finished request of @Device, or NULL if none has finished yet.
+ * Requests finish in any order.
+ */
+IO_REQUEST* PollRead( DEVICE* Device );
+
+/*
+ * Like PollRead(), but waits for a request to finish. Returns NULL if no
+ * requests are queued on @Device.
+ */
+IO_REQUEST* WaitRead( DEVICE* Device );
+
+/*
+ * Times reads of several sizes from BIOS drive @Drive and has ReadSector() use
+ * the fastest size that returns the same data as single sector reads. Calls
+ * are also kept on 4 kB boundaries if that is faster. Each timed read goes to
+ * its own window of the disk, so the drive's cache doesn't skew the rates.
+ * Drives are only calibrated on request, since this takes a while. Returns
+ * FALSE if the drive couldn't be calibrated, or has a native driver.
+ */
+BOOL CalibrateDrive( UCHAR Drive );
+
+/*
+ * Initializes the I/O Manager. @device is the boot device, @HeapSize the
+ * size of the heap, part of which is used for the sector cache.
+ */
+VOID IoInitialize( ULONG device, ULONG HeapSize );
+
+/*
+ * A run of a file's data on its device. The data starts @Offset bytes into
+ * sector @Sector, like with ReadSectorBytes().
+ */
+struct _FILE_EXTENT
+{
+    ULONGLONG Sector;       /* Relative to the device */
+    ULONGLONG Offset;
+    ULONGLONG Length;       /* In bytes               */
+};
 
 /* Returns TRUE if the Path indicates a device (instead of a file) */
 BOOL IsDevice( FILE* File );
@@ -71,4 +139,14 @@ ULONGLONG GetFilePointer( FILE* File );
 ULONGLONG GetFileSize   ( FILE* File );
 VOID      CloseFile     ( FILE* File );
 
+/*
+ * Describes where the @nBytes bytes at offset @Offset in @File are on its
+ * device, in file order. Up to @nExtents runs are stored in @Extents, but the
+ * number of runs that make up the range is returned, so it can be called
+ * with no buffer first. The range is cut off at the end of the file. If the
+ * runs cover less than that, the file is damaged. Returns 0 and sets errno
+ * to ENOFSYS if the file system can't tell.
+ */
+ULONG GetFileExtents( FILE* File, ULONGLONG Offset, ULONGLONG nBytes, FILE_EXTENT* Extents, ULONG nExtents );
+
 #endif
@@ -0,0 +1,225 @@
+#include <keyboard.h>
+#include <port.h>
+
+/*
+ * i8042 keyboard
+ *
+ * With the keyboard interrupt masked, scan codes stay in the controller
+ * until we read them, so the BIOS never sees them. Keys the BIOS buffered
+ * before we took over are read from its buffer in the BIOS data area.
+ * The controller's scan code translation, which the BIOS turns on, gives us
+ * set 1 codes. The BIOS returns the same codes for most keys, but has codes
+ * of its own for F11/F12 and for keys pressed with Shift, Ctrl or Alt; these
+ * are turned back into the set 1 code of the key, so both paths agree.
+ */
+
+#define KBC_DATA          0x60
+#define KBC_STATUS        0x64
+
+#define STATUS_OUTPUT     0x01  /* A byte is waiting in KBC_DATA */
+#define STATUS_AUX        0x20  /* ... and it's from the mouse   */
+
+#define PIC1_MASK         0x21
+#define IRQ_KEYBOARD      0x02
+
+#define SCAN_EXTENDED     0xE0
+#define SCAN_PAUSE        0xE1  /* Followed by five more bytes   */
+#define SCAN_RELEASE      0x80
+
+#define MAX_READS         16    /* Bytes read per call, at most  */
+
+/* Keyboard buffer in the BIOS data area, offsets from segment 0x40 */
+#define BDA_BASE           0x400
+#define BDA_KEYBOARD_HEAD  0x1A
+#define BDA_KEYBOARD_TAIL  0x1C
+#define BDA_KEYBOARD_START 0x80
+#define BDA_KEYBOARD_END   0x82
+
+/* BIOS key codes that aren't set 1 codes */
+#define BIOS_KEY_FIRST     0x54
+#define BIOS_KEY_LAST      0xA6
+#define BIOS_KEY_EXTENDED  0xE0  /* Keypad Enter and '/'; the character tells */
+
+/* Set 1 codes for BIOS codes BIOS_KEY_FIRST to BIOS_KEY_LAST, 0 if none */
+static CONST UCHAR BiosKeys[] =
+{
+    /* 54: Shift-F1..F10, Ctrl-F1..F10 */
+    0x3B, 0x3C, 0x3D, 0x3E, 0x3F, 0x40, 0x41, 0x42, 0x43, 0x44,
+    0x3B, 0x3C, 0x3D, 0x3E, 0x3F, 0x40, 0x41, 0x42, 0x43, 0x44,
+    /* 68: Alt-F1..F10 */
+    0x3B, 0x3C, 0x3D, 0x3E, 0x3F, 0x40, 0x41, 0x42, 0x43, 0x44,
+    /* 72: Ctrl-PrtSc, Ctrl-cursor keys */
+    0x37, 0x4B, 0x4D, 0x4F, 0x51, 0x47,
+    /* 78: Alt-1..Alt-= */
+    0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B,
+    0x0C, 0x0D,
+    /* 84: Ctrl-PgUp, F11/F12 alone and with Shift, Ctrl, Alt */
+    0x49, 0x57, 0x58, 0x57, 0x58, 0x57, 0x58, 0x57, 0x58,
+    /* 8D: Ctrl-cursor and keypad keys, Ctrl-Tab */
+    0x48, 0x4A, 0x4C, 0x4E, 0x50, 0x52, 0x53, 0x0F, 0x35, 0x37,
+    /* 97: Alt-cursor and editing keys */
+    0x47, 0x48, 0x49, 0x00, 0x4B, 0x00, 0x4D, 0x00, 0x4F, 0x50,
+    0x51, 0x52, 0x53,
+    /* A4: Alt-keypad /, Alt-Tab, Alt-keypad Enter */
+    0x35, 0x0F, 0x1C
+};
+
+static BOOL            Native;
+static UCHAR           SavedMask;
+static BOOL            Extended;    /* The last byte was SCAN_EXTENDED */
+static ULONG           nSkip;       /* Bytes left of a Pause sequence  */
+static volatile UCHAR* Bda;
+
+static volatile USHORT* BdaWord( ULONG Offset )
+{
+    return (volatile USHORT*)(Bda + Offset);
+}
+
+BOOL KeyboardInitialize( VOID )
+{
+    Native   = FALSE;
+    Extended = FALSE;
+    nSkip    = 0;
+    Bda      = (UCHAR*)BDA_BASE;
+
+    if (inb( KBC_STATUS ) == 0xFF)
+    {
+        /* Nothing there, USB keyboards without legacy emulation */
+        return FALSE;
+    }
+
+    SavedMask = inb( PIC1_MASK );
+    outb( PIC1_MASK, SavedMask | IRQ_KEYBOARD );
+    Native = TRUE;
+    return TRUE;
+}
+
+BOOL IsKeyboardNative( VOID )
+{
+    return Native;
+}
+
+VOID KeyboardRelease( VOID )
+{
+    if (Native)
+    {
+        outb( PIC1_MASK, (inb( PIC1_MASK ) & ~IRQ_KEYBOARD) | (SavedMask & IRQ_KEYBOARD) );
+        Native = FALSE;
+    }
+}
+
+INT TranslateBiosKey( USHORT Key )
+{
+    UCHAR Code = Key >> 8;
+    UCHAR Char = Key & 0xFF;
+
+    if (Code == BIOS_KEY_EXTENDED)
+    {
+        return ((Char == '\r') || (Char == '\n')) ? 0x1C : (Char == '/') ? 0x35 : 0;
+    }
+    if ((Code >= BIOS_KEY_FIRST) && (Code <= BIOS_KEY_LAST))
+    {
+        return BiosKeys[ Code - BIOS_KEY_FIRST ];
+    }
+    return Code;
+}
+
+/* Takes a key from the BIOS keyboard buffer, or returns -1 */
+static INT ReadBiosBuffer( VOID )
+{
+    USHORT Head = *BdaWord( BDA_KEYBOARD_HEAD );
+    USHORT Key;
+
+    if (Head == *BdaWord( BDA_KEYBOARD_TAIL ))
+    {
+        return -1;
+    }
+
+    Key   = *BdaWord( Head );
+    Head += 2;
+    if (Head >= *BdaWord( BDA_KEYBOARD_END ))
+    {
+        Head = *BdaWord( BDA_KEYBOARD_START );
+    }
+    *BdaWord( BDA_KEYBOARD_HEAD ) = Head;
+
+    return TranslateBiosKey( Key );
+}
+
+static BOOL IsModifier( UCHAR Code, BOOL IsExtended )
+{
+    switch (Code)
+    {
+        case 0x1D:  /* Ctrl        */
+        case 0x2A:  /* Left Shift  */
+        case 0x36:  /* Right Shift */
+        case 0x38:  /* Alt         */
+        case 0x3A:  /* Caps Lock   */
+        case 0x45:  /* Num Lock    */
+        case 0x46:  /* Scroll Lock */
+            return TRUE;
+
+        case 0x5B:  /* Windows keys */
+        case 0x5C:
+        case 0x5D:
+            return IsExtended;
+    }
+    return FALSE;
+}
+
+INT ReadKeyboard( VOID )
+{
+    UCHAR Status;
+    UCHAR Code;
+    BOOL  IsExtended;
+    INT   Key;
+    ULONG i;
+
+    if (!Native)
+    {
+        return -1;
+    }
+
+    if ((Key = ReadBiosBuffer()) > 0)
+    {
+        return Key;
+    }
+
+    for (i = 0; (i < MAX_READS) && ((Status = inb( KBC_STATUS )) & STATUS_OUTPUT); i++)
+    {
+        Code = inb( KBC_DATA );
+
+        if (Status & STATUS_AUX)
+        {
+            /* Mouse data */
+            continue;
+        }
+
+        if (nSkip > 0)
+        {
+            nSkip--;
+            continue;
+        }
+
+        if (Code == SCAN_PAUSE)
+        {
+            nSkip = 5;
+            continue;
+        }
+
+        if (Code == SCAN_EXTENDED)
+        {
+            Extended = TRUE;
+            continue;
+        }
+
+        IsExtended = Extended;
+        Extended   = FALSE;
+
+        if ((~Code & SCAN_RELEASE) && (!IsModifier( Code, IsExtended )))
+        {
+            return Code;
+        }
+    }
+    return -1;
+}
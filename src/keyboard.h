@@ -0,0 +1,34 @@
+#ifndef KEYBOARD_H
+#define KEYBOARD_H
+
+#include <types.h>
+
+/*
+ * Takes the keyboard over from the BIOS if there is an i8042 keyboard
+ * controller: its interrupt is masked and the controller is polled instead.
+ * Returns FALSE if there is no controller, in which case the BIOS keeps the
+ * keyboard.
+ */
+BOOL KeyboardInitialize( VOID );
+
+/* Returns TRUE if the keyboard was taken over from the BIOS */
+BOOL IsKeyboardNative( VOID );
+
+/* Hands the keyboard back to the BIOS; call before leaving osldr */
+VOID KeyboardRelease( VOID );
+
+/*
+ * Returns the scan code (set 1) of the next key press, or -1 if no key was
+ * pressed. Modifier keys and key releases
+ * are skipped.
+ */
+INT  ReadKeyboard( VOID );
+
+/*
+ * Returns the set 1 scan code, as ReadKeyboard() would, of a key the BIOS
+ * returned as @Key (scan code in the high byte, character in the low byte),
+ * or 0 for a key without one.
+ */
+INT  TranslateBiosKey( USHORT Key );
+
+#endif
@@ -1,8 +1,14 @@
+#include <clock.h>
+#include <console.h>
 #include <drive.h>
 #include <errno.h>
+#include <keyboard.h>
+#include <log.h>
 #include <mem.h>
+#include <plan.h>
 #include <string.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "loader.h"
@@ -89,6 +95,10 @@ static VOID LoadBootsector( IMAGE* image )
             if (*(USHORT*)&buf[ size - 2 ] == 0xAA55)
             {
                 /* This function shouldn't return */
+                LogEvent( "Starting bootsector from drive %02X", image->Drive );
+                FlushConsole();
+                ReleaseNativeDisks();
+                KeyboardRelease();
                 CallAsBootsector( image->Drive, 0x7C00 );
                 errno = EFAULT;
             }
@@ -104,11 +114,96 @@ static VOID LoadBootsector( IMAGE* image )
     }
 }
 
+/*
+ * Appends the @Length bytes at @Data, allocated with PhysAlloc() for
+ * @Size bytes, to the modules as @Name. Frees @Data if that fails.
+ */
+static VOID AppendModule( MULTIBOOT_INFO* mbi, CHAR* Data, ULONG Length, ULONG Size, CHAR* Name )
+{
+    MODULE* Modules = realloc( mbi->ModuleAddress, (mbi->ModuleCount + 1) * sizeof(MODULE) );
+    if (Modules == NULL)
+    {
+        PhysFree( Data, Size );
+        return;
+    }
+
+    Modules[ mbi->ModuleCount ].ModStart = (ULONG)Data;
+    Modules[ mbi->ModuleCount ].ModEnd   = (ULONG)Data + Length;
+    Modules[ mbi->ModuleCount ].String   = Name;
+    Modules[ mbi->ModuleCount ].Reserved = 0;
+
+    mbi->ModuleAddress = Modules;
+    mbi->ModuleCount++;
+    mbi->Flags |= MIF_MODULES;
+}
+
+/*
+ * Hands the clock frequency to the kernel as a module, if the image wants it.
+ * Multiboot has no field for it, so kernels that know the module name can
+ * skip calibrating the clock themselves.
+ */
+static VOID AddClockModule( IMAGE* image, MULTIBOOT_INFO* mbi )
+{
+    ULONG Frequency = GetClockFrequency();
+    CHAR* Text;
+
+    if ((!image->PassClock) || (Frequency == 0))
+    {
+        return;
+    }
+
+    Text = PhysAlloc( 0, PAGE_SIZE, PAGE_SIZE );
+    if (Text != NULL)
+    {
+        AppendModule( mbi, Text, sprintf( Text, "tsc_khz=%u\n", Frequency ), PAGE_SIZE, CLOCK_MODULE_NAME );
+    }
+}
+
+/*
+ * Hands the boot log to the kernel as the last module, if the image wants it
+ */
+static VOID AddLogModule( IMAGE* image, MULTIBOOT_INFO* mbi )
+{
+    ULONG Size = GetLogSize();
+    CHAR* Log;
+
+    if ((!image->BootLog) || (Size == 0))
+    {
+        return;
+    }
+
+    Log = PhysAlloc( 0, Size, PAGE_SIZE );
+    if (Log != NULL)
+    {
+        AppendModule( mbi, Log, ReadLog( Log, Size ), Size, LOG_MODULE_NAME );
+    }
+}
+
+/* Passes control to the loaded kernel. Only returns if that fails. */
+static VOID StartMultiboot( IMAGE* image, ULONG EntryAddr, MULTIBOOT_INFO* mbi )
+{
+    if (image->mbhdr.Magic != 0)
+    {
+        /* Now the drives' flat buffer tests and native drivers are known */
+        GetDrivesInfo( mbi );
+    }
+
+    LogEvent( "Starting kernel at %08X with %u modules", EntryAddr, mbi->ModuleCount );
+    AddClockModule( image, mbi );
+    AddLogModule( image, mbi );
+    FlushConsole();
+    ReleaseNativeDisks();
+    KeyboardRelease();
+
+    CallAsMultiboot( EntryAddr, mbi );
+}
+
 static BOOL LoadMultiboot( IMAGE* image, MULTIBOOT_INFO* mbi )
 {
     ULONGLONG Base   = image->mbhdr.LoadAddr;
     ULONGLONG Size   = GetFileSize( image->File );
     ULONGLONG Offset = image->mbhdrOffset - (image->mbhdr.HeaderAddr - image->mbhdr.LoadAddr);
+    LOAD_PLAN Plan;
     CHAR*     mem;
 
     if ((image->mbhdr.Magic == 0) || (~image->mbhdr.Flags & MIF_HAS_ADDRESS))
@@ -153,17 +248,11 @@ static BOOL LoadMultiboot( IMAGE* image, MULTIBOOT_INFO* mbi )
         return FALSE;
     }
 
-    if (!SetFilePointer( image->File, Offset, FILE_BEGIN ))
-    {
-        errno = ECORRUPT;
-        PhysFree( mem, image->mbhdr.BssEndAddr - Base );
-        return FALSE;
-    }
+    InitLoadPlan( &Plan );
 
     Size = MIN( image->mbhdr.LoadEndAddr - image->mbhdr.LoadAddr, Size);
-    if (ReadFile( image->File, mem, Size ) != Size)
+    if (!AddToLoadPlan( &Plan, image->File, Offset, Size, mem ))
     {
-        errno = EIO;
         PhysFree( mem, image->mbhdr.BssEndAddr - image->mbhdr.LoadAddr );
         return FALSE;
     }
@@ -171,11 +260,16 @@ static BOOL LoadMultiboot( IMAGE* image, MULTIBOOT_INFO* mbi )
     /* Clear BSS */
     memset( mem + Size, 0, image->mbhdr.BssEndAddr - (image->mbhdr.LoadAddr + Size) );
 
-    /* Load modules */
-    LoadModules( mbi, image->Modules, image->nModules, (image->mbhdr.Flags & MIF_WANT_PAGE_ALIGN) != 0);
+    /* Add the modules and read everything in one pass */
+    LoadModules( mbi, image->Modules, image->nModules, (image->mbhdr.Flags & MIF_WANT_PAGE_ALIGN) != 0, &Plan );
+    if (!RunLoadPlan( &Plan ))
+    {
+        PhysFree( mem, image->mbhdr.BssEndAddr - image->mbhdr.LoadAddr );
+        return FALSE;
+    }
 
     /* This function should not return */
-    CallAsMultiboot( image->mbhdr.EntryAddr, mbi );
+    StartMultiboot( image, image->mbhdr.EntryAddr, mbi );
 
     errno = EFAULT;
     return FALSE;
@@ -185,6 +279,7 @@ static BOOL LoadELF( IMAGE* image, MULTIBOOT_INFO* mbi )
 {
     ELF32_HDR   hdr;
     ELF32_PHDR* phdr;
+    LOAD_PLAN   Plan;
     UINT        i;
     BOOL        loadable;
 
@@ -270,7 +365,8 @@ static BOOL LoadELF( IMAGE* image, MULTIBOOT_INFO* mbi )
         return FALSE;
     }
 
-    /* Load loadable segments */
+    /* Plan the loadable segments */
+    InitLoadPlan( &Plan );
     for (i = 0; i < hdr.e_phnum; i++)
     {
         ELF32_PHDR* cur = (ELF32_PHDR*)((CHAR*)phdr + i * hdr.e_phentsize);
@@ -285,14 +381,7 @@ static BOOL LoadELF( IMAGE* image, MULTIBOOT_INFO* mbi )
                 break;
             }
 
-            if (!SetFilePointer( image->File, cur->p_offset, FILE_BEGIN ))
-            {
-                errno = ECORRUPT;
-                PhysFree( (VOID*)cur->p_paddr, cur->p_memsz );
-                break;
-            }
-
-            if (ReadFile( image->File, (VOID*)cur->p_paddr, cur->p_filesz) != cur->p_filesz)
+            if (!AddToLoadPlan( &Plan, image->File, cur->p_offset, cur->p_filesz, (VOID*)cur->p_paddr ))
             {
                 PhysFree( (VOID*)cur->p_paddr, cur->p_memsz );
                 break;
@@ -303,30 +392,35 @@ static BOOL LoadELF( IMAGE* image, MULTIBOOT_INFO* mbi )
         }
     }
 
-    if (i < hdr.e_phnum)
+    if (i == hdr.e_phnum)
+    {
+        /* Now add the multiboot modules and read everything in one pass */
+        LoadModules( mbi, image->Modules, image->nModules, (image->mbhdr.Flags & MIF_WANT_PAGE_ALIGN) != 0, &Plan );
+        if (RunLoadPlan( &Plan ))
+        {
+            /* This function should not return */
+            StartMultiboot( image, hdr.e_entry, mbi );
+
+            errno = EFAULT;
+            return FALSE;
+        }
+    }
+
+    /* Something failed, free everything */
+    FreeLoadPlan( &Plan );
     {
-        /* Something failed, free everything */
         INT j;
         for (j = 0; j < i; j++)
         {
-            if (phdr[j].p_type == PT_LOAD)
-            {
-                ELF32_PHDR* cur = (ELF32_PHDR*)((CHAR*)phdr + i * hdr.e_phentsize);
+            ELF32_PHDR* cur = (ELF32_PHDR*)((CHAR*)phdr + j * hdr.e_phentsize);
 
+            if (cur->p_type == PT_LOAD)
+            {
                 PhysFree( (VOID*)cur->p_paddr, cur->p_memsz );
             }
         }
-        free( phdr );
-        return FALSE;
     }
-
-    /* Now load the multiboot modules */
-    LoadModules( mbi, image->Modules, image->nModules, (image->mbhdr.Flags & MIF_WANT_PAGE_ALIGN) != 0);
-
-    /* This function should not return */
-    CallAsMultiboot( hdr.e_entry, mbi );
-
-    errno = EFAULT;
+    free( phdr );
     return FALSE;
 }
 
@@ -336,6 +430,7 @@ static BOOL LoadCOFF( IMAGE* image, MULTIBOOT_INFO* mbi )
     COFF_OPTIONAL_HEADER    ohdr;
     COFF_OPTIONAL_NT_HEADER nthdr;
     COFF_SECTION_HEADER*    shdr;
+    LOAD_PLAN               Plan;
     ULONG                   offset = 0;
     BOOL                    isPECOFF = FALSE;
     UINT                    i;
@@ -420,7 +515,8 @@ static BOOL LoadCOFF( IMAGE* image, MULTIBOOT_INFO* mbi )
         return FALSE;
     }
 
-    /* Now load all the sections */
+    /* Now plan all the sections */
+    InitLoadPlan( &Plan );
     for (i = 0; i < fhdr.NumberOfSections; i++)
     {
         if (isPECOFF)
@@ -449,21 +545,11 @@ static BOOL LoadCOFF( IMAGE* image, MULTIBOOT_INFO* mbi )
             break;
         }
 
-        if (shdr[i].SizeOfRawData > 0)
+        if (!AddToLoadPlan( &Plan, image->File, shdr[i].PointerToRawData, shdr[i].SizeOfRawData, addr ))
         {
-            if (!SetFilePointer( image->File, shdr[i].PointerToRawData, FILE_BEGIN ))
-            {
-                errno = ECORRUPT;
-                PhysFree( addr, shdr[i].VirtualSize );
-                break;
-            }
-
-            if (ReadFile( image->File, addr, shdr[i].SizeOfRawData ) != shdr[i].SizeOfRawData)
-            {
-                errno = ECORRUPT;
-                PhysFree( addr, shdr[i].VirtualSize );
-                break;
-            }
+            errno = ECORRUPT;
+            PhysFree( addr, shdr[i].VirtualSize );
+            break;
         }
 
         if (shdr[i].VirtualSize > shdr[i].SizeOfRawData)
@@ -472,30 +558,37 @@ static BOOL LoadCOFF( IMAGE* image, MULTIBOOT_INFO* mbi )
         }
     }
 
-    if (i < fhdr.NumberOfSections)
+    if (i == fhdr.NumberOfSections)
+    {
+        /* Now add the multiboot modules and read everything in one pass */
+        LoadModules( mbi, image->Modules, image->nModules, (image->mbhdr.Flags & MIF_WANT_PAGE_ALIGN) != 0, &Plan );
+        if (RunLoadPlan( &Plan ))
+        {
+            /* This function should not return */
+            StartMultiboot( image, ohdr.AddressOfEntryPoint, mbi );
+
+            errno = EFAULT;
+            return FALSE;
+        }
+    }
+
+    /* Something failed, free everything */
+    FreeLoadPlan( &Plan );
     {
-        /* Something failed, free everything */
         UINT j;
         for (j = 0; j < i; j++)
         {
             PhysFree( (VOID*)shdr[j].VirtualAddress, shdr[j].VirtualSize );
         }
-        return FALSE;
     }
-
-    /* Now load the multiboot modules */
-    LoadModules( mbi, image->Modules, image->nModules, (image->mbhdr.Flags & MIF_WANT_PAGE_ALIGN) != 0);
-
-    /* This function should not return */
-    CallAsMultiboot( ohdr.AddressOfEntryPoint, mbi );
-
-    errno = EFAULT;
+    free( shdr );
     return FALSE;
 }
 
 static BOOL LoadBinary( IMAGE* image, MULTIBOOT_INFO* mbi )
 {
     ULONGLONG Size;
+    LOAD_PLAN Plan;
     VOID*     Mem;
 
     if (image->Address == 0)
@@ -511,23 +604,22 @@ static BOOL LoadBinary( IMAGE* image, MULTIBOOT_INFO* mbi )
         return FALSE;
     }
 
-    if (!SetFilePointer( image->File, 0, FILE_BEGIN ))
+    InitLoadPlan( &Plan );
+    if (!AddToLoadPlan( &Plan, image->File, 0, Size, Mem ))
     {
-        errno = EFAULT;
         PhysFree( Mem, Size );
         return FALSE;
     }
 
-    if (ReadFile( image->File, Mem, Size ) != Size)
+    LoadModules( mbi, image->Modules, image->nModules, (image->mbhdr.Flags & MIF_WANT_PAGE_ALIGN) != 0, &Plan );
+    if (!RunLoadPlan( &Plan ))
     {
         PhysFree( Mem, Size );
         return FALSE;
     }
 
-    LoadModules( mbi, image->Modules, image->nModules, (image->mbhdr.Flags & MIF_WANT_PAGE_ALIGN) != 0);
-
     /* This function should not return */
-    CallAsMultiboot( (ULONG)Mem, mbi );
+    StartMultiboot( image, (ULONG)Mem, mbi );
     return FALSE;
 }
 
@@ -569,9 +661,12 @@ VOID LoadImage( IMAGE* image, MULTIBOOT_INFO* mbi )
         return;
     }
 
+    LogEvent( "Loading %s", image->Command );
+
     if (image->mbhdr.Magic != 0)
     {
         /* The image contains a multiboot header */
+        LogEvent( "Multiboot header at offset %u, flags %08X", (ULONG)image->mbhdrOffset, image->mbhdr.Flags );
         if ((image->mbhdr.Flags & MULTIBOOT_REQUIRED_MASK) & ~MULTIBOOT_SUPPORTED_FLAGS)
         {
             /* The header has requirements we don't support */
@@ -585,7 +680,7 @@ VOID LoadImage( IMAGE* image, MULTIBOOT_INFO* mbi )
         mbi->BootLoaderName = "OSLDR/1.0";
         mbi->Flags         |= MIF_BOOT_DEVICE | MIF_CMDLINE | MIF_LOADER_NAME;
 
-        /* Read system info like APM, config table, disk parameters and VBE */
+        /* Read system info like APM, config table and VBE */
         GetSystemInformation( mbi, &image->mbhdr );
 
         /* Compare requirements and capabilities */
@@ -604,6 +699,9 @@ VOID LoadImage( IMAGE* image, MULTIBOOT_INFO* mbi )
         return;
     }
 
+    /* Load the image without going through the BIOS where we can */
+    AttachNativeDisks();
+
     switch (image->Type)
     {
         case IT_RELOCATABLE:
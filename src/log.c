@@ -0,0 +1,112 @@
+#include <clock.h>
+#include <console.h>
+#include <log.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Boot log
+ *
+ * A console driver that keeps everything written in a ring buffer. Like the
+ * debug console it's a plain stream: cursor moves start a new line.
+ */
+
+#define EVENT_SIZE 160
+
+static CHAR  Log[ LOG_SIZE ];
+static ULONG Head;          /* Where the next byte goes */
+static BOOL  Wrapped;       /* Older output was dropped */
+static BOOL  AtLineStart;
+
+static VOID Append( CONST CHAR* s, ULONG Length )
+{
+    while (Length-- > 0)
+    {
+        if (*s != '\r')
+        {
+            Log[ Head ] = *s;
+            AtLineStart = (*s == '\n');
+            if (++Head == LOG_SIZE)
+            {
+                Head    = 0;
+                Wrapped = TRUE;
+            }
+        }
+        s++;
+    }
+}
+
+static VOID LogWrite( CONSOLE* Console, CONST CHAR* s, ULONG Length, UCHAR Attr )
+{
+    Append( s, Length );
+}
+
+static VOID LogGotoXY( CONSOLE* Console, ULONG X, ULONG Y )
+{
+    if (!AtLineStart)
+    {
+        Append( "\n", 1 );
+    }
+}
+
+static VOID LogClear( CONSOLE* Console, UCHAR Attr )
+{
+    LogGotoXY( Console, 0, 0 );
+}
+
+static VOID LogShowCursor( CONSOLE* Console, BOOL Show )
+{
+}
+
+static CONSOLE LogConsole = { LogWrite, LogGotoXY, LogClear, LogShowCursor, NULL, NULL, NULL };
+
+VOID LogInitialize( VOID )
+{
+    Head        = 0;
+    Wrapped     = FALSE;
+    AtLineStart = TRUE;
+
+    AddConsole( &LogConsole );
+}
+
+VOID LogEvent( CONST CHAR* Format, ... )
+{
+    CHAR      Event[ EVENT_SIZE ];
+    ULONG     Time = GetClockMs();
+    ULONG     Length;
+    va_list   args;
+
+    /* Keep the event apart from console output */
+    UpdateConsole();
+    LogGotoXY( &LogConsole, 0, 0 );
+
+    Length = snprintf( Event, EVENT_SIZE, "[%5u.%03u] ", Time / 1000, Time % 1000 );
+
+    va_start( args, Format );
+    vsnprintf( Event + Length, EVENT_SIZE - Length - 1, Format, args );
+    va_end( args );
+    Event[ EVENT_SIZE - 2 ] = '\0';
+
+    Length = strlen( Event );
+    Event[ Length++ ] = '\n';
+    Append( Event, Length );
+}
+
+ULONG GetLogSize( VOID )
+{
+    return (Wrapped) ? LOG_SIZE : Head;
+}
+
+ULONG ReadLog( CHAR* Buffer, ULONG Size )
+{
+    ULONG Old = (Wrapped) ? LOG_SIZE - Head : 0;
+
+    Size = MIN( Size, GetLogSize() );
+
+    /* Oldest part first: from Head to the end, if the log wrapped */
+    Old = MIN( Old, Size );
+    memcpy( Buffer, Log + Head, Old );
+    memcpy( Buffer + Old, Log, Size - Old );
+    return Size;
+}
@@ -0,0 +1,25 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <types.h>
+
+#define LOG_SIZE        16384   /* Bytes kept; older output is dropped */
+#define LOG_MODULE_NAME "osldr.log"
+
+/*
+ * Starts the boot log, which keeps the last LOG_SIZE bytes written to the
+ * console, and of events logged with LogEvent(). Call after
+ * ConsoleInitialize().
+ */
+VOID LogInitialize( VOID );
+
+/* Adds a line to the boot log, but not to the console, with a time stamp */
+VOID LogEvent( CONST CHAR* Format, ... );
+
+/* Returns the number of bytes in the boot log */
+ULONG GetLogSize( VOID );
+
+/* Copies the boot log to @Buffer, oldest first, and returns its size */
+ULONG ReadLog( CHAR* Buffer, ULONG Size );
+
+#endif
@@ -1,11 +1,16 @@
+#include <clock.h>
 #include <conio.h>
+#include <console.h>
+#include <drive.h>
+#include <io.h>
+#include <keyboard.h>
+#include <log.h>
 #include <mem.h>
 #include <multiboot.h>
+#include <serial.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <time.h>
-#include <video.h>
 
 #include "loader.h"
 #include "config.h"
@@ -24,6 +29,90 @@ static MULTIBOOT_INFO mbi;
  */
 extern int ImageEndAddress;
 
+/*
+ * Prints @MsgId as a title, underlined
+ */
+static VOID PrintTitle( ULONG MsgId )
+{
+    INT len = strlen( GetMessage( MsgId ) );
+
+    puts("");
+    PrintMessage( MsgId );
+    printf("\n ");
+
+    while (len-- > 0)
+    {
+        printf("\xCD");
+    }
+    puts("\n");
+}
+
+/*
+ * Clears the screen and draws the static part of the boot menu
+ */
+static VOID DrawMenuFrame( ULONG textAlign )
+{
+    SetBkColor( COLOR_BLACK );
+    SetTextColor( COLOR_LIGHTGRAY );
+
+    ClearScreen();
+    ShowCursor( FALSE );
+
+    PrintTitle( MSG_MENU_TITLE );
+    PrintMessage( MSG_MENU_INSTR1 );
+    PrintMessage( MSG_MENU_INSTR2 );
+
+    GotoXY( 2, 23 );
+    printf("F2: ");
+    PrintMessage( MSG_DRIVES_MENU );
+
+    GotoXY( textAlign - 2, 23);
+    printf("F9: ");
+    PrintMessage( MSG_MENU_REBOOT );
+}
+
+/*
+ * Calibrates the BIOS hard disks and shows their transfer rates
+ */
+static VOID ShowDriveRates( VOID )
+{
+    DRIVE_INFO* pdi;
+    UINT        Drive;
+    ULONG       i;
+
+    ClearScreen();
+    PrintTitle( MSG_DRIVES_TITLE );
+
+    for (Drive = 0x80; Drive < 0x80 + GetHardDiskCount(); Drive++)
+    {
+        if ((pdi = GetDriveParameters( Drive )) == NULL)
+        {
+            continue;
+        }
+
+        if (pdi->Disk != NULL)
+        {
+            PrintMessage( MSG_DRIVES_NATIVE, Drive, pdi->MaxTransfer );
+        }
+        else if (!CalibrateDrive( Drive ))
+        {
+            PrintMessage( MSG_DRIVES_NOT_CALIBRATED, Drive, pdi->TransferSize );
+        }
+        else
+        {
+            PrintMessage( MSG_DRIVES_CALIBRATED, Drive, pdi->TransferSize, pdi->ReadAlignment );
+            for (i = 0; i < pdi->nRates; i++)
+            {
+                PrintMessage( (pdi->Rate[i] != 0) ? MSG_DRIVES_RATE : MSG_DRIVES_WRONG_DATA,
+                              pdi->RateSize[i], pdi->Rate[i] );
+            }
+        }
+    }
+
+    PrintMessage( MSG_DRIVES_PRESS_KEY );
+    getch();
+}
+
 /*
  * Returns the image that the user wants to run or NULL for a reboot
  */
@@ -37,7 +126,7 @@ static IMAGE* RunBootMenu( CONFIG* config, BOOL useTimer )
     ULONG    windowSize  = 13;
     ULONG    textAlign;
     LONGLONG nPrevSecs;
-    time_t   start;
+    ULONG    start;
     INT      i;
 
     if ((useTimer) && (config->Timeout == 0))
@@ -67,33 +156,11 @@ static IMAGE* RunBootMenu( CONFIG* config, BOOL useTimer )
     textAlign = MAX( textAlign, strlen(GetMessage( MSG_MENU_REBOOT )) );
     textAlign = 77 - textAlign;
 
-    SetBkColor( COLOR_BLACK );
-    SetTextColor( COLOR_LIGHTGRAY );
-
-    ClearScreen();
-    ShowCursor( FALSE );
-
-    /* Draw the static part */
-    puts("");
-    PrintMessage( MSG_MENU_TITLE );
-    printf("\n ");
-
-    INT len = strlen( GetMessage( MSG_MENU_TITLE ) );
-    while (len-- > 0)
-    {
-        printf("\xCD");
-    }
-    puts("\n");
-    PrintMessage( MSG_MENU_INSTR1 );
-    PrintMessage( MSG_MENU_INSTR2 );
-
-    GotoXY( textAlign - 2, 23);
-    printf("F9: ");
-    PrintMessage( MSG_MENU_REBOOT );
+    DrawMenuFrame( textAlign );
 
     nPrevSecs = -1;
     oldSel    = Selected + 1;
-    start     = time( NULL );
+    start     = GetClockMs();
     while (1)
     {
         if (kbhit())
@@ -143,6 +210,13 @@ static IMAGE* RunBootMenu( CONFIG* config, BOOL useTimer )
             else if (c == VK_HOME) { Selected = 0; windowStart = 0; }
             else if (c == VK_END)  { Selected = config->nImages - 1; windowStart = config->nImages - windowSize; }
             else if (c == VK_F9)   { return NULL; }
+            else if (c == VK_F2)
+            {
+                /* Show the drive rates, then redraw everything */
+                ShowDriveRates();
+                DrawMenuFrame( textAlign );
+                oldSel = Selected + 1;
+            }
             else if ((c >= VK_1) && (c < VK_1 + config->nImages))
             {
                 Selected = c - VK_1;
@@ -187,7 +261,7 @@ static IMAGE* RunBootMenu( CONFIG* config, BOOL useTimer )
 
         if (useTimer)
         {
-            ULONG nSecs = difftime( time( NULL ), start );
+            ULONG nSecs = MIN( (GetClockMs() - start) / 1000, config->Timeout );
             if (nSecs != nPrevSecs )
             {
                 /* Timer has changed. Redraw it */
@@ -238,8 +312,16 @@ INT main( ULONG BootDevice )
     CONFIG Config;
     FILE*  file;
     IMAGE* image;
+    ULONG  HeapSize;
     INT    ch;
 
+    /* Write to the screen directly from now on, and keep a log */
+    ConsoleInitialize();
+    LogInitialize();
+
+    /* Poll the keyboard controller instead of calling the BIOS for keys */
+    KeyboardInitialize();
+
     /* First get the conventional memory */
     GetConventionalMemoryMap( &mbi );
 
@@ -249,7 +331,8 @@ INT main( ULONG BootDevice )
      * We use the lower memory count to be safe. If we cannot get the lower
      * memory count, we use 0x9FC00 and pray that nothing goes wrong.
      */
-    HeapInit( &ImageEndAddress, ((mbi.Flags & MIF_SIMPLE_MEMORY) ? (mbi.MemLower * 1024) : 0x9FC00) - (ULONG)&ImageEndAddress );
+    HeapSize = ((mbi.Flags & MIF_SIMPLE_MEMORY) ? (mbi.MemLower * 1024) : 0x9FC00) - (ULONG)&ImageEndAddress;
+    HeapInit( &ImageEndAddress, HeapSize );
 
     /* Now get the extended memory information (which requires a heap) */
     GetSystemMemoryMap( &mbi );
@@ -262,8 +345,14 @@ INT main( ULONG BootDevice )
         return 0;
     }
 
+    /* The I/O Manager, the menu and the log are timed with the clock */
+    ClockInitialize();
+
+    LogEvent( "Booted from device %08X, %u kB heap, %s keyboard, TSC at %u kHz", BootDevice,
+              HeapSize / 1024, (IsKeyboardNative()) ? "i8042" : "BIOS", GetClockFrequency() );
+
     /* Tell the I/O Manager what device we booted from */
-    IoInitialize( BootDevice );
+    IoInitialize( BootDevice, HeapSize );
 
     /*
      * Next up: reading the boot.ini file from the booted drive
@@ -285,6 +374,13 @@ INT main( ULONG BootDevice )
     }
 
     CloseFile( file );
+
+    if (Config.SerialPort != 0)
+    {
+        /* Show everything on the serial terminal as well */
+        SerialInitialize( Config.SerialPort, Config.SerialBaud );
+    }
+
     if (Config.nImages == 0)
     {
         PrintMessage( MSG_MAIN_NO_ENTRIES_IN_FILE );
@@ -319,6 +415,7 @@ INT main( ULONG BootDevice )
     /*
      * Load and run image
      */
+    LogEvent( "Booting '%s'", image->Name );
     PhysInit( &mbi );
 
     LoadImage( image, &mbi );
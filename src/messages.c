@@ -85,7 +85,7 @@
 #define LANG LANG_ENGLISH
 #endif
 
-#define N_MESSAGES 32
+#define N_MESSAGES 43
 #define N_ERRORS   11
 
 /* LANG_ENGLISH */
@@ -131,8 +131,27 @@ static CONST CHAR* Messages[ N_MESSAGES ] =
 
     /* Loader */
     "Kan de A20 poort niet activeren\n",
-    "Kernel heeft niet-ondersteunde multiboot eisen\n"
-    "Onverenigbare of oude hardware\n"
+    "Kernel heeft niet-ondersteunde multiboot eisen\n",
+    "Onverenigbare of oude hardware\n",
+
+    /* I/O Manager */
+    "Kan sector %llu van schijf %02X niet lezen",
+
+    /* Drive diagnostics */
+    "Schijven",
+    "  Overdrachtssnelheid van schijven",
+    " %02X: eigen stuurprogramma, %u sectoren per opdracht\n",
+    " %02X: BIOS, %u sectoren per opdracht, niet gemeten\n",
+    " %02X: BIOS, %u sectoren per opdracht, uitgelijnd op %u sectoren\n",
+    "     %3u sectoren per opdracht: %6u kB/s\n",
+    "     %3u sectoren per opdracht: verkeerde gegevens\n",
+    "\n Druk op een toets om terug te gaan naar het menu\n",
+
+    /* Configuration */
+    "Fout: '%s' waarde is geen geldige COM-poort\n",
+
+    /* Native drivers */
+    "Schijf %02X is van het BIOS overgenomen, maar het eigen stuurprogramma werkt niet"
 #else
     /* Errors */
     "No error",
@@ -174,7 +193,26 @@ static CONST CHAR* Messages[ N_MESSAGES ] =
     /* Loader */
     "Unable to enable the A20 gate\n",
     "Kernel has unsupported multiboot requirements\n",
-    "Incompatible or old hardware\n"
+    "Incompatible or old hardware\n",
+
+    /* I/O Manager */
+    "Unable to read sector %llu of drive %02X",
+
+    /* Drive diagnostics */
+    "Drives",
+    "  Drive transfer rates",
+    " %02X: native driver, %u sectors per call\n",
+    " %02X: BIOS, %u sectors per call, not calibrated\n",
+    " %02X: BIOS, %u sectors per call, aligned to %u sectors\n",
+    "     %3u sectors per call: %6u kB/s\n",
+    "     %3u sectors per call: wrong data\n",
+    "\n Press any key to return to the menu\n",
+
+    /* Configuration */
+    "Error: '%s' value is not a valid serial port\n",
+
+    /* Native drivers */
+    "Drive %02X was taken from the BIOS, but its native driver failed"
 #endif
 };
 
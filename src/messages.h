@@ -50,6 +50,25 @@
 #define MSG_LOADER_UNSUPPORTED_REQS     30
 #define MSG_LOADER_WRONG_HARDWARE       31
 
+/* I/O Manager */
+#define MSG_IO_BAD_SECTOR               32
+
+/* Drive diagnostics */
+#define MSG_DRIVES_MENU                 33
+#define MSG_DRIVES_TITLE                34
+#define MSG_DRIVES_NATIVE               35
+#define MSG_DRIVES_NOT_CALIBRATED       36
+#define MSG_DRIVES_CALIBRATED           37
+#define MSG_DRIVES_RATE                 38
+#define MSG_DRIVES_WRONG_DATA           39
+#define MSG_DRIVES_PRESS_KEY            40
+
+/* Configuration */
+#define MSG_CONF_INVALID_SERIAL         41
+
+/* Native drivers */
+#define MSG_DRIVE_LOST                  42
+
 INT         PrintError( ULONG MsgId, ... );
 INT         PrintMessage( ULONG MsgId, ... );
 CONST CHAR* GetMessage( ULONG MsgId );
@@ -1,10 +1,12 @@
 #include <bios.h>
+#include <drive.h>
 #include <errno.h>
 #include <limits.h>
 #include <mem.h>
 #include <multiboot.h>
 #include <stdlib.h>
 #include <string.h>
+#include <video.h>
 
 static BOOL GetApmInfo( APM_TABLE *apm )
 {
@@ -187,6 +189,96 @@ static BOOL GetVbeModeInfo( VBE_INFO *vbe )
     return TRUE;
 }
 
+/* Adds the drive to the Multiboot drives list */
+static BOOL AddDrive( MULTIBOOT_DRIVE* Drive, UCHAR Number )
+{
+    DRIVE_INFO* pdi = GetDriveParameters( Number );
+
+    if (pdi == NULL)
+    {
+        return FALSE;
+    }
+
+    Drive->Size            = sizeof(MULTIBOOT_DRIVE);
+    Drive->Number          = Number;
+    Drive->Mode            = (pdi->ControllerFlags & 1) ? DRIVE_MODE_LBA : DRIVE_MODE_CHS;
+    Drive->nCylinders      = MIN( pdi->nCylinders, 0xFFFF );
+    Drive->nHeads          = MIN( pdi->nHeads,     0xFF );
+    Drive->nSectors        = MIN( pdi->nSectors,   0xFF );
+    Drive->Ports[0]        = 0;
+    Drive->nTotalSectors   = pdi->nTotalSectors;
+    Drive->nBytesPerSector = pdi->nBytesPerSector;
+    Drive->MaxTransfer     = pdi->BiosMaxTransfer;
+    Drive->Flags           = ((pdi->Flags & DIF_FLAT_BUFFER) ? MDF_FLAT_BUFFER : 0) |
+                             ((pdi->Flags & DIF_FLAT_TESTED) ? MDF_FLAT_TESTED : 0) |
+                             ((pdi->Flags & DIF_REMOVABLE)   ? MDF_REMOVABLE   : 0);
+
+    Drive->NativeMaxTransfer = 0;
+    Drive->NativeAlignment   = 0;
+    if (pdi->Disk != NULL)
+    {
+        Drive->Flags            |= MDF_NATIVE;
+        Drive->NativeMaxTransfer = pdi->Disk->MaxTransfer;
+        Drive->NativeAlignment   = pdi->Disk->Alignment;
+    }
+    return TRUE;
+}
+
+/* The drives are the ones the BIOS reports, plus the boot drive */
+VOID GetDrivesInfo( MULTIBOOT_INFO* mbi )
+{
+    UCHAR            BootDrive  = mbi->BootDevice >> 24;
+    UCHAR            nFloppies  = 0;
+    UCHAR            nHardDisks = 0;
+    MULTIBOOT_DRIVE* Drives;
+    ULONG            nDrives = 0;
+    ULONG            i;
+    REGS             regs;
+
+    /* Get the number of floppy drives from the equipment list */
+    int86( 0x11, &regs, &regs );
+    if (regs.x.ax & 1)
+    {
+        nFloppies = ((regs.x.ax >> 6) & 3) + 1;
+    }
+
+    /* Get the number of hard disks */
+    nHardDisks = GetHardDiskCount();
+
+    Drives = malloc( (nFloppies + nHardDisks + 1) * sizeof(MULTIBOOT_DRIVE) );
+    if (Drives == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < nFloppies; i++)
+    {
+        nDrives += AddDrive( &Drives[ nDrives ], i );
+    }
+
+    for (i = 0; i < nHardDisks; i++)
+    {
+        nDrives += AddDrive( &Drives[ nDrives ], 0x80 + i );
+    }
+
+    if (((BootDrive <  0x80) && (BootDrive >= nFloppies)) ||
+        ((BootDrive >= 0x80) && (BootDrive >= 0x80 + nHardDisks)))
+    {
+        /* Boot drive isn't listed, e.g. a CD-ROM */
+        nDrives += AddDrive( &Drives[ nDrives ], BootDrive );
+    }
+
+    if (nDrives == 0)
+    {
+        free( Drives );
+        return;
+    }
+
+    mbi->DrivesAddress = Drives;
+    mbi->DrivesLength  = nDrives * sizeof(MULTIBOOT_DRIVE);
+    mbi->Flags        |= MIF_DRIVES;
+}
+
 BOOL GetSystemInformation( MULTIBOOT_INFO* mbi, MULTIBOOT_HEADER* mbhdr )
 {
     REGS regs;
@@ -224,6 +316,7 @@ BOOL GetSystemInformation( MULTIBOOT_INFO* mbi, MULTIBOOT_HEADER* mbhdr )
         }
 
         SetVbeMode( &mbi->VbeInfo, mbhdr->ModeType, mbhdr->Width, mbhdr->Height, mbhdr->Depth );
+        VideoInitialize();
 
         GetVbeModeInfo( &mbi->VbeInfo );
     }
@@ -231,7 +324,7 @@ BOOL GetSystemInformation( MULTIBOOT_INFO* mbi, MULTIBOOT_HEADER* mbhdr )
     return TRUE;
 }
 
-VOID LoadModules( MULTIBOOT_INFO* mbi, MODULE* Modules, ULONG nModules, BOOL PageAlign )
+VOID LoadModules( MULTIBOOT_INFO* mbi, MODULE* Modules, ULONG nModules, BOOL PageAlign, LOAD_PLAN* Plan )
 {
     ULONG i;
 
@@ -252,7 +345,7 @@ VOID LoadModules( MULTIBOOT_INFO* mbi, MODULE* Modules, ULONG nModules, BOOL Pag
                 VOID* addr = PhysAlloc( 0, Size, (PageAlign) ? 4096 : 0 );
                 if (addr != NULL)
                 {
-                    if (ReadFile( file, addr, Size) == Size)
+                    if (AddToLoadPlan( Plan, file, 0, Size, addr ))
                     {
                         Modules[i].ModStart = (ULONG)addr;
                         Modules[i].ModEnd   = (ULONG)addr + (ULONG)Size;
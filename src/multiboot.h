@@ -2,6 +2,7 @@
 #define MULTIBOOT_H
 
 #include <io.h>
+#include <plan.h>
 
 typedef struct _MMAP_ENTRY
 {
@@ -163,6 +164,38 @@ typedef struct _MODULE
     ULONG Reserved;
 } PACKED MODULE;
 
+/* Multiboot drive structure, an array of these is passed in DrivesAddress */
+typedef struct _MULTIBOOT_DRIVE
+{
+    ULONG     Size;             /* Size of this structure                 */
+    UCHAR     Number;           /* BIOS drive number                      */
+    UCHAR     Mode;             /* DRIVE_MODE_CHS or DRIVE_MODE_LBA       */
+    USHORT    nCylinders;
+    UCHAR     nHeads;
+    UCHAR     nSectors;
+    USHORT    Ports[1];         /* I/O ports of the drive, zero-terminated */
+
+    /* OSLDR extension, skipped by kernels that step through by Size */
+    ULONGLONG nTotalSectors;
+    ULONG     nBytesPerSector;
+    ULONG     MaxTransfer;      /* Most sectors per BIOS call             */
+    ULONG     Flags;
+
+    /* The loader's native driver for the drive, valid if Flags & MDF_NATIVE */
+    ULONG     NativeMaxTransfer;    /* Most sectors per native read       */
+    ULONG     NativeAlignment;      /* Native buffer alignment in bytes   */
+} PACKED MULTIBOOT_DRIVE;
+
+/* Values for MULTIBOOT_DRIVE.Mode */
+#define DRIVE_MODE_CHS      0
+#define DRIVE_MODE_LBA      1
+
+/* Values for MULTIBOOT_DRIVE.Flags */
+#define MDF_FLAT_BUFFER     0x0001  /* BIOS reads into buffers above 1 MB      */
+#define MDF_REMOVABLE       0x0002  /* Drive has removable media               */
+#define MDF_FLAT_TESTED     0x0004  /* MDF_FLAT_BUFFER was tested, not assumed */
+#define MDF_NATIVE          0x0008  /* Read natively, the BIOS may not reach it */
+
 typedef struct _MULTIBOOT_INFO
 {
     ULONG Flags;
@@ -198,7 +231,18 @@ typedef struct _MULTIBOOT_INFO
 } PACKED MULTIBOOT_INFO;
 
 BOOL GetSystemInformation( MULTIBOOT_INFO* mbi, MULTIBOOT_HEADER* mbhdr );
-VOID LoadModules( MULTIBOOT_INFO* mbi, MODULE* Modules, ULONG nModules, BOOL PageAlign );
+
+/*
+ * Passes the drive information we gathered to the kernel. Call this once the
+ * image is loaded, so it reflects the drivers that were used for that.
+ */
+VOID GetDrivesInfo( MULTIBOOT_INFO* mbi );
+
+/*
+ * Allocates memory for the modules and adds their reads to @Plan; they are
+ * only loaded when the plan is run. Modules that can't be opened are dropped.
+ */
+VOID LoadModules( MULTIBOOT_INFO* mbi, MODULE* Modules, ULONG nModules, BOOL PageAlign, LOAD_PLAN* Plan );
 VOID CallAsMultiboot( ULONG EntryAddr, MULTIBOOT_INFO* mbi );
 
 #endif
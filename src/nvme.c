@@ -0,0 +1,604 @@
+#include <disk.h>
+#include <pci.h>
+#include <port.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Memory mapped registers */
+#define REG(base, ofs)          (*(volatile ULONG*)((CHAR*)(base) + (ofs)))
+
+/* Controller registers */
+#define NVME_CAP                0x00
+#define NVME_CAP_HIGH           0x04
+#define NVME_CC                 0x14
+#define NVME_CSTS               0x1C
+#define NVME_AQA                0x24
+#define NVME_ASQ                0x28
+#define NVME_ASQ_HIGH           0x2C
+#define NVME_ACQ                0x30
+#define NVME_ACQ_HIGH           0x34
+#define NVME_DOORBELLS          0x1000
+
+#define NVME_CAP_MQES(cap)      (((cap) & 0xFFFF) + 1)
+#define NVME_CAP_DSTRD(high)    ((high) & 0xF)
+#define NVME_CAP_MPSMIN(high)   (((high) >> 16) & 0xF)
+
+#define NVME_CC_ENABLE          0x00000001
+#define NVME_CC_QUEUE_SIZES     0x00460000  /* 64 byte submission, 16 byte completion entries */
+
+#define NVME_CSTS_READY         0x00000001
+#define NVME_CSTS_FATAL         0x00000002
+
+/* Admin commands */
+#define NVME_ADMIN_CREATE_SQ    0x01
+#define NVME_ADMIN_CREATE_CQ    0x05
+#define NVME_ADMIN_IDENTIFY     0x06
+
+#define NVME_IDENTIFY_NAMESPACE 0x00
+#define NVME_IDENTIFY_CTRL      0x01
+
+/* I/O commands */
+#define NVME_CMD_READ           0x02
+
+#define NVME_PAGE_SIZE          4096
+#define NVME_ADMIN_DEPTH        8
+#define NVME_IO_DEPTH           64          /* Fills one page of submission entries */
+#define NVME_SLOTS              32          /* Most commands in flight              */
+#define NVME_LIST_ENTRIES       32          /* PRP list entries per command         */
+#define NVME_MAX_NAMESPACES     16
+#define NVME_TIMEOUT            0x1000000   /* Register polls before giving up      */
+
+typedef struct _NVME_COMMAND
+{
+    ULONG     Cdw0;         /* Opcode, command identifier in the high word */
+    ULONG     Nsid;
+    ULONG     Reserved[2];
+    ULONGLONG Metadata;
+    ULONGLONG Prp1;
+    ULONGLONG Prp2;
+    ULONG     Cdw10;
+    ULONG     Cdw11;
+    ULONG     Cdw12;
+    ULONG     Cdw13;
+    ULONG     Cdw14;
+    ULONG     Cdw15;
+} NVME_COMMAND;
+
+typedef struct _NVME_COMPLETION
+{
+    ULONG  Result;
+    ULONG  Reserved;
+    USHORT SqHead;
+    USHORT SqId;
+    USHORT Cid;
+    USHORT Status;          /* Phase tag in bit 0 */
+} NVME_COMPLETION;
+
+typedef struct _NVME_QUEUE
+{
+    NVME_COMMAND*             Sq;
+    volatile NVME_COMPLETION* Cq;
+    ULONG                     Size;
+    ULONG                     SqTail;
+    ULONG                     CqHead;
+    USHORT                    Phase;
+    volatile ULONG*           SqDoorbell;
+    volatile ULONG*           CqDoorbell;
+} NVME_QUEUE;
+
+typedef struct _NVME_CONTROLLER
+{
+    CHAR*      Regs;
+    NVME_QUEUE Admin;
+    NVME_QUEUE Io;
+    ULONGLONG* PrpLists;    /* NVME_LIST_ENTRIES per slot        */
+    ULONG      nSlots;
+    ULONG      MaxChunk;    /* Most bytes per command            */
+    BOOL       isFailed;    /* Commands were lost, don't go on   */
+
+    /* Submitted reads, by slot */
+    ULONG      Busy;
+    ULONG      Done;
+    DISK*      Owner[ NVME_SLOTS ];
+    ULONG      Count[ NVME_SLOTS ];  /* Sectors, 0 if the read failed */
+} NVME_CONTROLLER;
+
+typedef struct _NVME_NAMESPACE
+{
+    DISK             Disk;
+    NVME_CONTROLLER* Ctrl;
+    ULONG            Nsid;
+} NVME_NAMESPACE;
+
+/* Polls the controller status until (CSTS & @Mask) == @Value. Returns FALSE on timeout */
+static BOOL WaitStatus( NVME_CONTROLLER* Ctrl, ULONG Mask, ULONG Value )
+{
+    ULONG i;
+
+    for (i = 0; i < NVME_TIMEOUT; i++)
+    {
+        if ((REG( Ctrl->Regs, NVME_CSTS ) & Mask) == Value)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/* Allocates the memory for queue @Id and finds its doorbells */
+static BOOL CreateQueue( NVME_CONTROLLER* Ctrl, NVME_QUEUE* Queue, ULONG Id, ULONG Size )
+{
+    ULONG Stride = 4 << NVME_CAP_DSTRD( REG( Ctrl->Regs, NVME_CAP_HIGH ) );
+
+    Queue->Sq = memalign( NVME_PAGE_SIZE, Size * sizeof(NVME_COMMAND) );
+    Queue->Cq = memalign( NVME_PAGE_SIZE, Size * sizeof(NVME_COMPLETION) );
+    if ((Queue->Sq == NULL) || (Queue->Cq == NULL))
+    {
+        free( (VOID*)Queue->Cq );
+        free( Queue->Sq );
+        return FALSE;
+    }
+
+    memset( Queue->Sq,        0, Size * sizeof(NVME_COMMAND) );
+    memset( (VOID*)Queue->Cq, 0, Size * sizeof(NVME_COMPLETION) );
+
+    Queue->Size       = Size;
+    Queue->SqTail     = 0;
+    Queue->CqHead     = 0;
+    Queue->Phase      = 1;
+    Queue->SqDoorbell = (volatile ULONG*)(Ctrl->Regs + NVME_DOORBELLS + (2 * Id)     * Stride);
+    Queue->CqDoorbell = (volatile ULONG*)(Ctrl->Regs + NVME_DOORBELLS + (2 * Id + 1) * Stride);
+    return TRUE;
+}
+
+/* Adds @Cmd to the submission queue; the controller sees it after the next Ring() */
+static VOID Submit( NVME_QUEUE* Queue, NVME_COMMAND* Cmd )
+{
+    memcpy( &Queue->Sq[ Queue->SqTail ], Cmd, sizeof(NVME_COMMAND) );
+    Queue->SqTail = (Queue->SqTail + 1) % Queue->Size;
+}
+
+static VOID Ring( NVME_QUEUE* Queue )
+{
+    MemoryBarrier();
+    *Queue->SqDoorbell = Queue->SqTail;
+}
+
+/* Takes the next completion off the queue. Returns FALSE if there is none yet */
+static BOOL Reap( NVME_QUEUE* Queue, USHORT* Cid, USHORT* Status )
+{
+    volatile NVME_COMPLETION* Entry = &Queue->Cq[ Queue->CqHead ];
+
+    if ((Entry->Status & 1) != Queue->Phase)
+    {
+        return FALSE;
+    }
+
+    *Cid    = Entry->Cid;
+    *Status = Entry->Status >> 1;
+
+    if (++Queue->CqHead == Queue->Size)
+    {
+        /* The controller flips the phase tag on every pass */
+        Queue->CqHead = 0;
+        Queue->Phase ^= 1;
+    }
+
+    *Queue->CqDoorbell = Queue->CqHead;
+    return TRUE;
+}
+
+/* Runs an admin command and waits for it. Returns TRUE on success */
+static BOOL AdminCommand( NVME_CONTROLLER* Ctrl, NVME_COMMAND* Cmd )
+{
+    USHORT Cid, Status;
+    ULONG  i;
+
+    Submit( &Ctrl->Admin, Cmd );
+    Ring( &Ctrl->Admin );
+
+    for (i = 0; i < NVME_TIMEOUT; i++)
+    {
+        if (Reap( &Ctrl->Admin, &Cid, &Status ))
+        {
+            return (Status == 0);
+        }
+    }
+
+    return FALSE;
+}
+
+static BOOL Identify( NVME_CONTROLLER* Ctrl, ULONG Cns, ULONG Nsid, VOID* Buffer )
+{
+    NVME_COMMAND Cmd;
+
+    memset( &Cmd, 0, sizeof(Cmd) );
+    Cmd.Cdw0  = NVME_ADMIN_IDENTIFY;
+    Cmd.Nsid  = Nsid;
+    Cmd.Prp1  = (ULONG)Buffer;
+    Cmd.Cdw10 = Cns;
+
+    return AdminCommand( Ctrl, &Cmd );
+}
+
+/* Fills in @Cmd to read @nBytes into @Buffer, using the PRP list of @Slot if needed */
+static VOID SetDataPointer( NVME_CONTROLLER* Ctrl, NVME_COMMAND* Cmd, ULONG Slot, VOID* Buffer, ULONG nBytes )
+{
+    ULONG Address = (ULONG)Buffer;
+    ULONG First   = NVME_PAGE_SIZE - (Address & (NVME_PAGE_SIZE - 1));
+
+    Cmd->Prp1 = Address;
+    Cmd->Prp2 = 0;
+
+    if (nBytes > First + NVME_PAGE_SIZE)
+    {
+        /* More than two pages, list all but the first */
+        ULONGLONG* List = &Ctrl->PrpLists[ Slot * NVME_LIST_ENTRIES ];
+        ULONG      Page;
+
+        for (Page = Address + First; Page < Address + nBytes; Page += NVME_PAGE_SIZE)
+        {
+            *List++ = Page;
+        }
+
+        Cmd->Prp2 = (ULONG)&Ctrl->PrpLists[ Slot * NVME_LIST_ENTRIES ];
+    }
+    else if (nBytes > First)
+    {
+        Cmd->Prp2 = Address + First;
+    }
+}
+
+/* Fills in @Cmd to read @nSectors at @Sector into @Buffer through @Slot */
+static VOID BuildRead( NVME_NAMESPACE* Ns, NVME_COMMAND* Cmd, ULONG Slot, ULONGLONG Sector, ULONG nSectors,
+                       VOID* Buffer )
+{
+    memset( Cmd, 0, sizeof(NVME_COMMAND) );
+    Cmd->Cdw0  = NVME_CMD_READ | (Slot << 16);
+    Cmd->Nsid  = Ns->Nsid;
+    Cmd->Cdw10 = (ULONG)Sector;
+    Cmd->Cdw11 = (ULONG)(Sector >> 32);
+    Cmd->Cdw12 = nSectors - 1;
+    SetDataPointer( Ns->Ctrl, Cmd, Slot, Buffer, nSectors * Ns->Disk.nBytesPerSector );
+}
+
+/* Moves the submitted reads that finished off the completion queue */
+static VOID ReapSubmitted( NVME_CONTROLLER* Ctrl )
+{
+    USHORT Cid, Status;
+
+    while (Reap( &Ctrl->Io, &Cid, &Status ))
+    {
+        if ((Cid < NVME_SLOTS) && (Ctrl->Busy & (1UL << Cid)))
+        {
+            Ctrl->Done |= 1UL << Cid;
+            if (Status != 0)
+            {
+                Ctrl->Count[ Cid ] = 0;
+            }
+        }
+    }
+}
+
+/*
+ * Queues one command per chunk, up to nSlots of them, and rings the doorbell
+ * once. The controller is free to work on all of them at the same time.
+ */
+static ULONG NvmeRead( DISK* Disk, ULONGLONG Sector, ULONG nSectors, VOID* Buffer )
+{
+    NVME_NAMESPACE*  Ns     = Disk->Data;
+    NVME_CONTROLLER* Ctrl   = Ns->Ctrl;
+    ULONG            nChunk = Ctrl->MaxChunk / Disk->nBytesPerSector;
+    ULONG            Done   = 0;
+    ULONG            Read   = 0;
+    ULONG            nPending;
+    ULONG            Slot;
+    ULONG            i;
+
+    if ((Ctrl->isFailed) || (nSectors == 0) || (nSectors > Disk->MaxTransfer) ||
+        (Sector + nSectors > Disk->nTotalSectors))
+    {
+        return 0;
+    }
+
+    /* Let the reads other namespaces submitted finish, so all completions are ours */
+    for (i = 0; (Ctrl->Busy & ~Ctrl->Done) && (i < NVME_TIMEOUT); i++)
+    {
+        ReapSubmitted( Ctrl );
+    }
+
+    if (Ctrl->Busy & ~Ctrl->Done)
+    {
+        Ctrl->isFailed = TRUE;
+        return 0;
+    }
+
+    for (Slot = 0; Slot * nChunk < nSectors; Slot++)
+    {
+        NVME_COMMAND Cmd;
+
+        BuildRead( Ns, &Cmd, Slot, Sector + Slot * nChunk, MIN( nSectors - Slot * nChunk, nChunk ),
+                   (CHAR*)Buffer + Slot * nChunk * Disk->nBytesPerSector );
+        Submit( &Ctrl->Io, &Cmd );
+    }
+    Ring( &Ctrl->Io );
+
+    for (nPending = Slot, i = 0; (nPending > 0) && (i < NVME_TIMEOUT); i++)
+    {
+        USHORT Cid, Status;
+
+        while (Reap( &Ctrl->Io, &Cid, &Status ))
+        {
+            nPending--;
+            if ((Status == 0) && (Cid < Slot))
+            {
+                Done |= 1UL << Cid;
+            }
+        }
+    }
+
+    if (nPending > 0)
+    {
+        /* The commands may still complete later, the queues are no longer usable */
+        Ctrl->isFailed = TRUE;
+        return 0;
+    }
+
+    /* Only count the chunks up to the first one that failed */
+    for (Slot = 0; (Read < nSectors) && (Done & (1UL << Slot)); Slot++)
+    {
+        Read += MIN( nSectors - Read, nChunk );
+    }
+
+    return Read;
+}
+
+/* Queues a read in a free slot, which is also its tag */
+static INT NvmeSubmit( DISK* Disk, ULONGLONG Sector, ULONG nSectors, VOID* Buffer )
+{
+    NVME_NAMESPACE*  Ns   = Disk->Data;
+    NVME_CONTROLLER* Ctrl = Ns->Ctrl;
+    NVME_COMMAND     Cmd;
+    ULONG            Slot;
+
+    if ((Ctrl->isFailed) || (nSectors == 0) || (nSectors > Disk->MaxSubmit) ||
+        (Sector + nSectors > Disk->nTotalSectors))
+    {
+        return -1;
+    }
+
+    for (Slot = 0; (Slot < Ctrl->nSlots) && (Ctrl->Busy & (1UL << Slot)); Slot++);
+    if (Slot == Ctrl->nSlots)
+    {
+        return -1;
+    }
+
+    BuildRead( Ns, &Cmd, Slot, Sector, nSectors, Buffer );
+    Submit( &Ctrl->Io, &Cmd );
+    Ring( &Ctrl->Io );
+
+    Ctrl->Busy          |= 1UL << Slot;
+    Ctrl->Owner[ Slot ]  = Disk;
+    Ctrl->Count[ Slot ]  = nSectors;
+    return Slot;
+}
+
+/* Returns a finished read of @Disk; those of other namespaces wait for their own Poll */
+static INT NvmePoll( DISK* Disk, ULONG* nRead )
+{
+    NVME_CONTROLLER* Ctrl = ((NVME_NAMESPACE*)Disk->Data)->Ctrl;
+    ULONG            Slot;
+
+    ReapSubmitted( Ctrl );
+
+    for (Slot = 0; Slot < Ctrl->nSlots; Slot++)
+    {
+        if ((Ctrl->Done & (1UL << Slot)) && (Ctrl->Owner[ Slot ] == Disk))
+        {
+            Ctrl->Busy &= ~(1UL << Slot);
+            Ctrl->Done &= ~(1UL << Slot);
+            *nRead = Ctrl->Count[ Slot ];
+            return Slot;
+        }
+    }
+
+    return -1;
+}
+
+static VOID NvmeAbort( DISK* Disk )
+{
+    NVME_CONTROLLER* Ctrl = ((NVME_NAMESPACE*)Disk->Data)->Ctrl;
+    ULONG            Slot;
+
+    /* Reads that completed but weren't polled yet aren't lost */
+    ReapSubmitted( Ctrl );
+
+    for (Slot = 0; Slot < Ctrl->nSlots; Slot++)
+    {
+        if ((Ctrl->Busy & (1UL << Slot)) && (Ctrl->Owner[ Slot ] == Disk))
+        {
+            if (~Ctrl->Done & (1UL << Slot))
+            {
+                /* The command may still complete later, the queues are no longer usable */
+                Ctrl->isFailed = TRUE;
+            }
+
+            Ctrl->Busy &= ~(1UL << Slot);
+            Ctrl->Done &= ~(1UL << Slot);
+        }
+    }
+}
+
+/* Resets the controller and sets up the admin and I/O queues */
+static BOOL StartController( NVME_CONTROLLER* Ctrl, VOID* Buffer )
+{
+    ULONG        Cap   = REG( Ctrl->Regs, NVME_CAP );
+    ULONG        Depth = MIN( NVME_IO_DEPTH, NVME_CAP_MQES(Cap) );
+    NVME_COMMAND Cmd;
+    UCHAR        Mdts;
+
+    REG( Ctrl->Regs, NVME_CC ) &= ~NVME_CC_ENABLE;
+    if ((!WaitStatus( Ctrl, NVME_CSTS_READY, 0 )) ||
+        (!CreateQueue( Ctrl, &Ctrl->Admin, 0, NVME_ADMIN_DEPTH )) ||
+        (!CreateQueue( Ctrl, &Ctrl->Io,    1, Depth )))
+    {
+        return FALSE;
+    }
+
+    REG( Ctrl->Regs, NVME_AQA )      = ((NVME_ADMIN_DEPTH - 1) << 16) | (NVME_ADMIN_DEPTH - 1);
+    REG( Ctrl->Regs, NVME_ASQ )      = (ULONG)Ctrl->Admin.Sq;
+    REG( Ctrl->Regs, NVME_ASQ_HIGH ) = 0;
+    REG( Ctrl->Regs, NVME_ACQ )      = (ULONG)Ctrl->Admin.Cq;
+    REG( Ctrl->Regs, NVME_ACQ_HIGH ) = 0;
+    REG( Ctrl->Regs, NVME_CC )       = NVME_CC_QUEUE_SIZES | NVME_CC_ENABLE;
+
+    if ((!WaitStatus( Ctrl, NVME_CSTS_READY | NVME_CSTS_FATAL, NVME_CSTS_READY )) ||
+        (!Identify( Ctrl, NVME_IDENTIFY_CTRL, 0, Buffer )))
+    {
+        return FALSE;
+    }
+
+    /* Maximum data transfer size, in units of the minimum page size */
+    Ctrl->MaxChunk = NVME_LIST_ENTRIES * NVME_PAGE_SIZE;
+    Mdts = ((UCHAR*)Buffer)[77];
+    if ((Mdts != 0) && (Mdts < 16))
+    {
+        Ctrl->MaxChunk = MIN( Ctrl->MaxChunk, NVME_PAGE_SIZE << Mdts );
+    }
+
+    /* Polled queues, no interrupts */
+    memset( &Cmd, 0, sizeof(Cmd) );
+    Cmd.Cdw0  = NVME_ADMIN_CREATE_CQ;
+    Cmd.Prp1  = (ULONG)Ctrl->Io.Cq;
+    Cmd.Cdw10 = ((Depth - 1) << 16) | 1;
+    Cmd.Cdw11 = 1;                          /* Physically contiguous */
+    if (!AdminCommand( Ctrl, &Cmd ))
+    {
+        return FALSE;
+    }
+
+    memset( &Cmd, 0, sizeof(Cmd) );
+    Cmd.Cdw0  = NVME_ADMIN_CREATE_SQ;
+    Cmd.Prp1  = (ULONG)Ctrl->Io.Sq;
+    Cmd.Cdw10 = ((Depth - 1) << 16) | 1;
+    Cmd.Cdw11 = (1 << 16) | 1;              /* Completion queue 1, physically contiguous */
+    if (!AdminCommand( Ctrl, &Cmd ))
+    {
+        return FALSE;
+    }
+
+    /* A full submission queue holds one less than its size */
+    Ctrl->nSlots   = MIN( NVME_SLOTS, Depth - 1 );
+    Ctrl->PrpLists = memalign( NVME_PAGE_SIZE, Ctrl->nSlots * NVME_LIST_ENTRIES * sizeof(ULONGLONG) );
+
+    return (Ctrl->PrpLists != NULL);
+}
+
+static VOID ProbeNamespace( PCI_DEVICE* Pci, NVME_CONTROLLER* Ctrl, ULONG Nsid, UCHAR* Id )
+{
+    NVME_NAMESPACE* Ns;
+    ULONG           Format;
+
+    if (!Identify( Ctrl, NVME_IDENTIFY_NAMESPACE, Nsid, Id ))
+    {
+        return;
+    }
+
+    /* The LBA format in use holds the sector size as a power of two */
+    Format = *(ULONG*)&Id[ 128 + 4 * (Id[26] & 0xF) ];
+
+    Ns = malloc( sizeof(NVME_NAMESPACE) );
+    if ((Ns == NULL) || (*(ULONGLONG*)Id == 0) || (((Format >> 16) & 0xFF) < 9))
+    {
+        /* Inactive namespace */
+        free( Ns );
+        return;
+    }
+
+    memset( Ns, 0, sizeof(NVME_NAMESPACE) );
+    Ns->Ctrl = Ctrl;
+    Ns->Nsid = Nsid;
+
+    Ns->Disk.Read            = NvmeRead;
+    Ns->Disk.Submit          = NvmeSubmit;
+    Ns->Disk.Poll            = NvmePoll;
+    Ns->Disk.Abort           = NvmeAbort;
+    Ns->Disk.nTotalSectors   = *(ULONGLONG*)Id;
+    Ns->Disk.nBytesPerSector = 1 << ((Format >> 16) & 0xFF);
+    Ns->Disk.MaxTransfer     = Ctrl->nSlots * (Ctrl->MaxChunk / Ns->Disk.nBytesPerSector);
+    Ns->Disk.MaxSubmit       = Ctrl->MaxChunk / Ns->Disk.nBytesPerSector;
+    Ns->Disk.Alignment       = 4;   /* PRP entries are dword aligned */
+    Ns->Disk.Pci             = *Pci;
+    Ns->Disk.Data            = Ns;
+
+    RegisterDisk( &Ns->Disk );
+}
+
+/*
+ * Registers the namespaces of an NVMe controller. The controller is reset in
+ * the process, which leaves it unusable for the BIOS.
+ */
+static BOOL NvmeStart( PCI_DEVICE* Pci, BOOL* isReset )
+{
+    NVME_CONTROLLER* Ctrl;
+    ULONG            nNamespaces;
+    ULONG            Nsid;
+    UCHAR*           Id = memalign( NVME_PAGE_SIZE, NVME_PAGE_SIZE );
+
+    Ctrl = malloc( sizeof(NVME_CONTROLLER) );
+    if ((Id == NULL) || (Ctrl == NULL))
+    {
+        free( Ctrl );
+        free( Id );
+        return FALSE;
+    }
+
+    memset( Ctrl, 0, sizeof(NVME_CONTROLLER) );
+    Ctrl->Regs = (CHAR*)PciGetBar( Pci, 0 );
+    PciEnable( Pci, PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER );
+
+    if (NVME_CAP_MPSMIN( REG( Ctrl->Regs, NVME_CAP_HIGH ) ) != 0)
+    {
+        /* No 4 kB pages, leave the controller to the BIOS */
+        free( Ctrl );
+        free( Id );
+        return FALSE;
+    }
+
+    /* StartController() disables the controller first */
+    *isReset = TRUE;
+    if (!StartController( Ctrl, Id ))
+    {
+        /* The queues leak, only broken controllers get here */
+        free( Ctrl );
+        free( Id );
+        return FALSE;
+    }
+
+    nNamespaces = *(ULONG*)&Id[516];
+    for (Nsid = 1; Nsid <= MIN( nNamespaces, NVME_MAX_NAMESPACES ); Nsid++)
+    {
+        ProbeNamespace( Pci, Ctrl, Nsid, Id );
+    }
+
+    free( Id );
+    return TRUE;
+}
+
+/*
+ * Finds all NVMe controllers.
+ */
+VOID NvmeProbe( VOID )
+{
+    PCI_DEVICE Pci;
+    ULONG      Index;
+
+    for (Index = 0; PciFindClass( PCI_CLASS_STORAGE, PCI_STORAGE_NVM, Index, &Pci ); Index++)
+    {
+        if ((Pci.ProgIf == PCI_NVM_EXPRESS) && (PciGetBar( &Pci, 0 ) != 0))
+        {
+            RegisterController( &Pci, NvmeStart );
+        }
+    }
+}
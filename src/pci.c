@@ -0,0 +1,187 @@
+#include <pci.h>
+#include <port.h>
+
+/* Configuration mechanism #1 */
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+#define PCI_CONFIG_ENABLE  0x80000000
+
+#define PCI_BAR_IO         0x01
+#define PCI_BAR_64BIT      0x04
+
+static VOID SelectRegister( PCI_DEVICE* Dev, UCHAR Reg )
+{
+    outl( PCI_CONFIG_ADDRESS, PCI_CONFIG_ENABLE | ((ULONG)Dev->Bus << 16) |
+          ((ULONG)Dev->Device << 11) | ((ULONG)Dev->Function << 8) | (Reg & 0xFC) );
+}
+
+UCHAR PciRead8( PCI_DEVICE* Dev, UCHAR Reg )
+{
+    SelectRegister( Dev, Reg );
+    return inb( PCI_CONFIG_DATA + (Reg & 3) );
+}
+
+USHORT PciRead16( PCI_DEVICE* Dev, UCHAR Reg )
+{
+    SelectRegister( Dev, Reg );
+    return inw( PCI_CONFIG_DATA + (Reg & 2) );
+}
+
+ULONG PciRead32( PCI_DEVICE* Dev, UCHAR Reg )
+{
+    SelectRegister( Dev, Reg );
+    return inl( PCI_CONFIG_DATA );
+}
+
+VOID PciWrite8( PCI_DEVICE* Dev, UCHAR Reg, UCHAR Value )
+{
+    SelectRegister( Dev, Reg );
+    outb( PCI_CONFIG_DATA + (Reg & 3), Value );
+}
+
+VOID PciWrite16( PCI_DEVICE* Dev, UCHAR Reg, USHORT Value )
+{
+    SelectRegister( Dev, Reg );
+    outw( PCI_CONFIG_DATA + (Reg & 2), Value );
+}
+
+VOID PciWrite32( PCI_DEVICE* Dev, UCHAR Reg, ULONG Value )
+{
+    SelectRegister( Dev, Reg );
+    outl( PCI_CONFIG_DATA, Value );
+}
+
+/* Returns TRUE if configuration mechanism #1 works */
+static BOOL IsPciPresent( VOID )
+{
+    ULONG Saved = inl( PCI_CONFIG_ADDRESS );
+    BOOL  Present;
+
+    outl( PCI_CONFIG_ADDRESS, PCI_CONFIG_ENABLE );
+    Present = (inl( PCI_CONFIG_ADDRESS ) == PCI_CONFIG_ENABLE);
+    outl( PCI_CONFIG_ADDRESS, Saved );
+
+    return Present;
+}
+
+/* Finds the @Index'th function for which (@Reg & @Mask) == @Value */
+static BOOL PciFind( UCHAR Reg, ULONG Mask, ULONG Value, ULONG Index, PCI_DEVICE* Dev )
+{
+    ULONG Bus, Device, Function;
+
+    if (!IsPciPresent())
+    {
+        return FALSE;
+    }
+
+    for (Bus = 0; Bus < 256; Bus++)
+    {
+        for (Device = 0; Device < 32; Device++)
+        {
+            for (Function = 0; Function < 8; Function++)
+            {
+                ULONG Id;
+
+                Dev->Bus      = Bus;
+                Dev->Device   = Device;
+                Dev->Function = Function;
+
+                Id = PciRead32( Dev, PCI_VENDOR_ID );
+                if (LOWORD(Id) == 0xFFFF)
+                {
+                    if (Function == 0)
+                    {
+                        /* Empty slot */
+                        break;
+                    }
+                    continue;
+                }
+
+                if (((PciRead32( Dev, Reg ) & Mask) == Value) && (Index-- == 0))
+                {
+                    ULONG ClassCode = PciRead32( Dev, PCI_CLASS_REVISION );
+
+                    Dev->VendorId = LOWORD(Id);
+                    Dev->DeviceId = HIWORD(Id);
+                    Dev->Class    = HIBYTE(HIWORD(ClassCode));
+                    Dev->SubClass = LOBYTE(HIWORD(ClassCode));
+                    Dev->ProgIf   = HIBYTE(ClassCode);
+                    return TRUE;
+                }
+
+                if ((Function == 0) && (~PciRead8( Dev, PCI_HEADER_TYPE ) & 0x80))
+                {
+                    /* Not a multi-function device */
+                    break;
+                }
+            }
+        }
+    }
+
+    return FALSE;
+}
+
+BOOL PciFindClass( UCHAR Class, UCHAR SubClass, ULONG Index, PCI_DEVICE* Dev )
+{
+    return PciFind( PCI_CLASS_REVISION, 0xFFFF0000, ((ULONG)Class << 24) | ((ULONG)SubClass << 16), Index, Dev );
+}
+
+BOOL PciFindDevice( USHORT VendorId, USHORT DeviceId, ULONG Index, PCI_DEVICE* Dev )
+{
+    return PciFind( PCI_VENDOR_ID, 0xFFFFFFFF, ((ULONG)DeviceId << 16) | VendorId, Index, Dev );
+}
+
+UCHAR PciFindCapability( PCI_DEVICE* Dev, UCHAR Id, UCHAR Previous )
+{
+    UCHAR Cap;
+    INT   i;
+
+    if (Previous != 0)
+    {
+        Cap = PciRead8( Dev, Previous + 1 );
+    }
+    else if (PciRead16( Dev, PCI_STATUS ) & PCI_STATUS_CAPABILITIES)
+    {
+        Cap = PciRead8( Dev, PCI_CAPABILITIES );
+    }
+    else
+    {
+        return 0;
+    }
+
+    /* The list can't hold more than 48 entries, don't loop forever on a broken one */
+    for (i = 0; (i < 48) && (Cap >= 0x40); i++)
+    {
+        Cap &= 0xFC;
+        if (PciRead8( Dev, Cap ) == Id)
+        {
+            return Cap;
+        }
+        Cap = PciRead8( Dev, Cap + 1 );
+    }
+
+    return 0;
+}
+
+ULONG PciGetBar( PCI_DEVICE* Dev, UINT Bar )
+{
+    ULONG Value = PciRead32( Dev, PCI_BAR0 + 4 * Bar );
+
+    if (Value & PCI_BAR_IO)
+    {
+        return Value & ~3;
+    }
+
+    if ((Value & PCI_BAR_64BIT) && (Bar < 5) && (PciRead32( Dev, PCI_BAR0 + 4 * (Bar + 1) ) != 0))
+    {
+        /* Out of reach */
+        return 0;
+    }
+
+    return Value & ~0xF;
+}
+
+VOID PciEnable( PCI_DEVICE* Dev, USHORT Bits )
+{
+    PciWrite16( Dev, PCI_COMMAND, PciRead16( Dev, PCI_COMMAND ) | Bits );
+}
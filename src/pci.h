@@ -0,0 +1,89 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <types.h>
+
+typedef struct _PCI_DEVICE
+{
+    UCHAR  Bus;
+    UCHAR  Device;
+    UCHAR  Function;
+    USHORT VendorId;
+    USHORT DeviceId;
+    UCHAR  Class;
+    UCHAR  SubClass;
+    UCHAR  ProgIf;
+} PCI_DEVICE;
+
+/* Configuration space registers */
+#define PCI_VENDOR_ID      0x00
+#define PCI_COMMAND        0x04
+#define PCI_STATUS         0x06
+#define PCI_CLASS_REVISION 0x08
+#define PCI_HEADER_TYPE    0x0E
+#define PCI_BAR0           0x10
+#define PCI_CAPABILITIES   0x34
+
+/* Capability IDs */
+#define PCI_CAP_VENDOR     0x09
+
+/* Bits in PCI_STATUS */
+#define PCI_STATUS_CAPABILITIES 0x0010
+
+/* Bits in PCI_COMMAND */
+#define PCI_COMMAND_IO     0x0001
+#define PCI_COMMAND_MEMORY 0x0002
+#define PCI_COMMAND_MASTER 0x0004
+
+/* Device classes */
+#define PCI_CLASS_STORAGE  0x01
+#define PCI_STORAGE_IDE    0x01
+#define PCI_STORAGE_SATA   0x06
+#define PCI_SATA_AHCI      0x01    /* Programming interface */
+#define PCI_STORAGE_NVM    0x08
+#define PCI_NVM_EXPRESS    0x02    /* Programming interface */
+#define PCI_CLASS_SERIAL   0x0C
+#define PCI_SERIAL_USB     0x03
+#define PCI_USB_XHCI       0x30    /* Programming interface */
+
+/*
+ * Read and write the configuration space of @Dev.
+ */
+UCHAR  PciRead8  ( PCI_DEVICE* Dev, UCHAR Reg );
+USHORT PciRead16 ( PCI_DEVICE* Dev, UCHAR Reg );
+ULONG  PciRead32 ( PCI_DEVICE* Dev, UCHAR Reg );
+VOID   PciWrite8 ( PCI_DEVICE* Dev, UCHAR Reg, UCHAR  Value );
+VOID   PciWrite16( PCI_DEVICE* Dev, UCHAR Reg, USHORT Value );
+VOID   PciWrite32( PCI_DEVICE* Dev, UCHAR Reg, ULONG  Value );
+
+/*
+ * Finds the @Index'th function (counting from 0) with the given class and
+ * subclass and fills in @Dev. Returns FALSE if there is no such function or
+ * no PCI bus at all.
+ */
+BOOL PciFindClass( UCHAR Class, UCHAR SubClass, ULONG Index, PCI_DEVICE* Dev );
+
+/*
+ * Like PciFindClass(), but looks for a vendor and device ID.
+ */
+BOOL PciFindDevice( USHORT VendorId, USHORT DeviceId, ULONG Index, PCI_DEVICE* Dev );
+
+/*
+ * Returns the offset of the first capability with ID @Id after the one at
+ * @Previous, or the first one if @Previous is 0. Returns 0 if there is none.
+ */
+UCHAR PciFindCapability( PCI_DEVICE* Dev, UCHAR Id, UCHAR Previous );
+
+/*
+ * Returns the address decoded by base address register @Bar of @Dev, with
+ * the type bits stripped. Memory above 4 GB can't be reached, 0 is returned
+ * for it.
+ */
+ULONG PciGetBar( PCI_DEVICE* Dev, UINT Bar );
+
+/*
+ * Sets @Bits (PCI_COMMAND_xxx) in the command register of @Dev.
+ */
+VOID PciEnable( PCI_DEVICE* Dev, USHORT Bits );
+
+#endif
@@ -0,0 +1,305 @@
+#include <clock.h>
+#include <drive.h>
+#include <errno.h>
+#include <log.h>
+#include <plan.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Load planner
+ *
+ * Every file range is broken up into runs of whole sectors, plus single
+ * partial sectors at the ends of each extent. The runs are sorted by drive
+ * and LBA, so each drive is read in one ascending sweep. Runs of whole sectors
+ * go straight to their destination through SubmitRead(); partial sectors go
+ * through a sector buffer and are copied when they complete.
+ */
+
+#define RUN_GROW 32 /* Grow the run list by this many entries */
+
+struct _LOAD_RUN
+{
+    DEVICE*    Device;
+    ULONG      Drive;       /* Sort key: drive, then LBA          */
+    ULONGLONG  Lba;
+    ULONGLONG  Sector;      /* Relative to the device             */
+    ULONGLONG  nSectors;
+    ULONG      Skip;        /* Bytes to skip in the first sector  */
+    ULONGLONG  Length;      /* Bytes that go to Buffer            */
+    BOOL       Partial;     /* Only part of a sector is wanted    */
+    CHAR*      Buffer;
+    CHAR*      Bounce;      /* Sector buffer for partial sectors  */
+    IO_REQUEST Request;
+};
+
+VOID InitLoadPlan( LOAD_PLAN* Plan )
+{
+    Plan->Runs  = NULL;
+    Plan->nRuns = 0;
+}
+
+VOID FreeLoadPlan( LOAD_PLAN* Plan )
+{
+    free( Plan->Runs );
+    InitLoadPlan( Plan );
+}
+
+static LOAD_RUN* AddRun( LOAD_PLAN* Plan, DEVICE* Device )
+{
+    LOAD_RUN* Run;
+
+    if (Plan->nRuns % RUN_GROW == 0)
+    {
+        LOAD_RUN* tmp = realloc( Plan->Runs, (Plan->nRuns + RUN_GROW) * sizeof(LOAD_RUN) );
+        if (tmp == NULL)
+        {
+            errno = ENOMEM;
+            return NULL;
+        }
+        Plan->Runs = tmp;
+    }
+
+    Run = &Plan->Runs[ Plan->nRuns++ ];
+    Run->Device = Device;
+    Run->Drive  = Device->DeviceId >> 24;
+    Run->Bounce = NULL;
+    return Run;
+}
+
+/* Splits @Extent into runs, the same way ReadSectorBytes() splits its reads */
+static BOOL AddExtent( LOAD_PLAN* Plan, DEVICE* Device, ULONG SectorSize, FILE_EXTENT* Extent, CHAR* Buffer )
+{
+    ULONGLONG Sector = Extent->Sector + Extent->Offset / SectorSize;
+    ULONG     Skip   = Extent->Offset % SectorSize;
+    ULONGLONG Left   = Extent->Length;
+
+    while (Left > 0)
+    {
+        LOAD_RUN* Run = AddRun( Plan, Device );
+        if (Run == NULL)
+        {
+            return FALSE;
+        }
+
+        Run->Sector  = Sector;
+        Run->Lba     = Device->StartSector + Sector;
+        Run->Skip    = Skip;
+        Run->Buffer  = Buffer;
+        Run->Partial = (Skip != 0) || (Left < SectorSize);
+
+        if (!Run->Partial)
+        {
+            Run->nSectors = Left / SectorSize;
+            Run->Length   = Run->nSectors * SectorSize;
+        }
+        else
+        {
+            Run->nSectors = 1;
+            Run->Length   = MIN( Left, SectorSize - Skip );
+        }
+
+        Buffer += Run->Length;
+        Left   -= Run->Length;
+        Sector += (Skip + Run->Length) / SectorSize;
+        Skip    = 0;
+    }
+    return TRUE;
+}
+
+BOOL AddToLoadPlan( LOAD_PLAN* Plan, FILE* File, ULONGLONG Offset, ULONGLONG nBytes, VOID* Buffer )
+{
+    DRIVE_INFO*  pdi   = GetDriveParameters( File->Device->DeviceId >> 24 );
+    INT          Error = errno;
+    FILE_EXTENT* Extents;
+    ULONGLONG    Covered;
+    ULONG        nExtents;
+    ULONG        i;
+
+    if (nBytes == 0)
+    {
+        return TRUE;
+    }
+
+    errno    = EZERO;
+    nExtents = GetFileExtents( File, Offset, nBytes, NULL, 0 );
+    if ((nExtents == 0) && (errno == ENOFSYS))
+    {
+        /* The file system can't tell where the data is, read it now */
+        errno = Error;
+        if ((!SetFilePointer( File, Offset, FILE_BEGIN )) || (ReadFile( File, Buffer, nBytes ) != nBytes))
+        {
+            errno = EIO;
+            return FALSE;
+        }
+        return TRUE;
+    }
+    errno = Error;
+
+    if (nExtents == 0)
+    {
+        /* Nothing of the range is in the file */
+        errno = EIO;
+        return FALSE;
+    }
+
+    Extents = malloc( nExtents * sizeof(FILE_EXTENT) );
+    if ((pdi == NULL) || (Extents == NULL))
+    {
+        free( Extents );
+        errno = (pdi == NULL) ? EIO : ENOMEM;
+        return FALSE;
+    }
+
+    nExtents = GetFileExtents( File, Offset, nBytes, Extents, nExtents );
+
+    Covered = 0;
+    for (i = 0; i < nExtents; i++)
+    {
+        if (!AddExtent( Plan, File->Device, pdi->nBytesPerSector, &Extents[i], (CHAR*)Buffer + Covered ))
+        {
+            free( Extents );
+            return FALSE;
+        }
+        Covered += Extents[i].Length;
+    }
+
+    free( Extents );
+
+    if (Covered != nBytes)
+    {
+        /* Past the end of the file, or the cluster chain ended early */
+        errno = EIO;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static BOOL IsBefore( CONST LOAD_RUN* Run1, CONST LOAD_RUN* Run2 )
+{
+    return (Run1->Drive < Run2->Drive) || ((Run1->Drive == Run2->Drive) && (Run1->Lba < Run2->Lba));
+}
+
+/* Shell sort; runs of one file are mostly in order already */
+static VOID SortRuns( LOAD_RUN* Runs, ULONG nRuns )
+{
+    ULONG Gap;
+
+    for (Gap = nRuns / 2; Gap > 0; Gap /= 2)
+    {
+        ULONG i;
+        for (i = Gap; i < nRuns; i++)
+        {
+            LOAD_RUN tmp = Runs[i];
+            ULONG    j;
+
+            for (j = i; (j >= Gap) && (IsBefore( &tmp, &Runs[j - Gap] )); j -= Gap)
+            {
+                Runs[j] = Runs[j - Gap];
+            }
+            Runs[j] = tmp;
+        }
+    }
+}
+
+/* Joins sorted runs that continue each other on disk and in memory */
+static ULONG MergeRuns( LOAD_RUN* Runs, ULONG nRuns )
+{
+    ULONG n = 0;
+    ULONG i;
+
+    for (i = 0; i < nRuns; i++)
+    {
+        LOAD_RUN* Last = (n > 0) ? &Runs[n - 1] : NULL;
+
+        if ((Last != NULL) && (!Last->Partial) && (!Runs[i].Partial) &&
+            (Last->Device == Runs[i].Device) &&
+            (Last->Sector + Last->nSectors == Runs[i].Sector) &&
+            (Last->Buffer + Last->Length == Runs[i].Buffer))
+        {
+            Last->nSectors += Runs[i].nSectors;
+            Last->Length   += Runs[i].Length;
+        }
+        else
+        {
+            Runs[n++] = Runs[i];
+        }
+    }
+    return n;
+}
+
+BOOL RunLoadPlan( LOAD_PLAN* Plan )
+{
+    LOAD_RUN*   Runs      = Plan->Runs;
+    ULONG       nRuns     = Plan->nRuns;
+    BOOL        Result    = TRUE;
+    ULONG       Start     = GetClockMs();
+    ULONGLONG   nBytes    = 0;
+    IO_REQUEST* Request;
+    ULONG       i;
+    ULONG       j;
+
+    SortRuns( Runs, nRuns );
+    nRuns = MergeRuns( Runs, nRuns );
+
+    /* The sweep: queue everything in disk order */
+    for (i = 0; i < nRuns; i++)
+    {
+        LOAD_RUN* Run = &Runs[i];
+
+        if (Run->Partial)
+        {
+            DRIVE_INFO* pdi = GetDriveParameters( Run->Drive );
+
+            Run->Bounce = (pdi != NULL) ? malloc( pdi->nBytesPerSector ) : NULL;
+            if (Run->Bounce == NULL)
+            {
+                errno = ENOMEM;
+                break;
+            }
+        }
+
+        Run->Request.Sector   = Run->Sector;
+        Run->Request.nSectors = Run->nSectors;
+        Run->Request.Buffer   = (Run->Partial) ? Run->Bounce : Run->Buffer;
+        Run->Request.Context  = Run;
+
+        if (!SubmitRead( Run->Device, &Run->Request ))
+        {
+            free( Run->Bounce );
+            break;
+        }
+    }
+
+    if (i < nRuns)
+    {
+        Result = FALSE;
+    }
+
+    /* Collect whatever was queued, on every device that was used */
+    for (j = 0; j < i; j++)
+    {
+        while ((Request = WaitRead( Runs[j].Device )) != NULL)
+        {
+            LOAD_RUN* Run = (LOAD_RUN*)Request->Context;
+
+            if (Request->nRead != Request->nSectors)
+            {
+                errno  = EIO;
+                Result = FALSE;
+            }
+            else if (Run->Partial)
+            {
+                memcpy( Run->Buffer, Run->Bounce + Run->Skip, Run->Length );
+            }
+            nBytes += Run->Length;
+            free( Run->Bounce );
+        }
+    }
+
+    LogEvent( "Load plan: %u of %u runs, %u kB in %u ms", i, nRuns, (ULONG)(nBytes / 1024),
+              GetClockMs() - Start );
+
+    FreeLoadPlan( Plan );
+    return Result;
+}
@@ -0,0 +1,39 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include <io.h>
+
+typedef struct _LOAD_RUN LOAD_RUN;
+
+/*
+ * The reads needed to boot an image. Instead of reading file after file,
+ * they are gathered first and then done in a single pass over each drive.
+ */
+typedef struct _LOAD_PLAN
+{
+    LOAD_RUN* Runs;
+    ULONG     nRuns;
+} LOAD_PLAN;
+
+/* Initializes @Plan to an empty plan */
+VOID InitLoadPlan( LOAD_PLAN* Plan );
+
+/*
+ * Adds reading @nBytes bytes at offset @Offset in @File into @Buffer to
+ * @Plan. Where the data is on disk is looked up right away, so @File may be
+ * closed afterwards. If the file system can't tell, the data is read right
+ * away instead. Returns FALSE if the data can't be read.
+ */
+BOOL AddToLoadPlan( LOAD_PLAN* Plan, FILE* File, ULONGLONG Offset, ULONGLONG nBytes, VOID* Buffer );
+
+/*
+ * Does all reads in @Plan in order of their position on disk, merging reads
+ * that follow each other on disk and in memory. The plan is empty afterwards.
+ * Returns FALSE if any read failed.
+ */
+BOOL RunLoadPlan( LOAD_PLAN* Plan );
+
+/* Empties @Plan without reading anything */
+VOID FreeLoadPlan( LOAD_PLAN* Plan );
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef PORT_H
+#define PORT_H
+
+#include <types.h>
+
+UCHAR  inb ( USHORT Port );
+USHORT inw ( USHORT Port );
+ULONG  inl ( USHORT Port );
+
+VOID   outb( USHORT Port, UCHAR  Value );
+VOID   outw( USHORT Port, USHORT Value );
+VOID   outl( USHORT Port, ULONG  Value );
+
+/*
+ * Keeps the compiler from moving memory accesses across it. Needed between
+ * filling in a structure a device reads and telling the device about it.
+ */
+#define MemoryBarrier() __asm__ __volatile__( "" : : : "memory" )
+
+/* Reads @Count words from @Port into @Buffer */
+VOID   insw( USHORT Port, VOID* Buffer, ULONG Count );
+
+/* Returns the CPUID feature flags (EDX of leaf 1), or 0 if there is no CPUID */
+ULONG  GetCpuFeatures( VOID );
+
+#define CPU_FEATURE_TSC 0x00000010
+
+/* Reads the time stamp counter; only if the CPU has it */
+ULONGLONG ReadTimeStamp( VOID );
+
+#endif
@@ -0,0 +1,85 @@
+.code32
+.text
+
+.global inb
+inb:
+    movl 4(%esp), %edx
+    xorl %eax, %eax
+    inb %dx, %al
+    ret
+
+.global inw
+inw:
+    movl 4(%esp), %edx
+    xorl %eax, %eax
+    inw %dx, %ax
+    ret
+
+.global inl
+inl:
+    movl 4(%esp), %edx
+    inl %dx, %eax
+    ret
+
+.global outb
+outb:
+    movl 4(%esp), %edx
+    movl 8(%esp), %eax
+    outb %al, %dx
+    ret
+
+.global outw
+outw:
+    movl 4(%esp), %edx
+    movl 8(%esp), %eax
+    outw %ax, %dx
+    ret
+
+.global outl
+outl:
+    movl 4(%esp), %edx
+    movl 8(%esp), %eax
+    outl %eax, %dx
+    ret
+
+.global insw
+insw:
+    pushl %edi
+    cld
+    movl 8(%esp), %edx
+    movl 12(%esp), %edi
+    movl 16(%esp), %ecx
+    rep insw
+    popl %edi
+    ret
+
+.global GetCpuFeatures
+GetCpuFeatures:
+    pushfl
+    popl %eax
+    movl %eax, %ecx
+    xorl $0x00200000, %eax
+    pushl %eax
+    popfl
+    pushfl
+    popl %eax
+    pushl %ecx
+    popfl
+    xorl %ecx, %eax
+    jz 1f
+
+    /* The ID flag can be changed, so CPUID exists */
+    pushl %ebx
+    movl $1, %eax
+    cpuid
+    popl %ebx
+    movl %edx, %eax
+    ret
+1:
+    xorl %eax, %eax
+    ret
+
+.global ReadTimeStamp
+ReadTimeStamp:
+    rdtsc
+    ret
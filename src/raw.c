@@ -23,75 +23,16 @@ static FILE* _OpenFile( DEVICE* Device, CHAR* Path )
 
 static ULONGLONG _ReadFile( FILE* file, VOID* Buffer, ULONGLONG nBytes )
 {
-    RAWFILE*    File = (RAWFILE*)file;
-    DRIVE_INFO* pdi  = GetDriveParameters( file->Device->DeviceId >> 24 );
-    ULONG       Read = 0;
+    RAWFILE*  File = (RAWFILE*)file;
+    ULONGLONG Read = ReadSectorBytes( file->Device, 0, File->Cursor, nBytes, Buffer, RS_NOCACHE );
 
-    while (nBytes > 0)
+    if (Read != nBytes)
     {
-        ULONGLONG nSectors;
-        ULONGLONG Sector;
-        ULONGLONG len;
-        CHAR*     TmpBuf;
-        CHAR*     src;
-
-        nSectors = File->Cursor % pdi->nBytesPerSector + nBytes;
-        nSectors = (nSectors + pdi->nBytesPerSector - 1) / pdi->nBytesPerSector;
-        Sector   = File->Cursor / pdi->nBytesPerSector;
-
-        /* If we can't allocate the entire run at once, break it up
-         * into smaller pieces. Hence the above while loop */
-        do
-        {
-            TmpBuf = malloc( nSectors * pdi->nBytesPerSector );
-            if (TmpBuf != NULL)
-            {
-                break;
-            }
-            nSectors /= 2;
-        } while (nSectors > 1);
-
-        if (TmpBuf == NULL)
-        {
-            /* Error, return what we read so far */
-            errno = ENOMEM;
-            return Read;
-        }
-
-        if (ReadSector( file->Device, Sector, nSectors, TmpBuf ) != nSectors)
-        {
-            /* Error, return what we read so far */
-            errno = EIO;
-            free( TmpBuf );
-            return Read;
-        }
-
-        /* Copy the full sectors by default */
-        src = TmpBuf;
-        len = nSectors * pdi->nBytesPerSector;
-
-        if (File->Cursor % pdi->nBytesPerSector != 0)
-        {
-            /* Read starting unaligned bytes */
-            src += File->Cursor % pdi->nBytesPerSector;
-            len -= File->Cursor % pdi->nBytesPerSector;
-        }
-
-        if (nBytes < len)
-        {
-            /* Read remaining unaligned bytes */
-            len = nBytes;
-        }
-
-        memcpy( Buffer, src, len );
-        Buffer         = (CHAR*)Buffer + len;
-        Read          += len;
-        nBytes        -= len;
-        File->Cursor  += len;
-
-        free( TmpBuf );
+        errno = EIO;
     }
 
+    File->Cursor += Read;
+
     return Read;
 }
 
@@ -137,6 +78,25 @@ static VOID _CloseFile( FILE* File )
 {
 }
 
+static ULONG _GetFileExtents( FILE* File, ULONGLONG Offset, ULONGLONG nBytes, FILE_EXTENT* Extents, ULONG nExtents )
+{
+    ULONGLONG Size = _GetFileSize( File );
+
+    if ((Offset >= Size) || (nBytes == 0))
+    {
+        return 0;
+    }
+
+    /* The whole device is one run */
+    if (nExtents > 0)
+    {
+        Extents[0].Sector = 0;
+        Extents[0].Offset = Offset;
+        Extents[0].Length = MIN( nBytes, Size - Offset );
+    }
+    return 1;
+}
+
 static VOID _Release( DEVICE* Device )
 {
 }
@@ -149,6 +109,7 @@ BOOL RawMount( DEVICE* Device )
     Device->GetFileSize    = _GetFileSize;
     Device->ReadFile       = _ReadFile;
     Device->CloseFile      = _CloseFile;
+    Device->GetFileExtents = _GetFileExtents;
     Device->Release        = _Release;
 
     return TRUE;
@@ -0,0 +1,223 @@
+#include <console.h>
+#include <port.h>
+#include <serial.h>
+#include <stdio.h>
+
+/*
+ * Serial console
+ *
+ * Drives a 16550 UART without interrupts. Output goes into a queue which is
+ * moved into the transmit FIFO a FIFO-full at a time whenever the UART is
+ * ready, so writing only waits when the queue is full. The console's cursor
+ * positioning and colors are sent as VT100/ANSI sequences.
+ */
+
+#define UART_DATA     0     /* Divisor latch low with LCR_DLAB  */
+#define UART_IER      1     /* Divisor latch high with LCR_DLAB */
+#define UART_FCR      2     /* Interrupt identification on read */
+#define UART_LCR      3
+#define UART_MCR      4
+#define UART_LSR      5
+
+#define FCR_ENABLE    0x01
+#define FCR_CLEAR     0x06
+#define FCR_TRIGGER14 0xC0
+#define IIR_FIFO      0xC0  /* Both set if the FIFOs work */
+
+#define LCR_8N1       0x03
+#define LCR_DLAB      0x80
+
+#define MCR_DTR       0x01
+#define MCR_RTS       0x02
+#define MCR_LOOP      0x10
+
+#define LSR_DATA      0x01
+#define LSR_THRE      0x20  /* Transmit FIFO empty    */
+#define LSR_TEMT      0x40  /* Transmitter idle       */
+
+#define UART_CLOCK    115200
+#define UART_FIFO     16
+#define UART_TIMEOUT  0x100000
+
+#define QUEUE_SIZE    1024
+
+static USHORT Base;
+static ULONG  FifoSize;
+static CHAR   Queue[ QUEUE_SIZE ];
+static ULONG  Head;                 /* Next free entry    */
+static ULONG  Tail;                 /* Next byte to send  */
+static UCHAR  CurrentAttr;          /* Last attribute sent */
+
+/* VGA colors are BGR, ANSI colors RGB */
+static CONST UCHAR AnsiColors[8] = { 0, 4, 2, 6, 1, 5, 3, 7 };
+
+static CONST USHORT ComPorts[4] = { 0x3F8, 0x2F8, 0x3E8, 0x2E8 };
+
+USHORT GetComPort( ULONG Index )
+{
+    return ((Index >= 1) && (Index <= 4)) ? ComPorts[ Index - 1 ] : 0;
+}
+
+/* Moves queued bytes into the transmit FIFO, if it's empty */
+static VOID Pump( VOID )
+{
+    ULONG n;
+
+    if ((Head != Tail) && (inb( Base + UART_LSR ) & LSR_THRE))
+    {
+        for (n = 0; (n < FifoSize) && (Head != Tail); n++)
+        {
+            outb( Base + UART_DATA, Queue[ Tail ] );
+            Tail = (Tail + 1) % QUEUE_SIZE;
+        }
+    }
+}
+
+static VOID Send( CHAR c )
+{
+    ULONG Next = (Head + 1) % QUEUE_SIZE;
+
+    while (Next == Tail)
+    {
+        /* Queue full, wait for the UART */
+        Pump();
+    }
+
+    Queue[ Head ] = c;
+    Head = Next;
+}
+
+static VOID SendString( CONST CHAR* s )
+{
+    while (*s != '\0')
+    {
+        Send( *s++ );
+    }
+}
+
+static VOID SetAttribute( UCHAR Attr )
+{
+    CHAR Sequence[16];
+
+    if (Attr != CurrentAttr)
+    {
+        sprintf( Sequence, "\x1B[0;%s3%u;4%um", (Attr & 0x08) ? "1;" : "",
+                 AnsiColors[ Attr & 7 ], AnsiColors[ (Attr >> 4) & 7 ] );
+        SendString( Sequence );
+        CurrentAttr = Attr;
+    }
+}
+
+/* Terminals rarely do code page 437; draw boxes with ASCII instead */
+static CHAR Translate( CHAR c )
+{
+    UCHAR u = c;
+
+    if (u < 0x80)                   return c;
+    if (u == 0xCD)                  return '=';
+    if (u == 0xC4)                  return '-';
+    if ((u == 0xB3) || (u == 0xBA)) return '|';
+    if ((u > 0xB3) && (u <= 0xDA))  return '+';
+    return '?';
+}
+
+static VOID SerialWrite( CONSOLE* Console, CONST CHAR* s, ULONG Length, UCHAR Attr )
+{
+    SetAttribute( Attr );
+    while (Length-- > 0)
+    {
+        Send( Translate( *s++ ) );
+    }
+    Pump();
+}
+
+static VOID SerialGotoXY( CONSOLE* Console, ULONG X, ULONG Y )
+{
+    CHAR Sequence[24];
+
+    sprintf( Sequence, "\x1B[%u;%uH", Y + 1, X + 1 );
+    SendString( Sequence );
+    Pump();
+}
+
+static VOID SerialClear( CONSOLE* Console, UCHAR Attr )
+{
+    SetAttribute( Attr );
+    SendString( "\x1B[2J\x1B[H" );
+    Pump();
+}
+
+static VOID SerialShowCursor( CONSOLE* Console, BOOL Show )
+{
+    SendString( (Show) ? "\x1B[?25h" : "\x1B[?25l" );
+    Pump();
+}
+
+static INT SerialRead( CONSOLE* Console )
+{
+    /* The menu polls for input, so this keeps output going as well */
+    Pump();
+
+    return (inb( Base + UART_LSR ) & LSR_DATA) ? inb( Base + UART_DATA ) : -1;
+}
+
+static VOID SerialFlush( CONSOLE* Console )
+{
+    ULONG i;
+
+    while (Head != Tail)
+    {
+        Pump();
+    }
+
+    for (i = 0; (i < UART_TIMEOUT) && (~inb( Base + UART_LSR ) & LSR_TEMT); i++);
+}
+
+static CONSOLE SerialConsole = { SerialWrite, SerialGotoXY, SerialClear, SerialShowCursor, SerialRead, SerialFlush, NULL };
+
+BOOL SerialInitialize( USHORT Port, ULONG Baud )
+{
+    ULONG Divisor = (Baud > 0) ? UART_CLOCK / Baud : 0;
+    ULONG i;
+
+    if ((Port == 0) || (Divisor == 0) || (Divisor > 0xFFFF))
+    {
+        return FALSE;
+    }
+
+    outb( Port + UART_IER, 0 );
+    outb( Port + UART_LCR, LCR_DLAB );
+    outb( Port + UART_DATA, Divisor & 0xFF );
+    outb( Port + UART_IER,  Divisor >> 8 );
+    outb( Port + UART_LCR, LCR_8N1 );
+    outb( Port + UART_FCR, FCR_ENABLE | FCR_CLEAR | FCR_TRIGGER14 );
+
+    /* See if there's a UART by sending a byte to ourselves */
+    outb( Port + UART_MCR, MCR_LOOP | MCR_DTR | MCR_RTS );
+    outb( Port + UART_DATA, 0xAE );
+    for (i = 0; (i < UART_TIMEOUT) && (~inb( Port + UART_LSR ) & LSR_DATA); i++);
+
+    if ((i == UART_TIMEOUT) || (inb( Port + UART_DATA ) != 0xAE))
+    {
+        outb( Port + UART_MCR, 0 );
+        return FALSE;
+    }
+
+    /* Normal operation, no interrupts (OUT2 off) */
+    outb( Port + UART_MCR, MCR_DTR | MCR_RTS );
+
+    /* Anything received so far is stale */
+    for (i = 0; (i < UART_FIFO) && (inb( Port + UART_LSR ) & LSR_DATA); i++)
+    {
+        inb( Port + UART_DATA );
+    }
+
+    Base        = Port;
+    FifoSize    = ((inb( Port + UART_FCR ) & IIR_FIFO) == IIR_FIFO) ? UART_FIFO : 1;
+    Head        = 0;
+    Tail        = 0;
+    CurrentAttr = 0xFF;
+
+    AddConsole( &SerialConsole );
+    return TRUE;
+}
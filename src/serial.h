@@ -0,0 +1,20 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <types.h>
+
+#define SERIAL_DEFAULT_BAUD 115200
+
+/* Returns the I/O port of COM port @Index (1 - 4), or 0 if there's no such port */
+USHORT GetComPort( ULONG Index );
+
+/*
+ * Sets up the 16550 UART at I/O port @Port for @Baud baud, 8 data bits, no
+ * parity, 1 stop bit, with FIFOs on and interrupts off, and adds it to the
+ * console as a VT100 terminal. Output is queued and moved into the FIFO
+ * whenever the console is written or read. Returns FALSE if there is no
+ * UART at @Port or @Baud can't be set.
+ */
+BOOL SerialInitialize( USHORT Port, ULONG Baud );
+
+#endif
@@ -18,6 +18,12 @@ start:
     addl $4, %esp
     pushl %eax
 
+    /* Send out what's still queued for the serial console */
+    call FlushConsole
+
+    /* The BIOS waits for the key below */
+    call KeyboardRelease
+
     call LeaveProtectedMode
     .code16
 
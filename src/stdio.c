@@ -5,7 +5,7 @@
 #include <stdio.h>
 #include <string.h>
 
-#include "video.h"
+#include <console.h>
 
 static VOID ulltoa(ULONGLONG value, CHAR* string, INT base)
 {
@@ -31,8 +31,18 @@ static VOID ulltoa(ULONGLONG value, CHAR* string, INT base)
     }
 }
 
+/* Writes @c to the console, without handing it to the drivers yet */
+static INT PutChar( INT c )
+{
+    if (c == '\n')
+    {
+        WriteChar( '\r' );
+    }
+
+    return WriteChar( c );
+}
 
-#define PRINT(c)                 do { if (!useString) putchar(c); else if (n > 0) *s++ = (c); n--; } while(0)
+#define PRINT(c)                 do { if (!useString) PutChar(c); else if (n > 0) *s++ = (c); n--; } while(0)
 
 #define FLAG_FORCE_SIGN          1
 #define FLAG_LEFT_JUSTIFY        2
@@ -347,24 +357,19 @@ INT _printf(CHAR* s, BOOL useString, INT n, CONST CHAR* format, va_list arg)
 
 INT putchar(INT c)
 {
-    if (c == '\n')
-    {                 
-        putchar('\r');
-    }
-
-    return WriteChar( c );
+    PutChar( c );
+    UpdateConsole();
+    return c;
 }
 
 INT puts(CONST CHAR* s)
 {
     while (*s != '\0')
     {
-        if (putchar(*s++) == EOF)
-        {
-            return EOF;
-        }
+        PutChar( *s++ );
     }
-    putchar('\n');
+    PutChar('\n');
+    UpdateConsole();
     return 1;
 }
 
@@ -406,7 +411,9 @@ INT sprintf(CHAR* s, CONST CHAR* format, ...)
 
 INT vprintf(CONST CHAR* format, va_list arg)
 {
-    return _printf( NULL, FALSE, 0, format, arg );
+    INT rv = _printf( NULL, FALSE, 0, format, arg );
+    UpdateConsole();
+    return rv;
 }
 
 INT vsprintf(CHAR* s, CONST CHAR* format, va_list arg)
@@ -119,6 +119,39 @@ VOID HeapInit( VOID* Address, ULONG Size )
     }
 }
 
+/* Hands out the first @nBytes of free block @Block */
+static VOID* Allocate( HEAPBLOCK* Block, ULONG nBytes )
+{
+    ULONG Remainder = SIZE(Block) - nBytes;
+
+    Unlink( Block );
+
+    if (Remainder >= MIN_BLOCKSIZE + BLOCKSIZE)
+    {
+        /* It's worth splicing the block */
+        HEAPBLOCK* NewBlock;
+
+        /* Clear FREE, copy ALIGNED flag */
+        Block->Size = nBytes | (Block->Size & BLOCK_ALIGNED);
+
+        NewBlock = NEXT(Block);
+        NewBlock->PrevSize = Block->Size;
+        NewBlock->Size     = (Remainder - BLOCKSIZE) | BLOCK_FREE;
+        NEXT(NewBlock)->PrevSize = NewBlock->Size;
+
+        Link( NewBlock );
+    }
+    else
+    {
+        /* Just clear free flag */
+        Block->Size &= ~BLOCK_FREE;
+        NEXT(Block)->PrevSize &= ~BLOCK_FREE;
+    }
+
+    /* Return pointer to user area after header */
+    return (Block + 1);
+}
+
 VOID* malloc( ULONG nBytes )
 {
     HEAPBLOCK* Block;
@@ -131,34 +164,50 @@ VOID* malloc( ULONG nBytes )
         if (Block->Size >= nBytes)
         {
             /* We found a big enough block */
-            ULONG Remainder = SIZE(Block) - nBytes;
+            return Allocate( Block, nBytes );
+        }
+    }
+
+    /* No blocks found */
+    return NULL;
+}
 
-            Unlink( Block );
+VOID* memalign( ULONG Alignment, ULONG nBytes )
+{
+    HEAPBLOCK* Block;
 
-            if (Remainder >= MIN_BLOCKSIZE + BLOCKSIZE)
-            {
-                /* It's worth splicing the block */
-                HEAPBLOCK* NewBlock;
+    nBytes = ALIGN(nBytes);
 
-                /* Clear FREE, copy ALIGNED flag */
-                Block->Size = nBytes | (Block->Size & BLOCK_ALIGNED);
+    /* Walk through the linked list */
+    for (Block = HeapList; Block != NULL; Block = Block->Next)
+    {
+        ULONG Start = (ULONG)(Block + 1);
+        ULONG User  = (Start + Alignment - 1) & -Alignment;
 
-                NewBlock = NEXT(Block);
-                NewBlock->PrevSize = Block->Size;
-                NewBlock->Size     = (Remainder - BLOCKSIZE) | BLOCK_FREE;
-                NEXT(NewBlock)->PrevSize = NewBlock->Size;
+        while ((User != Start) && (User - Start < BLOCKSIZE + MIN_BLOCKSIZE))
+        {
+            /* The part before the aligned address must fit a free block */
+            User += Alignment;
+        }
 
-                Link( NewBlock );
-            }
-            else
+        if (User + nBytes <= Start + SIZE(Block))
+        {
+            if (User != Start)
             {
-                /* Just clear free flag */
-                Block->Size &= ~BLOCK_FREE;
-                NEXT(Block)->PrevSize &= ~BLOCK_FREE;
+                /* Split off the part before the aligned address */
+                HEAPBLOCK* Aligned = (HEAPBLOCK*)User - 1;
+                ULONG      Size    = SIZE(Block) - (User - Start);
+
+                Block->Size = (User - Start - BLOCKSIZE) | (Block->Size & (BLOCK_ALIGNED | BLOCK_FREE));
+                Aligned->PrevSize = Block->Size;
+                Aligned->Size     = Size | BLOCK_FREE;
+                NEXT(Aligned)->PrevSize = Aligned->Size;
+
+                Link( Aligned );
+                Block = Aligned;
             }
 
-            /* Return pointer to user area after header */
-            return (Block + 1);
+            return Allocate( Block, nBytes );
         }
     }
 
@@ -17,6 +17,14 @@ VOID* realloc( VOID* Address, ULONG nBytes );
 /* Non standard functions */
 VOID  HeapInit( VOID* Address, ULONG Size );
 
+/*
+ * Allocates @nBytes bytes at an address that's a multiple of @Alignment,
+ * which must be a power of two. Like all allocations, the memory doesn't
+ * cross a 64 kB boundary, so it can be handed to DMA controllers.
+ * The memory is released with free().
+ */
+VOID* memalign( ULONG Alignment, ULONG nBytes );
+
 /* Waits for an interrupt */
 VOID WaitForInterrupt( VOID );
 BOOL EnableA20Gate( VOID );
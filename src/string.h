@@ -7,6 +7,7 @@ VOID* memset ( VOID* Src,  INT c,     INT n );
 VOID* memchr ( VOID* Src,  INT c,     INT n );
 VOID* memcpy ( VOID* Dest, VOID* Src, INT n );
 VOID* memmove( VOID* Dest, VOID* Src, INT n );
+INT   memcmp ( VOID* s1,   VOID* s2,  INT n );
 
 CHAR* strchr ( CONST CHAR* Src,  INT c );
 CHAR* strcpy ( CHAR* Dest, CONST CHAR* Src );
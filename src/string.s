@@ -73,6 +73,25 @@ memmove:
     cld
     ret
 
+.global memcmp
+memcmp:
+    pushl %esi
+    pushl %edi
+    cld
+    movl 12(%esp), %esi
+    movl 16(%esp), %edi
+    movl 20(%esp), %ecx
+    xorl %eax, %eax
+    repe cmpsb
+    je 1f
+    movzbl -1(%esi), %eax
+    movzbl -1(%edi), %ecx
+    subl %ecx, %eax
+1:
+    popl %edi
+    popl %esi
+    ret
+
 .global strlen
 strlen:
     movl %edi, %edx
@@ -1,10 +1,76 @@
 #include <bios.h>
 #include <ctype.h>
+#include <port.h>
 #include <video.h>
 
-static UCHAR Attr = 7;
+/*
+ * Screen console
+ *
+ * In the standard text modes we write character/attribute pairs straight
+ * into video memory and move the cursor through the CRTC, instead of going
+ * through the BIOS for every character. A shadow copy of the screen lets us
+ * skip cells that already show what is written, so redrawing a whole row
+ * only touches the cells that changed. In other modes the BIOS is used.
+ */
 
-INT WriteChar( CHAR c )
+#define MAX_COLUMNS  80
+#define MAX_ROWS     50
+
+#define CRTC_CURSOR_START 0x0A
+#define CRTC_CURSOR_HIGH  0x0E
+#define CRTC_CURSOR_LOW   0x0F
+
+#define CURSOR_DISABLE    0x20  /* In CRTC_CURSOR_START */
+
+static BOOL             Direct;         /* FALSE: go through the BIOS */
+static volatile USHORT* Screen;
+static volatile USHORT* BiosCursor;     /* Page 0 cursor in the BIOS data area */
+static USHORT           CrtcPort;
+static ULONG            Columns;
+static ULONG            Rows;
+static ULONG            CursorX;
+static ULONG            CursorY;
+static USHORT           Shadow[ MAX_COLUMNS * MAX_ROWS ];
+
+static VOID PutCell( ULONG Index, USHORT Cell )
+{
+    if (Shadow[ Index ] != Cell)
+    {
+        Shadow[ Index ] = Cell;
+        Screen[ Index ] = Cell;
+    }
+}
+
+/* Moves the hardware cursor to CursorX, CursorY */
+static VOID MoveCursor( VOID )
+{
+    ULONG Offset = CursorY * Columns + CursorX;
+
+    outb( CrtcPort,     CRTC_CURSOR_HIGH );
+    outb( CrtcPort + 1, (Offset >> 8) & 0xFF );
+    outb( CrtcPort,     CRTC_CURSOR_LOW );
+    outb( CrtcPort + 1, Offset & 0xFF );
+
+    /* Keep the BIOS in sync for whatever we boot */
+    *BiosCursor = (USHORT)((CursorY << 8) | CursorX);
+}
+
+static VOID ScrollUp( UCHAR Attr )
+{
+    ULONG i;
+
+    for (i = 0; i < (Rows - 1) * Columns; i++)
+    {
+        PutCell( i, Shadow[ i + Columns ] );
+    }
+
+    for (; i < Rows * Columns; i++)
+    {
+        PutCell( i, (Attr << 8) | ' ' );
+    }
+}
+
+static VOID BiosWrite( CHAR c, UCHAR Attr )
 {
     REGS regs;
 
@@ -24,13 +90,79 @@ INT WriteChar( CHAR c )
     regs.x.bx = 7;
 
     int86( 0x10, &regs, &regs );
+}
+
+/* Puts @c on the screen; the hardware cursor is left alone */
+static VOID PutChar( CHAR c, UCHAR Attr )
+{
+    /* Same control characters as the BIOS teletype output */
+    switch (c)
+    {
+        case '\a':
+            return;
+
+        case '\b':
+            if (CursorX > 0) CursorX--;
+            break;
+
+        case '\r':
+            CursorX = 0;
+            break;
+
+        case '\n':
+            CursorY++;
+            break;
 
-    return c;
+        default:
+            PutCell( CursorY * Columns + CursorX, (Attr << 8) | (UCHAR)c );
+            if (++CursorX == Columns)
+            {
+                CursorX = 0;
+                CursorY++;
+            }
+            break;
+    }
+
+    if (CursorY == Rows)
+    {
+        ScrollUp( Attr );
+        CursorY--;
+    }
 }
 
-VOID ShowCursor( BOOL Show )
+static VOID VgaWrite( CONSOLE* Console, CONST CHAR* s, ULONG Length, UCHAR Attr )
 {
-    REGS regs;
+    while (Length-- > 0)
+    {
+        if (Direct)
+        {
+            PutChar( *s++, Attr );
+        }
+        else
+        {
+            BiosWrite( *s++, Attr );
+        }
+    }
+
+    if (Direct)
+    {
+        /* Once per line is enough */
+        MoveCursor();
+    }
+}
+
+static VOID VgaShowCursor( CONSOLE* Console, BOOL Show )
+{
+    REGS  regs;
+    UCHAR Start;
+
+    if (Direct)
+    {
+        outb( CrtcPort, CRTC_CURSOR_START );
+        Start = inb( CrtcPort + 1 ) & ~CURSOR_DISABLE;
+        outb( CrtcPort + 1, (Show) ? Start : Start | CURSOR_DISABLE );
+        return;
+    }
 
     regs.h.ah = 3;
     regs.h.bh = 0;
@@ -45,10 +177,18 @@ VOID ShowCursor( BOOL Show )
     int86( 0x10, &regs, &regs );
 }
 
-VOID GotoXY( ULONG X, ULONG Y )
+static VOID VgaGotoXY( CONSOLE* Console, ULONG X, ULONG Y )
 {
     REGS regs;
 
+    if (Direct)
+    {
+        CursorX = MIN( X, Columns - 1 );
+        CursorY = MIN( Y, Rows - 1 );
+        MoveCursor();
+        return;
+    }
+
     regs.h.ah = 2;
     regs.h.bh = 0;
     regs.h.dl = X;
@@ -57,27 +197,82 @@ VOID GotoXY( ULONG X, ULONG Y )
     int86( 0x10, &regs, &regs );
 }
 
-VOID ClearScreen( VOID )
+static VOID VgaClear( CONSOLE* Console, UCHAR Attr )
 {
-    REGS regs;
+    REGS  regs;
+    ULONG i;
 
-    regs.h.ah = 6;
-    regs.h.al = 0;
-    regs.h.bh = Attr;
-    regs.x.cx = 0;
-    regs.x.dx = 0x1850;
-    int86( 0x10, &regs, &regs );
+    if (Direct)
+    {
+        for (i = 0; i < Rows * Columns; i++)
+        {
+            PutCell( i, (Attr << 8) | ' ' );
+        }
+    }
+    else
+    {
+        regs.h.ah = 6;
+        regs.h.al = 0;
+        regs.h.bh = Attr;
+        regs.x.cx = 0;
+        regs.x.dx = 0x1850;
+        int86( 0x10, &regs, &regs );
+    }
 
-    GotoXY( 0, 0 );
+    VgaGotoXY( Console, 0, 0 );
 }
 
-VOID SetBkColor( UCHAR color )
-{
-    Attr = (Attr & 0x0F) | (color << 4);
-}
+static CONSOLE VgaConsole = { VgaWrite, VgaGotoXY, VgaClear, VgaShowCursor, NULL, NULL, NULL };
 
-VOID SetTextColor( UCHAR color )
+VOID VideoInitialize( VOID )
 {
-    Attr = (Attr & 0xF0) | (color & 0x0F);
-}
+    REGS  regs;
+    UCHAR Mode;
+    ULONG i;
+
+    /* Get the video mode and number of columns */
+    regs.h.ah = 0x0F;
+    int86( 0x10, &regs, &regs );
+
+    AddConsole( &VgaConsole );
+
+    Direct   = FALSE;
+    Mode     = regs.h.al & 0x7F;
+    Columns  = regs.h.ah;
+    Screen   = (USHORT*)((Mode == 7) ? 0xB0000 : 0xB8000);
+    CrtcPort = (Mode == 7) ? 0x3B4 : 0x3D4;
+
+    if ((Mode > 3) && (Mode != 7))
+    {
+        /* Not a text mode */
+        return;
+    }
+
+    /* Get the number of rows from the font information (EGA and up) */
+    regs.x.ax = 0x1130;
+    regs.h.bh = 0;
+    regs.h.dl = 0;
+    int86( 0x10, &regs, &regs );
+    Rows = (regs.h.dl != 0) ? regs.h.dl + 1 : 25;
+
+    if ((Columns == 0) || (Columns > MAX_COLUMNS) || (Rows > MAX_ROWS))
+    {
+        return;
+    }
+
+    /* Start where the BIOS left the cursor */
+    regs.h.ah = 3;
+    regs.h.bh = 0;
+    int86( 0x10, &regs, &regs );
+    CursorX = MIN( regs.h.dl, Columns - 1 );
+    CursorY = MIN( regs.h.dh, Rows - 1 );
 
+    /* Video memory is slow to read, so this is the only time we do */
+    for (i = 0; i < Columns * Rows; i++)
+    {
+        Shadow[i] = Screen[i];
+    }
+
+    BiosCursor = (USHORT*)0x450;
+    Direct     = TRUE;
+}
@@ -0,0 +1,614 @@
+#include <disk.h>
+#include <pci.h>
+#include <port.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VIRTIO_VENDOR           0x1AF4
+#define VIRTIO_BLK_TRANSITIONAL 0x1001  /* Legacy and modern interface */
+#define VIRTIO_BLK_MODERN       0x1042
+
+/* Memory mapped registers */
+#define REG8(base, ofs)         (*(volatile UCHAR*) ((CHAR*)(base) + (ofs)))
+#define REG16(base, ofs)        (*(volatile USHORT*)((CHAR*)(base) + (ofs)))
+#define REG32(base, ofs)        (*(volatile ULONG*) ((CHAR*)(base) + (ofs)))
+
+/* Legacy registers, in I/O space */
+#define LEGACY_HOST_FEATURES    0x00
+#define LEGACY_GUEST_FEATURES   0x04
+#define LEGACY_QUEUE_PFN        0x08
+#define LEGACY_QUEUE_SIZE       0x0C
+#define LEGACY_QUEUE_SELECT     0x0E
+#define LEGACY_QUEUE_NOTIFY     0x10
+#define LEGACY_STATUS           0x12
+#define LEGACY_CONFIG           0x14    /* Without MSI-X */
+
+/* Modern common configuration */
+#define COMMON_DF_SELECT        0x00
+#define COMMON_DF               0x04
+#define COMMON_GF_SELECT        0x08
+#define COMMON_GF               0x0C
+#define COMMON_STATUS           0x14
+#define COMMON_Q_SELECT         0x16
+#define COMMON_Q_SIZE           0x18
+#define COMMON_Q_ENABLE         0x1C
+#define COMMON_Q_NOTIFY_OFF     0x1E
+#define COMMON_Q_DESC           0x20
+#define COMMON_Q_AVAIL          0x28
+#define COMMON_Q_USED           0x30
+
+/* Modern capability types */
+#define VIRTIO_CAP_COMMON       1
+#define VIRTIO_CAP_NOTIFY       2
+#define VIRTIO_CAP_DEVICE       4
+
+/* Device status */
+#define STATUS_ACKNOWLEDGE      0x01
+#define STATUS_DRIVER           0x02
+#define STATUS_DRIVER_OK        0x04
+#define STATUS_FEATURES_OK      0x08
+
+/* Feature bits */
+#define VIRTIO_BLK_F_SIZE_MAX   0x00000002
+#define VIRTIO_BLK_F_SEG_MAX    0x00000004
+#define VIRTIO_F_VERSION_1      0x00000001  /* In the second feature word */
+
+/* Block device configuration */
+#define BLK_CAPACITY            0x00
+#define BLK_SIZE_MAX            0x08
+#define BLK_SEG_MAX             0x0C
+
+#define VIRTIO_BLK_T_IN         0
+#define VIRTIO_PAGE_SIZE        4096
+
+#define VRING_DESC_F_NEXT       1
+#define VRING_DESC_F_WRITE      2
+
+#define VIRTIO_MAX_QUEUE        1024        /* Largest ring we set up              */
+#define VIRTIO_MAX_SEGMENTS     4           /* Data descriptors per request        */
+#define VIRTIO_SLOT_DESCS       (VIRTIO_MAX_SEGMENTS + 2)
+#define VIRTIO_SLOTS            16          /* Most requests in flight             */
+#define VIRTIO_REQUEST_BYTES    0x40000     /* Most bytes per request              */
+#define VIRTIO_TIMEOUT          0x1000000   /* Ring polls before giving up         */
+
+typedef struct _VRING_DESC
+{
+    ULONGLONG Address;
+    ULONG     Length;
+    USHORT    Flags;
+    USHORT    Next;
+} VRING_DESC;
+
+typedef struct _VRING_AVAIL
+{
+    USHORT Flags;
+    USHORT Index;
+    USHORT Ring[1];
+} VRING_AVAIL;
+
+typedef struct _VRING_USED_ELEM
+{
+    ULONG Id;
+    ULONG Length;
+} VRING_USED_ELEM;
+
+typedef struct _VRING_USED
+{
+    USHORT          Flags;
+    USHORT          Index;
+    VRING_USED_ELEM Ring[1];
+} VRING_USED;
+
+typedef struct _VIRTIO_BLK_REQUEST
+{
+    ULONG     Type;
+    ULONG     Reserved;
+    ULONGLONG Sector;
+} VIRTIO_BLK_REQUEST;
+
+typedef struct _VIRTIO_BLK
+{
+    DISK                  Disk;
+    USHORT                IoBase;       /* Legacy interface, or 0   */
+    CHAR*                 Common;       /* Modern interface         */
+    CHAR*                 Device;
+    volatile USHORT*      Notify;
+    volatile VRING_DESC*  Desc;
+    volatile VRING_AVAIL* Avail;
+    volatile VRING_USED*  Used;
+    ULONG                 QueueSize;
+    USHORT                LastUsed;
+    VIRTIO_BLK_REQUEST*   Requests;     /* One per slot             */
+    volatile UCHAR*       Status;       /* One per slot             */
+    ULONG                 nSlots;
+    ULONG                 SegmentSize;  /* Most bytes per data descriptor */
+    ULONG                 RequestSize;  /* Most bytes per request   */
+    BOOL                  isFailed;
+
+    /* Submitted requests, by slot */
+    ULONG                 Busy;
+    ULONG                 Done;
+    ULONG                 Count[ VIRTIO_SLOTS ];    /* Sectors, 0 if the request failed */
+} VIRTIO_BLK;
+
+static ULONG ReadConfig32( VIRTIO_BLK* Blk, ULONG Offset )
+{
+    return (Blk->IoBase != 0) ? inl( Blk->IoBase + LEGACY_CONFIG + Offset ) : REG32( Blk->Device, Offset );
+}
+
+static VOID SetStatus( VIRTIO_BLK* Blk, UCHAR Status )
+{
+    if (Blk->IoBase != 0)
+    {
+        outb( Blk->IoBase + LEGACY_STATUS, Status );
+    }
+    else
+    {
+        REG8( Blk->Common, COMMON_STATUS ) = Status;
+    }
+}
+
+static UCHAR GetStatus( VIRTIO_BLK* Blk )
+{
+    return (Blk->IoBase != 0) ? inb( Blk->IoBase + LEGACY_STATUS ) : REG8( Blk->Common, COMMON_STATUS );
+}
+
+/* Returns the ring memory size and the offset of the used ring for @Size entries */
+static ULONG RingSize( ULONG Size, ULONG* UsedOffset )
+{
+    *UsedOffset = (Size * sizeof(VRING_DESC) + 6 + 2 * Size + VIRTIO_PAGE_SIZE - 1) & -VIRTIO_PAGE_SIZE;
+    return *UsedOffset + 6 + Size * sizeof(VRING_USED_ELEM);
+}
+
+/* Allocates the ring of queue 0 in the layout legacy devices expect; modern ones take it too */
+static BOOL AllocateRing( VIRTIO_BLK* Blk )
+{
+    ULONG UsedOffset;
+    ULONG Size = RingSize( Blk->QueueSize, &UsedOffset );
+    CHAR* Ring = memalign( VIRTIO_PAGE_SIZE, Size );
+
+    if (Ring == NULL)
+    {
+        return FALSE;
+    }
+
+    memset( Ring, 0, Size );
+    Blk->Desc     = (VRING_DESC*)Ring;
+    Blk->Avail    = (VRING_AVAIL*)(Ring + Blk->QueueSize * sizeof(VRING_DESC));
+    Blk->Used     = (VRING_USED*)(Ring + UsedOffset);
+    Blk->LastUsed = 0;
+    return TRUE;
+}
+
+static BOOL SetupLegacy( VIRTIO_BLK* Blk )
+{
+    ULONG Features = inl( Blk->IoBase + LEGACY_HOST_FEATURES ) & (VIRTIO_BLK_F_SIZE_MAX | VIRTIO_BLK_F_SEG_MAX);
+
+    outl( Blk->IoBase + LEGACY_GUEST_FEATURES, Features );
+
+    outw( Blk->IoBase + LEGACY_QUEUE_SELECT, 0 );
+    Blk->QueueSize = inw( Blk->IoBase + LEGACY_QUEUE_SIZE );
+    if ((Blk->QueueSize == 0) || (Blk->QueueSize > VIRTIO_MAX_QUEUE) || (!AllocateRing( Blk )))
+    {
+        /* Legacy devices dictate the ring size */
+        return FALSE;
+    }
+
+    outl( Blk->IoBase + LEGACY_QUEUE_PFN, (ULONG)Blk->Desc / VIRTIO_PAGE_SIZE );
+    return TRUE;
+}
+
+/* Finds the structures of a modern device through its vendor capabilities */
+static BOOL FindModernStructures( PCI_DEVICE* Pci, VIRTIO_BLK* Blk, ULONG* NotifyMultiplier )
+{
+    UCHAR Cap = 0;
+
+    while ((Cap = PciFindCapability( Pci, PCI_CAP_VENDOR, Cap )) != 0)
+    {
+        UCHAR Type = PciRead8( Pci, Cap + 3 );
+        UCHAR Bar  = PciRead8( Pci, Cap + 4 );
+        CHAR* Base;
+
+        if ((Bar > 5) || (PciRead32( Pci, PCI_BAR0 + 4 * Bar ) & 1))
+        {
+            /* We only map memory BARs */
+            continue;
+        }
+
+        Base = (CHAR*)PciGetBar( Pci, Bar );
+        if (Base == NULL)
+        {
+            continue;
+        }
+        Base += PciRead32( Pci, Cap + 8 );
+
+        switch (Type)
+        {
+            case VIRTIO_CAP_COMMON:
+                Blk->Common = Base;
+                break;
+
+            case VIRTIO_CAP_NOTIFY:
+                Blk->Notify       = (volatile USHORT*)Base;
+                *NotifyMultiplier = PciRead32( Pci, Cap + 16 );
+                break;
+
+            case VIRTIO_CAP_DEVICE:
+                Blk->Device = Base;
+                break;
+        }
+    }
+
+    return (Blk->Common != NULL) && (Blk->Notify != NULL) && (Blk->Device != NULL);
+}
+
+static BOOL SetupModern( VIRTIO_BLK* Blk, ULONG NotifyMultiplier )
+{
+    ULONG Features;
+
+    REG32( Blk->Common, COMMON_DF_SELECT ) = 1;
+    if (~REG32( Blk->Common, COMMON_DF ) & VIRTIO_F_VERSION_1)
+    {
+        return FALSE;
+    }
+
+    REG32( Blk->Common, COMMON_DF_SELECT ) = 0;
+    Features = REG32( Blk->Common, COMMON_DF ) & (VIRTIO_BLK_F_SIZE_MAX | VIRTIO_BLK_F_SEG_MAX);
+
+    REG32( Blk->Common, COMMON_GF_SELECT ) = 0;
+    REG32( Blk->Common, COMMON_GF )        = Features;
+    REG32( Blk->Common, COMMON_GF_SELECT ) = 1;
+    REG32( Blk->Common, COMMON_GF )        = VIRTIO_F_VERSION_1;
+
+    SetStatus( Blk, STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_FEATURES_OK );
+    if (~GetStatus( Blk ) & STATUS_FEATURES_OK)
+    {
+        /* The device didn't like our features */
+        return FALSE;
+    }
+
+    REG16( Blk->Common, COMMON_Q_SELECT ) = 0;
+    Blk->QueueSize = MIN( REG16( Blk->Common, COMMON_Q_SIZE ), VIRTIO_MAX_QUEUE );
+    if ((Blk->QueueSize == 0) || (!AllocateRing( Blk )))
+    {
+        return FALSE;
+    }
+
+    REG16( Blk->Common, COMMON_Q_SIZE )       = Blk->QueueSize;
+    REG32( Blk->Common, COMMON_Q_DESC )       = (ULONG)Blk->Desc;
+    REG32( Blk->Common, COMMON_Q_DESC + 4 )   = 0;
+    REG32( Blk->Common, COMMON_Q_AVAIL )      = (ULONG)Blk->Avail;
+    REG32( Blk->Common, COMMON_Q_AVAIL + 4 )  = 0;
+    REG32( Blk->Common, COMMON_Q_USED )       = (ULONG)Blk->Used;
+    REG32( Blk->Common, COMMON_Q_USED + 4 )   = 0;
+    REG16( Blk->Common, COMMON_Q_ENABLE )     = 1;
+
+    Blk->Notify = (volatile USHORT*)((CHAR*)Blk->Notify +
+                  REG16( Blk->Common, COMMON_Q_NOTIFY_OFF ) * NotifyMultiplier);
+    return TRUE;
+}
+
+/* Puts one request in the descriptors of @Slot. Returns the head descriptor */
+static USHORT BuildRequest( VIRTIO_BLK* Blk, ULONG Slot, ULONGLONG Sector, CHAR* Buffer, ULONG nBytes )
+{
+    USHORT Head = Slot * VIRTIO_SLOT_DESCS;
+    USHORT d    = Head;
+
+    Blk->Requests[ Slot ].Type     = VIRTIO_BLK_T_IN;
+    Blk->Requests[ Slot ].Reserved = 0;
+    Blk->Requests[ Slot ].Sector   = Sector;
+    Blk->Status[ Slot ]            = 0xFF;
+
+    Blk->Desc[d].Address = (ULONG)&Blk->Requests[ Slot ];
+    Blk->Desc[d].Length  = sizeof(VIRTIO_BLK_REQUEST);
+    Blk->Desc[d].Flags   = VRING_DESC_F_NEXT;
+    Blk->Desc[d].Next    = d + 1;
+    d++;
+
+    /* The data goes straight to its destination, in as few descriptors as allowed */
+    while (nBytes > 0)
+    {
+        ULONG Size = MIN( nBytes, Blk->SegmentSize );
+
+        Blk->Desc[d].Address = (ULONG)Buffer;
+        Blk->Desc[d].Length  = Size;
+        Blk->Desc[d].Flags   = VRING_DESC_F_WRITE | VRING_DESC_F_NEXT;
+        Blk->Desc[d].Next    = d + 1;
+        d++;
+
+        Buffer += Size;
+        nBytes -= Size;
+    }
+
+    Blk->Desc[d].Address = (ULONG)&Blk->Status[ Slot ];
+    Blk->Desc[d].Length  = 1;
+    Blk->Desc[d].Flags   = VRING_DESC_F_WRITE;
+    Blk->Desc[d].Next    = 0;
+
+    return Head;
+}
+
+/* Makes the available ring entries up to @Index visible and notifies the device */
+static VOID Publish( VIRTIO_BLK* Blk, USHORT Index )
+{
+    MemoryBarrier();
+    Blk->Avail->Index = Index;
+    MemoryBarrier();
+
+    if (Blk->IoBase != 0)
+    {
+        outw( Blk->IoBase + LEGACY_QUEUE_NOTIFY, 0 );
+    }
+    else
+    {
+        *Blk->Notify = 0;
+    }
+}
+
+/*
+ * Queues one request per chunk, up to nSlots of them, and notifies the device
+ * once, so the host can work on all of them in a single exit.
+ */
+static ULONG VirtioRead( DISK* Disk, ULONGLONG Sector, ULONG nSectors, VOID* Buffer )
+{
+    VIRTIO_BLK* Blk    = Disk->Data;
+    ULONG       nChunk = Blk->RequestSize / Disk->nBytesPerSector;
+    USHORT      Avail  = Blk->Avail->Index;
+    ULONG       Done   = 0;
+    ULONG       Read   = 0;
+    ULONG       nPending;
+    ULONG       Slot;
+    ULONG       i;
+
+    if ((Blk->isFailed) || (nSectors == 0) || (nSectors > Disk->MaxTransfer) ||
+        (Sector + nSectors > Disk->nTotalSectors))
+    {
+        return 0;
+    }
+
+    for (Slot = 0; Slot * nChunk < nSectors; Slot++)
+    {
+        ULONG count = MIN( nSectors - Slot * nChunk, nChunk );
+
+        Blk->Avail->Ring[ (USHORT)(Avail + Slot) % Blk->QueueSize ] =
+            BuildRequest( Blk, Slot, Sector + Slot * nChunk,
+                          (CHAR*)Buffer + Slot * nChunk * Disk->nBytesPerSector, count * Disk->nBytesPerSector );
+    }
+
+    Publish( Blk, Avail + Slot );
+
+    for (nPending = Slot, i = 0; (nPending > 0) && (i < VIRTIO_TIMEOUT); i++)
+    {
+        while ((nPending > 0) && (Blk->Used->Index != Blk->LastUsed))
+        {
+            ULONG Id = Blk->Used->Ring[ Blk->LastUsed % Blk->QueueSize ].Id / VIRTIO_SLOT_DESCS;
+
+            if ((Id < Slot) && (Blk->Status[ Id ] == 0))
+            {
+                Done |= 1UL << Id;
+            }
+
+            Blk->LastUsed++;
+            nPending--;
+        }
+    }
+
+    if (nPending > 0)
+    {
+        /* The requests may still complete later, the ring is no longer usable */
+        Blk->isFailed = TRUE;
+        return 0;
+    }
+
+    /* Only count the chunks up to the first one that failed */
+    for (Slot = 0; (Read < nSectors) && (Done & (1UL << Slot)); Slot++)
+    {
+        Read += MIN( nSectors - Read, nChunk );
+    }
+
+    return Read;
+}
+
+/* Queues a request in a free slot, which is also its tag */
+static INT VirtioSubmit( DISK* Disk, ULONGLONG Sector, ULONG nSectors, VOID* Buffer )
+{
+    VIRTIO_BLK* Blk   = Disk->Data;
+    USHORT      Avail = Blk->Avail->Index;
+    ULONG       Slot;
+
+    if ((Blk->isFailed) || (nSectors == 0) || (nSectors > Disk->MaxSubmit) ||
+        (Sector + nSectors > Disk->nTotalSectors))
+    {
+        return -1;
+    }
+
+    for (Slot = 0; (Slot < Blk->nSlots) && (Blk->Busy & (1UL << Slot)); Slot++);
+    if (Slot == Blk->nSlots)
+    {
+        return -1;
+    }
+
+    Blk->Avail->Ring[ Avail % Blk->QueueSize ] = BuildRequest( Blk, Slot, Sector, Buffer,
+                                                               nSectors * Disk->nBytesPerSector );
+    Publish( Blk, Avail + 1 );
+
+    Blk->Busy          |= 1UL << Slot;
+    Blk->Count[ Slot ]  = nSectors;
+    return Slot;
+}
+
+/* Marks the submitted requests the device has returned as done */
+static VOID ReapUsed( VIRTIO_BLK* Blk )
+{
+    ULONG Slot;
+
+    /* The device returns requests in whatever order it finished them */
+    while (Blk->Used->Index != Blk->LastUsed)
+    {
+        Slot = Blk->Used->Ring[ Blk->LastUsed % Blk->QueueSize ].Id / VIRTIO_SLOT_DESCS;
+
+        if ((Slot < Blk->nSlots) && (Blk->Busy & (1UL << Slot)))
+        {
+            Blk->Done |= 1UL << Slot;
+            if (Blk->Status[ Slot ] != 0)
+            {
+                Blk->Count[ Slot ] = 0;
+            }
+        }
+
+        Blk->LastUsed++;
+    }
+}
+
+static INT VirtioPoll( DISK* Disk, ULONG* nRead )
+{
+    VIRTIO_BLK* Blk = Disk->Data;
+    ULONG       Slot;
+
+    ReapUsed( Blk );
+
+    for (Slot = 0; Slot < Blk->nSlots; Slot++)
+    {
+        if (Blk->Done & (1UL << Slot))
+        {
+            Blk->Busy &= ~(1UL << Slot);
+            Blk->Done &= ~(1UL << Slot);
+            *nRead = Blk->Count[ Slot ];
+            return Slot;
+        }
+    }
+
+    return -1;
+}
+
+static VOID VirtioAbort( DISK* Disk )
+{
+    VIRTIO_BLK* Blk = Disk->Data;
+
+    /* Requests that completed but weren't polled yet aren't lost */
+    ReapUsed( Blk );
+
+    if (Blk->Busy & ~Blk->Done)
+    {
+        /* The requests may still complete later, the ring is no longer usable */
+        Blk->isFailed = TRUE;
+    }
+
+    Blk->Busy = 0;
+    Blk->Done = 0;
+}
+
+/*
+ * Registers a virtio block device, through the modern interface if it has
+ * one and the legacy one otherwise. The device is reset in the process,
+ * which leaves it unusable for the BIOS.
+ */
+static BOOL VirtioStart( PCI_DEVICE* Pci, BOOL* isReset )
+{
+    VIRTIO_BLK* Blk = malloc( sizeof(VIRTIO_BLK) );
+    ULONG       NotifyMultiplier = 0;
+    ULONG       Features;
+    BOOL        isReady;
+
+    if (Blk == NULL)
+    {
+        return FALSE;
+    }
+
+    memset( Blk, 0, sizeof(VIRTIO_BLK) );
+    PciEnable( Pci, PCI_COMMAND_IO | PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER );
+
+    if (!FindModernStructures( Pci, Blk, &NotifyMultiplier ))
+    {
+        Blk->Common = NULL;
+        if ((Pci->DeviceId != VIRTIO_BLK_TRANSITIONAL) || (~PciRead32( Pci, PCI_BAR0 ) & 1))
+        {
+            free( Blk );
+            return FALSE;
+        }
+        Blk->IoBase = PciGetBar( Pci, 0 );
+    }
+
+    /* Reset, then tell the device we know how to drive it */
+    *isReset = TRUE;
+    SetStatus( Blk, 0 );
+    SetStatus( Blk, STATUS_ACKNOWLEDGE | STATUS_DRIVER );
+
+    isReady = (Blk->IoBase != 0) ? SetupLegacy( Blk ) : SetupModern( Blk, NotifyMultiplier );
+
+    /* Only the features we asked for are in effect */
+    if (Blk->IoBase != 0)
+    {
+        Features = inl( Blk->IoBase + LEGACY_GUEST_FEATURES );
+    }
+    else
+    {
+        REG32( Blk->Common, COMMON_GF_SELECT ) = 0;
+        Features = REG32( Blk->Common, COMMON_GF );
+    }
+
+    Blk->SegmentSize = VIRTIO_REQUEST_BYTES;
+    if ((Features & VIRTIO_BLK_F_SIZE_MAX) && (ReadConfig32( Blk, BLK_SIZE_MAX ) >= 512))
+    {
+        Blk->SegmentSize = MIN( Blk->SegmentSize, ReadConfig32( Blk, BLK_SIZE_MAX ) & -512 );
+    }
+
+    Blk->RequestSize = Blk->SegmentSize * VIRTIO_MAX_SEGMENTS;
+    if ((Features & VIRTIO_BLK_F_SEG_MAX) && (ReadConfig32( Blk, BLK_SEG_MAX ) > 0))
+    {
+        Blk->RequestSize = Blk->SegmentSize * MIN( ReadConfig32( Blk, BLK_SEG_MAX ), VIRTIO_MAX_SEGMENTS );
+    }
+    Blk->RequestSize = MIN( Blk->RequestSize, VIRTIO_REQUEST_BYTES );
+
+    Blk->nSlots   = MIN( VIRTIO_SLOTS, Blk->QueueSize / VIRTIO_SLOT_DESCS );
+    Blk->Requests = malloc( Blk->nSlots * sizeof(VIRTIO_BLK_REQUEST) );
+    Blk->Status   = malloc( Blk->nSlots );
+
+    if ((!isReady) || (Blk->nSlots == 0) || (Blk->Requests == NULL) || (Blk->Status == NULL))
+    {
+        SetStatus( Blk, 0 );
+        free( (VOID*)Blk->Status );
+        free( Blk->Requests );
+        free( (VOID*)Blk->Desc );
+        free( Blk );
+        return FALSE;
+    }
+
+    SetStatus( Blk, GetStatus( Blk ) | STATUS_DRIVER_OK );
+
+    /* Virtio block sectors are always 512 bytes */
+    Blk->Disk.Read            = VirtioRead;
+    Blk->Disk.Submit          = VirtioSubmit;
+    Blk->Disk.Poll            = VirtioPoll;
+    Blk->Disk.Abort           = VirtioAbort;
+    Blk->Disk.nTotalSectors   = ReadConfig32( Blk, BLK_CAPACITY ) |
+                                ((ULONGLONG)ReadConfig32( Blk, BLK_CAPACITY + 4 ) << 32);
+    Blk->Disk.nBytesPerSector = 512;
+    Blk->Disk.MaxTransfer     = Blk->nSlots * (Blk->RequestSize / 512);
+    Blk->Disk.MaxSubmit       = Blk->RequestSize / 512;
+    Blk->Disk.Alignment       = 1;
+    Blk->Disk.Pci             = *Pci;
+    Blk->Disk.Data            = Blk;
+
+    RegisterDisk( &Blk->Disk );
+    return TRUE;
+}
+
+/*
+ * Finds all virtio block devices.
+ */
+VOID VirtioProbe( VOID )
+{
+    PCI_DEVICE Pci;
+    ULONG      Index;
+
+    for (Index = 0; PciFindDevice( VIRTIO_VENDOR, VIRTIO_BLK_TRANSITIONAL, Index, &Pci ); Index++)
+    {
+        RegisterController( &Pci, VirtioStart );
+    }
+
+    for (Index = 0; PciFindDevice( VIRTIO_VENDOR, VIRTIO_BLK_MODERN, Index, &Pci ); Index++)
+    {
+        RegisterController( &Pci, VirtioStart );
+    }
+}
@@ -0,0 +1,954 @@
+#include <disk.h>
+#include <pci.h>
+#include <port.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Memory mapped registers */
+#define REG8(base, ofs)         (*(volatile UCHAR*)((CHAR*)(base) + (ofs)))
+#define REG32(base, ofs)        (*(volatile ULONG*)((CHAR*)(base) + (ofs)))
+
+/* Capability registers */
+#define CAP_LENGTH              0x00
+#define CAP_HCSPARAMS1          0x04
+#define CAP_HCSPARAMS2          0x08
+#define CAP_HCCPARAMS1          0x10
+#define CAP_DBOFF               0x14
+#define CAP_RTSOFF              0x18
+
+#define HCS1_MAX_SLOTS(p)       ((p) & 0xFF)
+#define HCS1_MAX_PORTS(p)       ((p) >> 24)
+#define HCS2_SCRATCHPADS(p)     ((((p) >> 16) & 0x3E0) | (((p) >> 27) & 0x1F))
+#define HCC1_CONTEXT_64         0x00000004
+#define HCC1_XECP(p)            (((p) >> 16) << 2)
+
+/* Operational registers */
+#define OP_USBCMD               0x00
+#define OP_USBSTS               0x04
+#define OP_CRCR                 0x18
+#define OP_CRCR_HIGH            0x1C
+#define OP_DCBAAP               0x30
+#define OP_DCBAAP_HIGH          0x34
+#define OP_CONFIG               0x38
+#define OP_PORTSC(n)            (0x400 + 0x10 * ((n) - 1))
+
+#define USBCMD_RUN              0x00000001
+#define USBCMD_RESET            0x00000002
+#define USBSTS_HALTED           0x00000001
+#define USBSTS_NOT_READY        0x00000800
+
+#define SLOT_ROUTE_STRING       0x000FFFFF  /* Slot context dword 0 */
+#define SLOT_HUB                0x04000000
+
+#define PORTSC_CONNECTED        0x00000001
+#define PORTSC_ENABLED          0x00000002
+#define PORTSC_RESET            0x00000010
+#define PORTSC_SPEED(sc)        (((sc) >> 10) & 0xF)
+#define PORTSC_RESET_CHANGE     0x00200000
+#define PORTSC_PRESERVE         0x4E00FFE9  /* Writing these back changes nothing */
+
+/* Interrupter 0 in the runtime registers */
+#define IR0_ERSTSZ              0x28
+#define IR0_ERSTBA              0x30
+#define IR0_ERSTBA_HIGH         0x34
+#define IR0_ERDP                0x38
+#define IR0_ERDP_HIGH           0x3C
+#define ERDP_BUSY               0x00000008
+
+/* USB legacy support capability */
+#define XECP_LEGACY             1
+#define LEGACY_BIOS_OWNED       0x00010000
+#define LEGACY_OS_OWNED         0x01000000
+#define LEGACY_SMI_DISABLE      0x000E1FEE  /* Keeps the RsvdP bits, clears the enables */
+#define LEGACY_SMI_EVENTS       0xE0000000
+
+/* TRB types and flags */
+#define TRB_NORMAL              1
+#define TRB_SETUP               2
+#define TRB_DATA                3
+#define TRB_STATUS              4
+#define TRB_LINK                6
+#define TRB_ENABLE_SLOT         9
+#define TRB_ADDRESS_DEVICE      11
+#define TRB_CONFIGURE_EP        12
+#define TRB_RESET_EP            14
+#define TRB_SET_DEQUEUE         16
+#define TRB_TRANSFER_EVENT      32
+#define TRB_COMMAND_EVENT       33
+
+#define TRB_TYPE(t)             ((t) << 10)
+#define TRB_GET_TYPE(c)         (((c) >> 10) & 0x3F)
+#define TRB_CYCLE               0x00000001
+#define TRB_TOGGLE              0x00000002  /* Link TRBs */
+#define TRB_CHAIN               0x00000010
+#define TRB_IOC                 0x00000020
+#define TRB_IDT                 0x00000040
+#define TRB_DIR_IN              0x00010000
+#define TRB_SLOT(s)             ((ULONG)(s) << 24)
+#define TRB_ENDPOINT(e)         ((ULONG)(e) << 16)
+#define TRB_CODE(status)        ((status) >> 24)
+
+#define CODE_SUCCESS            1
+#define CODE_STALL              6
+#define CODE_SHORT_PACKET       13
+
+/* Context fields */
+#define EP_TYPE_BULK_OUT        2
+#define EP_TYPE_CONTROL         4
+#define EP_TYPE_BULK_IN         6
+
+#define SPEED_LOW               2
+#define SPEED_SUPER             4
+
+/* USB requests */
+#define USB_GET_DESCRIPTOR      6
+#define USB_SET_CONFIGURATION   9
+#define USB_CLEAR_FEATURE       1
+#define USB_DESC_DEVICE         1
+#define USB_DESC_CONFIG         2
+#define USB_DESC_INTERFACE      4
+#define USB_DESC_ENDPOINT       5
+#define BOT_RESET               0xFF
+
+/* Mass storage class, SCSI transparent command set, bulk-only transport */
+#define USB_CLASS_STORAGE       0x08
+#define USB_SUBCLASS_SCSI       0x06
+#define USB_PROTOCOL_BOT        0x50
+
+#define CBW_SIGNATURE           0x43425355
+#define CSW_SIGNATURE           0x53425355
+#define CBW_DATA_IN             0x80
+
+/* SCSI commands */
+#define SCSI_TEST_UNIT_READY    0x00
+#define SCSI_REQUEST_SENSE      0x03
+#define SCSI_READ_CAPACITY      0x25
+#define SCSI_READ_10            0x28
+#define SCSI_READ_16            0x88
+#define SCSI_READ_CAPACITY_16   0x9E
+
+#define XHCI_MAX_SLOTS          8
+#define XHCI_MAX_SCRATCHPADS    16
+#define XHCI_RING_SIZE          64          /* TRBs in command, event and control rings */
+#define XHCI_BULK_RING_SIZE     256
+#define XHCI_MAX_TRANSFER       0x100000    /* Most bytes per SCSI read             */
+#define XHCI_SCRATCH_SIZE       512         /* Low buffer for descriptors and such  */
+#define XHCI_TIMEOUT            0x1000000   /* Register polls before giving up      */
+#define XHCI_SETTLE             0x100000    /* Polls for devices to connect after a reset */
+
+typedef struct _XHCI_TRB
+{
+    ULONG Param[2];
+    ULONG Status;
+    ULONG Control;
+} XHCI_TRB;
+
+typedef struct _XHCI_RING
+{
+    volatile XHCI_TRB* Trbs;
+    ULONG              Size;
+    ULONG              Index;
+    ULONG              Cycle;
+} XHCI_RING;
+
+typedef struct _XHCI_CONTROLLER
+{
+    CHAR*              Op;
+    CHAR*              Runtime;
+    CHAR*              Doorbells;
+    ULONG              ContextSize;
+    ULONG*             Dcbaa;       /* 64-bit entries */
+    XHCI_RING          Command;
+    volatile XHCI_TRB* Events;
+    ULONG              EventIndex;
+    ULONG              EventCycle;
+} XHCI_CONTROLLER;
+
+typedef struct _USB_CBW
+{
+    ULONG Signature;
+    ULONG Tag;
+    ULONG DataLength;
+    UCHAR Flags;
+    UCHAR Lun;
+    UCHAR CbLength;
+    UCHAR Cb[16];
+} PACKED USB_CBW;
+
+typedef struct _USB_CSW
+{
+    ULONG Signature;
+    ULONG Tag;
+    ULONG Residue;
+    UCHAR Status;
+} PACKED USB_CSW;
+
+typedef struct _USB_DISK
+{
+    DISK             Disk;
+    XHCI_CONTROLLER* Ctrl;
+    ULONG            Slot;
+    ULONG            Port;
+    ULONG            Speed;
+    UCHAR*           Input;         /* Input context */
+    XHCI_RING        Ep0;
+    XHCI_RING        BulkIn;
+    XHCI_RING        BulkOut;
+    UCHAR            InAddress;
+    UCHAR            OutAddress;
+    USHORT           InPacket;
+    USHORT           OutPacket;
+    UCHAR            Interface;
+    ULONG            Tag;
+    USB_CBW*         Cbw;
+    USB_CSW*         Csw;
+    UCHAR*           Scratch;
+} USB_DISK;
+
+/* Device context index of an endpoint address */
+#define DCI(addr)               (2 * ((addr) & 0x0F) + (((addr) & 0x80) ? 1 : 0))
+
+static BOOL InitRing( XHCI_RING* Ring, ULONG Size )
+{
+    Ring->Trbs  = memalign( 64, Size * sizeof(XHCI_TRB) );
+    Ring->Size  = Size;
+    Ring->Index = 0;
+    Ring->Cycle = 1;
+
+    if (Ring->Trbs == NULL)
+    {
+        return FALSE;
+    }
+
+    memset( (VOID*)Ring->Trbs, 0, Size * sizeof(XHCI_TRB) );
+    return TRUE;
+}
+
+/* Writes a TRB on the ring, the cycle bit last so the controller never sees half a TRB */
+static VOID Enqueue( XHCI_RING* Ring, ULONG Param0, ULONG Param1, ULONG Status, ULONG Control )
+{
+    volatile XHCI_TRB* Trb = &Ring->Trbs[ Ring->Index ];
+
+    Trb->Param[0] = Param0;
+    Trb->Param[1] = Param1;
+    Trb->Status   = Status;
+    MemoryBarrier();
+    Trb->Control  = Control | Ring->Cycle;
+
+    if (++Ring->Index == Ring->Size - 1)
+    {
+        /* Link back to the start, a chained TD continues across the link */
+        Trb = &Ring->Trbs[ Ring->Index ];
+        Trb->Param[0] = (ULONG)Ring->Trbs;
+        Trb->Param[1] = 0;
+        Trb->Status   = 0;
+        MemoryBarrier();
+        Trb->Control  = TRB_TYPE(TRB_LINK) | TRB_TOGGLE | (Control & TRB_CHAIN) | Ring->Cycle;
+
+        Ring->Index  = 0;
+        Ring->Cycle ^= 1;
+    }
+}
+
+static VOID RingDoorbell( XHCI_CONTROLLER* Ctrl, ULONG Slot, ULONG Target )
+{
+    MemoryBarrier();
+    REG32( Ctrl->Doorbells, 4 * Slot ) = Target;
+}
+
+/* Waits for the next event of @Type, skipping others. Returns FALSE on timeout */
+static BOOL WaitEvent( XHCI_CONTROLLER* Ctrl, ULONG Type, XHCI_TRB* Event )
+{
+    ULONG i;
+
+    for (i = 0; i < XHCI_TIMEOUT; i++)
+    {
+        volatile XHCI_TRB* Trb = &Ctrl->Events[ Ctrl->EventIndex ];
+
+        if ((Trb->Control & TRB_CYCLE) != Ctrl->EventCycle)
+        {
+            continue;
+        }
+
+        Event->Param[0] = Trb->Param[0];
+        Event->Param[1] = Trb->Param[1];
+        Event->Status   = Trb->Status;
+        Event->Control  = Trb->Control;
+
+        if (++Ctrl->EventIndex == XHCI_RING_SIZE)
+        {
+            Ctrl->EventIndex  = 0;
+            Ctrl->EventCycle ^= 1;
+        }
+
+        /* Hand the event back to the controller */
+        REG32( Ctrl->Runtime, IR0_ERDP )      = (ULONG)&Ctrl->Events[ Ctrl->EventIndex ] | ERDP_BUSY;
+        REG32( Ctrl->Runtime, IR0_ERDP_HIGH ) = 0;
+
+        if (TRB_GET_TYPE( Event->Control ) == Type)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/* Runs a command. Returns the completion event's slot ID, or 0 on failure */
+static ULONG RunCommand( XHCI_CONTROLLER* Ctrl, ULONG Param0, ULONG Control )
+{
+    XHCI_TRB Event;
+
+    Enqueue( &Ctrl->Command, Param0, 0, 0, Control );
+    RingDoorbell( Ctrl, 0, 0 );
+
+    if ((!WaitEvent( Ctrl, TRB_COMMAND_EVENT, &Event )) || (TRB_CODE( Event.Status ) != CODE_SUCCESS))
+    {
+        return 0;
+    }
+
+    return MAX( Event.Control >> 24, 1 );
+}
+
+/* Rings the endpoint and waits for its transfer event. Returns the completion code */
+static ULONG RunTransfer( USB_DISK* Dev, ULONG Dci )
+{
+    XHCI_TRB Event;
+
+    RingDoorbell( Dev->Ctrl, Dev->Slot, Dci );
+    if (!WaitEvent( Dev->Ctrl, TRB_TRANSFER_EVENT, &Event ))
+    {
+        return 0;
+    }
+
+    return TRB_CODE( Event.Status );
+}
+
+static BOOL ControlTransfer( USB_DISK* Dev, UCHAR RequestType, UCHAR Request, USHORT Value, USHORT Index,
+                             USHORT Length, VOID* Data )
+{
+    BOOL  isIn = (RequestType & 0x80) != 0;
+    ULONG Code;
+
+    /* Transfer type: no data, OUT or IN data stage */
+    Enqueue( &Dev->Ep0, RequestType | (Request << 8) | ((ULONG)Value << 16), Index | ((ULONG)Length << 16), 8,
+             TRB_TYPE(TRB_SETUP) | TRB_IDT | ((Length == 0) ? 0 : (isIn ? 0x30000 : 0x20000)) );
+
+    if (Length > 0)
+    {
+        Enqueue( &Dev->Ep0, (ULONG)Data, 0, Length, TRB_TYPE(TRB_DATA) | (isIn ? TRB_DIR_IN : 0) );
+    }
+
+    /* The status stage goes the other way */
+    Enqueue( &Dev->Ep0, 0, 0, 0, TRB_TYPE(TRB_STATUS) | TRB_IOC | (((Length == 0) || (!isIn)) ? TRB_DIR_IN : 0) );
+
+    Code = RunTransfer( Dev, 1 );
+    return (Code == CODE_SUCCESS) || (Code == CODE_SHORT_PACKET);
+}
+
+/* Clears a halted bulk endpoint on both the controller and the device */
+static VOID ResetEndpoint( USB_DISK* Dev, XHCI_RING* Ring, UCHAR Address )
+{
+    ULONG Dci = DCI(Address);
+
+    RunCommand( Dev->Ctrl, 0, TRB_TYPE(TRB_RESET_EP) | TRB_SLOT(Dev->Slot) | TRB_ENDPOINT(Dci) );
+    RunCommand( Dev->Ctrl, (ULONG)&Ring->Trbs[ Ring->Index ] | Ring->Cycle,
+                TRB_TYPE(TRB_SET_DEQUEUE) | TRB_SLOT(Dev->Slot) | TRB_ENDPOINT(Dci) );
+    ControlTransfer( Dev, 0x02, USB_CLEAR_FEATURE, 0, Address, 0, NULL );
+}
+
+/* Bulk-only reset recovery, for when the device lost track of the protocol */
+static VOID ResetRecovery( USB_DISK* Dev )
+{
+    ControlTransfer( Dev, 0x21, BOT_RESET, 0, Dev->Interface, 0, NULL );
+    ResetEndpoint( Dev, &Dev->BulkIn,  Dev->InAddress );
+    ResetEndpoint( Dev, &Dev->BulkOut, Dev->OutAddress );
+}
+
+/*
+ * Moves @nBytes between @Buffer and a bulk endpoint. The buffer is described
+ * by as few TRBs as possible; they may not cross a 64 kB boundary.
+ * Returns the completion code.
+ */
+static ULONG BulkTransfer( USB_DISK* Dev, XHCI_RING* Ring, UCHAR Address, VOID* Buffer, ULONG nBytes )
+{
+    ULONG Address32 = (ULONG)Buffer;
+
+    while (nBytes > 0)
+    {
+        ULONG Size = MIN( nBytes, 0x10000 - (Address32 & 0xFFFF) );
+
+        nBytes -= Size;
+        Enqueue( Ring, Address32, 0, Size, TRB_TYPE(TRB_NORMAL) | ((nBytes > 0) ? TRB_CHAIN : TRB_IOC) );
+        Address32 += Size;
+    }
+
+    return RunTransfer( Dev, DCI(Address) );
+}
+
+/* Runs a SCSI command that reads @nBytes into @Data. Returns TRUE on success */
+static BOOL ScsiCommand( USB_DISK* Dev, UCHAR* Cdb, UCHAR CdbLength, VOID* Data, ULONG nBytes )
+{
+    ULONG Code;
+
+    memset( Dev->Cbw, 0, sizeof(USB_CBW) );
+    Dev->Cbw->Signature  = CBW_SIGNATURE;
+    Dev->Cbw->Tag        = ++Dev->Tag;
+    Dev->Cbw->DataLength = nBytes;
+    Dev->Cbw->Flags      = CBW_DATA_IN;
+    Dev->Cbw->CbLength   = CdbLength;
+    memcpy( Dev->Cbw->Cb, Cdb, CdbLength );
+
+    if (BulkTransfer( Dev, &Dev->BulkOut, Dev->OutAddress, Dev->Cbw, sizeof(USB_CBW) ) != CODE_SUCCESS)
+    {
+        ResetRecovery( Dev );
+        return FALSE;
+    }
+
+    if (nBytes > 0)
+    {
+        Code = BulkTransfer( Dev, &Dev->BulkIn, Dev->InAddress, Data, nBytes );
+        if (Code == CODE_STALL)
+        {
+            /* The device refuses the data, but still sends its status */
+            ResetEndpoint( Dev, &Dev->BulkIn, Dev->InAddress );
+        }
+        else if ((Code != CODE_SUCCESS) && (Code != CODE_SHORT_PACKET))
+        {
+            ResetRecovery( Dev );
+            return FALSE;
+        }
+    }
+
+    Code = BulkTransfer( Dev, &Dev->BulkIn, Dev->InAddress, Dev->Csw, sizeof(USB_CSW) );
+    if (Code == CODE_STALL)
+    {
+        /* One more try, as the spec says */
+        ResetEndpoint( Dev, &Dev->BulkIn, Dev->InAddress );
+        Code = BulkTransfer( Dev, &Dev->BulkIn, Dev->InAddress, Dev->Csw, sizeof(USB_CSW) );
+    }
+
+    if ((Code != CODE_SUCCESS) || (Dev->Csw->Signature != CSW_SIGNATURE) || (Dev->Csw->Tag != Dev->Tag))
+    {
+        ResetRecovery( Dev );
+        return FALSE;
+    }
+
+    return (Dev->Csw->Status == 0) && (Dev->Csw->Residue == 0);
+}
+
+static ULONG UsbRead( DISK* Disk, ULONGLONG Sector, ULONG nSectors, VOID* Buffer )
+{
+    USB_DISK* Dev = Disk->Data;
+    UCHAR     Cdb[16];
+    INT       i;
+
+    if ((nSectors == 0) || (nSectors > Disk->MaxTransfer) || (Sector + nSectors > Disk->nTotalSectors))
+    {
+        return 0;
+    }
+
+    memset( Cdb, 0, sizeof(Cdb) );
+    if (Sector + nSectors <= 0xFFFFFFFF)
+    {
+        Cdb[0] = SCSI_READ_10;
+        for (i = 0; i < 4; i++)
+        {
+            Cdb[2 + i] = (UCHAR)(Sector >> (24 - 8 * i));
+        }
+        Cdb[7] = HIBYTE(nSectors);
+        Cdb[8] = LOBYTE(nSectors);
+    }
+    else
+    {
+        Cdb[0] = SCSI_READ_16;
+        for (i = 0; i < 8; i++)
+        {
+            Cdb[2 + i] = (UCHAR)(Sector >> (56 - 8 * i));
+        }
+        Cdb[12] = HIBYTE(nSectors);
+        Cdb[13] = LOBYTE(nSectors);
+    }
+
+    return ScsiCommand( Dev, Cdb, (Cdb[0] == SCSI_READ_10) ? 10 : 16, Buffer, nSectors * Disk->nBytesPerSector )
+           ? nSectors : 0;
+}
+
+/* Reads a big-endian number of @n bytes */
+static ULONGLONG BigEndian( UCHAR* Data, INT n )
+{
+    ULONGLONG Value = 0;
+    INT       i;
+
+    for (i = 0; i < n; i++)
+    {
+        Value = (Value << 8) | Data[i];
+    }
+
+    return Value;
+}
+
+/* Asks the device for its size. Sticks may need a few tries before they're ready */
+static BOOL GetCapacity( USB_DISK* Dev )
+{
+    UCHAR Cdb[16];
+    INT   i;
+
+    for (i = 0; i < 5; i++)
+    {
+        memset( Cdb, 0, sizeof(Cdb) );
+        Cdb[0] = SCSI_TEST_UNIT_READY;
+        if (ScsiCommand( Dev, Cdb, 6, NULL, 0 ))
+        {
+            break;
+        }
+
+        /* Clears the unit attention condition */
+        Cdb[0] = SCSI_REQUEST_SENSE;
+        Cdb[4] = 18;
+        ScsiCommand( Dev, Cdb, 6, Dev->Scratch, 18 );
+    }
+
+    memset( Cdb, 0, sizeof(Cdb) );
+    Cdb[0] = SCSI_READ_CAPACITY;
+    if (!ScsiCommand( Dev, Cdb, 10, Dev->Scratch, 8 ))
+    {
+        return FALSE;
+    }
+
+    Dev->Disk.nTotalSectors   = BigEndian( Dev->Scratch, 4 ) + 1;
+    Dev->Disk.nBytesPerSector = BigEndian( Dev->Scratch + 4, 4 );
+
+    if (Dev->Disk.nTotalSectors == 0x100000000ULL)
+    {
+        /* Too big for READ CAPACITY(10) */
+        memset( Cdb, 0, sizeof(Cdb) );
+        Cdb[0]  = SCSI_READ_CAPACITY_16;
+        Cdb[1]  = 0x10;
+        Cdb[13] = 32;
+        if (!ScsiCommand( Dev, Cdb, 16, Dev->Scratch, 32 ))
+        {
+            return FALSE;
+        }
+
+        Dev->Disk.nTotalSectors   = BigEndian( Dev->Scratch, 8 ) + 1;
+        Dev->Disk.nBytesPerSector = BigEndian( Dev->Scratch + 8, 4 );
+    }
+
+    return (Dev->Disk.nBytesPerSector >= 512) && (Dev->Disk.nBytesPerSector <= 4096);
+}
+
+/* Fills in the endpoint context at @Context */
+static VOID SetEndpoint( ULONG* Context, ULONG Type, ULONG MaxPacket, XHCI_RING* Ring )
+{
+    Context[1] = (3 << 1) | (Type << 3) | (MaxPacket << 16);    /* Three retries */
+    Context[2] = (ULONG)Ring->Trbs | Ring->Cycle;
+    Context[3] = 0;
+    Context[4] = (Type == EP_TYPE_CONTROL) ? 8 : 3072;          /* Average TRB length */
+}
+
+/* Returns context @i of the input context */
+static ULONG* InputContext( USB_DISK* Dev, ULONG i )
+{
+    return (ULONG*)(Dev->Input + i * Dev->Ctrl->ContextSize);
+}
+
+/* Finds the first bulk-only mass storage interface in the configuration in Scratch */
+static BOOL ParseConfiguration( USB_DISK* Dev, ULONG Length )
+{
+    UCHAR* Desc;
+    BOOL   inInterface = FALSE;
+
+    for (Desc = Dev->Scratch; (Desc + 2 <= Dev->Scratch + Length) && (Desc[0] >= 2); Desc += Desc[0])
+    {
+        if (Desc[1] == USB_DESC_INTERFACE)
+        {
+            if (inInterface)
+            {
+                /* Past our interface */
+                break;
+            }
+
+            inInterface = (Desc[5] == USB_CLASS_STORAGE) && (Desc[6] == USB_SUBCLASS_SCSI) &&
+                          (Desc[7] == USB_PROTOCOL_BOT);
+            Dev->Interface = Desc[2];
+        }
+        else if ((Desc[1] == USB_DESC_ENDPOINT) && (inInterface) && ((Desc[3] & 3) == 2))
+        {
+            /* Bulk endpoint */
+            if (Desc[2] & 0x80)
+            {
+                Dev->InAddress = Desc[2];
+                Dev->InPacket  = (Desc[4] | (Desc[5] << 8)) & 0x7FF;
+            }
+            else
+            {
+                Dev->OutAddress = Desc[2];
+                Dev->OutPacket  = (Desc[4] | (Desc[5] << 8)) & 0x7FF;
+            }
+        }
+    }
+
+    return (Dev->InAddress != 0) && (Dev->OutAddress != 0);
+}
+
+/*
+ * Addresses the device on root hub port @Dev->Port and configures its bulk
+ * endpoints if it is a bulk-only mass storage device.
+ */
+static BOOL SetupDevice( USB_DISK* Dev, ULONG* Dcbaa )
+{
+    XHCI_CONTROLLER* Ctrl = Dev->Ctrl;
+    ULONG            nContext = 33 * Ctrl->ContextSize;
+    ULONG            MaxPacket0;
+    ULONG            Length;
+    UCHAR            Config;
+    VOID*            Output;
+
+    Dev->Slot = RunCommand( Ctrl, 0, TRB_TYPE(TRB_ENABLE_SLOT) );
+    if (Dev->Slot == 0)
+    {
+        return FALSE;
+    }
+
+    Output     = memalign( 64, nContext );
+    Dev->Input = memalign( 64, nContext );
+    if ((Output == NULL) || (Dev->Input == NULL) || (!InitRing( &Dev->Ep0, XHCI_RING_SIZE )))
+    {
+        return FALSE;
+    }
+
+    memset( Output, 0, nContext );
+    Dcbaa[ 2 * Dev->Slot ] = (ULONG)Output;
+
+    /*
+     * The default control pipe. Full speed devices may use less than 64 bytes
+     * per packet, but mass storage devices don't in practice.
+     */
+    MaxPacket0 = (Dev->Speed == SPEED_LOW) ? 8 : (Dev->Speed >= SPEED_SUPER) ? 512 : 64;
+
+    memset( Dev->Input, 0, nContext );
+    InputContext( Dev, 0 )[1] = 0x3;                                /* Add slot and EP0 */
+    InputContext( Dev, 1 )[0] = (1 << 27) | (Dev->Speed << 20);     /* One context entry */
+    InputContext( Dev, 1 )[1] = Dev->Port << 16;
+    SetEndpoint( InputContext( Dev, 2 ), EP_TYPE_CONTROL, MaxPacket0, &Dev->Ep0 );
+
+    if ((!RunCommand( Ctrl, (ULONG)Dev->Input, TRB_TYPE(TRB_ADDRESS_DEVICE) | TRB_SLOT(Dev->Slot) )) ||
+        (!ControlTransfer( Dev, 0x80, USB_GET_DESCRIPTOR, USB_DESC_DEVICE << 8, 0, 18, Dev->Scratch )) ||
+        (!ControlTransfer( Dev, 0x80, USB_GET_DESCRIPTOR, USB_DESC_CONFIG << 8, 0, 9, Dev->Scratch )))
+    {
+        return FALSE;
+    }
+
+    Config = Dev->Scratch[5];
+    Length = MIN( Dev->Scratch[2] | (Dev->Scratch[3] << 8), XHCI_SCRATCH_SIZE );
+
+    if ((!ControlTransfer( Dev, 0x80, USB_GET_DESCRIPTOR, USB_DESC_CONFIG << 8, 0, Length, Dev->Scratch )) ||
+        (!ParseConfiguration( Dev, Length )) ||
+        (!ControlTransfer( Dev, 0x00, USB_SET_CONFIGURATION, Config, 0, 0, NULL )) ||
+        (!InitRing( &Dev->BulkIn,  XHCI_BULK_RING_SIZE )) ||
+        (!InitRing( &Dev->BulkOut, XHCI_BULK_RING_SIZE )))
+    {
+        return FALSE;
+    }
+
+    /* Add both bulk endpoints */
+    memset( Dev->Input, 0, nContext );
+    InputContext( Dev, 0 )[1] = 1 | (1 << DCI(Dev->InAddress)) | (1 << DCI(Dev->OutAddress));
+    InputContext( Dev, 1 )[0] = (MAX( DCI(Dev->InAddress), DCI(Dev->OutAddress) ) << 27) | (Dev->Speed << 20);
+    InputContext( Dev, 1 )[1] = Dev->Port << 16;
+    SetEndpoint( InputContext( Dev, DCI(Dev->InAddress)  + 1 ), EP_TYPE_BULK_IN,  Dev->InPacket,  &Dev->BulkIn );
+    SetEndpoint( InputContext( Dev, DCI(Dev->OutAddress) + 1 ), EP_TYPE_BULK_OUT, Dev->OutPacket, &Dev->BulkOut );
+
+    return RunCommand( Ctrl, (ULONG)Dev->Input, TRB_TYPE(TRB_CONFIGURE_EP) | TRB_SLOT(Dev->Slot) ) != 0;
+}
+
+/* Registers the mass storage device on @Port. Returns TRUE if there is one */
+static BOOL ProbePort( PCI_DEVICE* Pci, XHCI_CONTROLLER* Ctrl, ULONG Port )
+{
+    USB_DISK* Dev;
+    ULONG     Status = REG32( Ctrl->Op, OP_PORTSC(Port) );
+    ULONG     i;
+
+    if (~Status & PORTSC_CONNECTED)
+    {
+        return FALSE;
+    }
+
+    if (~Status & PORTSC_ENABLED)
+    {
+        /* USB 2 ports are only enabled by a reset */
+        REG32( Ctrl->Op, OP_PORTSC(Port) ) = (Status & PORTSC_PRESERVE) | PORTSC_RESET;
+        for (i = 0; (i < XHCI_TIMEOUT) && (~REG32( Ctrl->Op, OP_PORTSC(Port) ) & PORTSC_RESET_CHANGE); i++);
+
+        Status = REG32( Ctrl->Op, OP_PORTSC(Port) );
+        REG32( Ctrl->Op, OP_PORTSC(Port) ) = (Status & PORTSC_PRESERVE) | PORTSC_RESET_CHANGE;
+        if (~Status & PORTSC_ENABLED)
+        {
+            return FALSE;
+        }
+    }
+
+    Dev = malloc( sizeof(USB_DISK) );
+    if (Dev == NULL)
+    {
+        return FALSE;
+    }
+
+    memset( Dev, 0, sizeof(USB_DISK) );
+    Dev->Ctrl    = Ctrl;
+    Dev->Port    = Port;
+    Dev->Speed   = PORTSC_SPEED(Status);
+    Dev->Cbw     = malloc( sizeof(USB_CBW) );
+    Dev->Csw     = malloc( sizeof(USB_CSW) );
+    Dev->Scratch = malloc( XHCI_SCRATCH_SIZE );
+
+    if ((Dev->Cbw == NULL) || (Dev->Csw == NULL) || (Dev->Scratch == NULL) ||
+        (!SetupDevice( Dev, Ctrl->Dcbaa )) || (!GetCapacity( Dev )))
+    {
+        /* Not a disk; whatever memory its slot took stays with the controller */
+        free( Dev->Scratch );
+        free( Dev->Csw );
+        free( Dev->Cbw );
+        free( Dev );
+        return FALSE;
+    }
+
+    Dev->Disk.Read        = UsbRead;
+    Dev->Disk.MaxTransfer = XHCI_MAX_TRANSFER / Dev->Disk.nBytesPerSector;
+    Dev->Disk.Alignment   = 1;
+    Dev->Disk.Pci         = *Pci;
+    Dev->Disk.Data        = Dev;
+
+    RegisterDisk( &Dev->Disk );
+    return TRUE;
+}
+
+/* Takes the controller from the BIOS, which stops its legacy USB emulation */
+static VOID TakeOwnership( CHAR* Base )
+{
+    ULONG Offset = HCC1_XECP( REG32( Base, CAP_HCCPARAMS1 ) );
+    ULONG i;
+
+    while (Offset != 0)
+    {
+        ULONG Cap = REG32( Base, Offset );
+
+        if ((Cap & 0xFF) == XECP_LEGACY)
+        {
+            REG8( Base, Offset + 3 ) = 1;
+            for (i = 0; (i < XHCI_TIMEOUT) && (REG32( Base, Offset ) & LEGACY_BIOS_OWNED); i++);
+
+            REG32( Base, Offset + 4 ) = (REG32( Base, Offset + 4 ) & LEGACY_SMI_DISABLE) | LEGACY_SMI_EVENTS;
+            return;
+        }
+
+        Offset = (Cap & 0xFF00) ? Offset + ((Cap >> 8) & 0xFF) * 4 : 0;
+    }
+}
+
+/*
+ * Resets the controller and sets up its data structures. Polled, no interrupts.
+ * Sets @isReset once the controller is taken from the BIOS.
+ */
+static BOOL StartController( XHCI_CONTROLLER* Ctrl, CHAR* Base, BOOL* isReset )
+{
+    ULONG  Params1 = REG32( Base, CAP_HCSPARAMS1 );
+    ULONG  nScratch = HCS2_SCRATCHPADS( REG32( Base, CAP_HCSPARAMS2 ) );
+    ULONG  nSlots  = MIN( HCS1_MAX_SLOTS(Params1), XHCI_MAX_SLOTS );
+    ULONG* Erst;
+    ULONG  i;
+
+    Ctrl->Op          = Base + REG8( Base, CAP_LENGTH );
+    Ctrl->Runtime     = Base + (REG32( Base, CAP_RTSOFF ) & ~0x1F);
+    Ctrl->Doorbells   = Base + (REG32( Base, CAP_DBOFF ) & ~0x3);
+    Ctrl->ContextSize = (REG32( Base, CAP_HCCPARAMS1 ) & HCC1_CONTEXT_64) ? 64 : 32;
+
+    if (nScratch > XHCI_MAX_SCRATCHPADS)
+    {
+        /* More memory than we can spare */
+        return FALSE;
+    }
+
+    *isReset = TRUE;
+    TakeOwnership( Base );
+
+    REG32( Ctrl->Op, OP_USBCMD ) &= ~USBCMD_RUN;
+    for (i = 0; (i < XHCI_TIMEOUT) && (~REG32( Ctrl->Op, OP_USBSTS ) & USBSTS_HALTED); i++);
+
+    REG32( Ctrl->Op, OP_USBCMD ) = USBCMD_RESET;
+    for (i = 0; (i < XHCI_TIMEOUT) && ((REG32( Ctrl->Op, OP_USBCMD ) & USBCMD_RESET) ||
+                                       (REG32( Ctrl->Op, OP_USBSTS ) & USBSTS_NOT_READY)); i++);
+    if (i == XHCI_TIMEOUT)
+    {
+        return FALSE;
+    }
+
+    Ctrl->Dcbaa  = memalign( 64, (nSlots + 1) * 8 );
+    Ctrl->Events = memalign( 64, XHCI_RING_SIZE * sizeof(XHCI_TRB) );
+    Erst         = memalign( 64, 16 );
+    if ((Ctrl->Dcbaa == NULL) || (Ctrl->Events == NULL) || (Erst == NULL) ||
+        (!InitRing( &Ctrl->Command, XHCI_RING_SIZE )))
+    {
+        return FALSE;
+    }
+
+    memset( Ctrl->Dcbaa, 0, (nSlots + 1) * 8 );
+    memset( (VOID*)Ctrl->Events, 0, XHCI_RING_SIZE * sizeof(XHCI_TRB) );
+    Ctrl->EventIndex = 0;
+    Ctrl->EventCycle = 1;
+
+    if (nScratch > 0)
+    {
+        /* Memory the controller keeps for itself, in 4 kB pages */
+        ULONG* Array = memalign( 64, nScratch * 8 );
+        if (Array == NULL)
+        {
+            return FALSE;
+        }
+
+        for (i = 0; i < nScratch; i++)
+        {
+            Array[2 * i]     = (ULONG)memalign( 4096, 4096 );
+            Array[2 * i + 1] = 0;
+            if (Array[2 * i] == 0)
+            {
+                return FALSE;
+            }
+        }
+
+        Ctrl->Dcbaa[0] = (ULONG)Array;
+    }
+
+    Erst[0] = (ULONG)Ctrl->Events;
+    Erst[1] = 0;
+    Erst[2] = XHCI_RING_SIZE;
+    Erst[3] = 0;
+
+    REG32( Ctrl->Op, OP_CONFIG )             = nSlots;
+    REG32( Ctrl->Op, OP_DCBAAP )             = (ULONG)Ctrl->Dcbaa;
+    REG32( Ctrl->Op, OP_DCBAAP_HIGH )        = 0;
+    REG32( Ctrl->Op, OP_CRCR )               = (ULONG)Ctrl->Command.Trbs | TRB_CYCLE;
+    REG32( Ctrl->Op, OP_CRCR_HIGH )          = 0;
+    REG32( Ctrl->Runtime, IR0_ERSTSZ )       = 1;
+    REG32( Ctrl->Runtime, IR0_ERDP )         = (ULONG)Ctrl->Events;
+    REG32( Ctrl->Runtime, IR0_ERDP_HIGH )    = 0;
+    REG32( Ctrl->Runtime, IR0_ERSTBA )       = (ULONG)Erst;
+    REG32( Ctrl->Runtime, IR0_ERSTBA_HIGH )  = 0;
+
+    REG32( Ctrl->Op, OP_USBCMD ) = USBCMD_RUN;
+    for (i = 0; (i < XHCI_TIMEOUT) && (REG32( Ctrl->Op, OP_USBSTS ) & USBSTS_HALTED); i++);
+
+    return (i < XHCI_TIMEOUT);
+}
+
+/*
+ * Returns TRUE if the BIOS drives just one device on the controller, and on a
+ * root port. The BIOS' device contexts tell us without touching the controller.
+ * Taking the controller over in any other case would cut off a keyboard, or
+ * a disk behind a hub, which we don't support.
+ */
+static BOOL HasSingleRootDevice( CHAR* Base )
+{
+    CHAR*  Op       = Base + REG8( Base, CAP_LENGTH );
+    ULONG  nSlots   = HCS1_MAX_SLOTS( REG32( Base, CAP_HCSPARAMS1 ) );
+    ULONG* Dcbaa    = (ULONG*)(REG32( Op, OP_DCBAAP ) & ~0x3F);
+    ULONG  nDevices = 0;
+    ULONG  Slot;
+
+    if ((REG32( Op, OP_USBSTS ) & USBSTS_HALTED) || (Dcbaa == NULL) || (REG32( Op, OP_DCBAAP_HIGH ) != 0))
+    {
+        /* The BIOS isn't running the controller, or we can't see how */
+        return FALSE;
+    }
+
+    for (Slot = 1; Slot <= nSlots; Slot++)
+    {
+        ULONG* Context = (ULONG*)(Dcbaa[2 * Slot] & ~0x3F);
+
+        if ((Context == NULL) && (Dcbaa[2 * Slot + 1] == 0))
+        {
+            continue;
+        }
+
+        if ((Dcbaa[2 * Slot + 1] != 0) || (Context[0] & (SLOT_ROUTE_STRING | SLOT_HUB)))
+        {
+            /* Out of reach, a hub, or behind one */
+            return FALSE;
+        }
+        nDevices++;
+    }
+
+    return (nDevices == 1);
+}
+
+/*
+ * Registers the mass storage devices on the root ports of an xHCI controller.
+ * Hubs are not supported. The controller is taken from the BIOS, which ends
+ * its USB legacy emulation, so this is only done if the BIOS uses nothing
+ * else on it.
+ */
+static BOOL XhciStart( PCI_DEVICE* Pci, BOOL* isReset )
+{
+    XHCI_CONTROLLER* Ctrl;
+    CHAR*            Base = (CHAR*)PciGetBar( Pci, 0 );
+    ULONG            nPorts;
+    ULONG            nDisks = 0;
+    ULONG            Port;
+    ULONG            i;
+
+    if (!HasSingleRootDevice( Base ))
+    {
+        return FALSE;
+    }
+
+    Ctrl = malloc( sizeof(XHCI_CONTROLLER) );
+    if (Ctrl == NULL)
+    {
+        return FALSE;
+    }
+
+    memset( Ctrl, 0, sizeof(XHCI_CONTROLLER) );
+    PciEnable( Pci, PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER );
+
+    if (!StartController( Ctrl, Base, isReset ))
+    {
+        free( Ctrl );
+        return FALSE;
+    }
+
+    /* The reset dropped all links, give the devices time to connect again */
+    nPorts = HCS1_MAX_PORTS( REG32( Base, CAP_HCSPARAMS1 ) );
+    for (i = 0; i < XHCI_SETTLE; i++)
+    {
+        REG32( Ctrl->Op, OP_USBSTS );
+    }
+
+    for (Port = 1; Port <= nPorts; Port++)
+    {
+        if (ProbePort( Pci, Ctrl, Port ))
+        {
+            nDisks++;
+        }
+    }
+
+    /* The BIOS' disk didn't come back, or we can't drive it */
+    return (nDisks > 0);
+}
+
+/*
+ * Finds all xHCI controllers.
+ */
+VOID XhciProbe( VOID )
+{
+    PCI_DEVICE Pci;
+    ULONG      Index;
+
+    for (Index = 0; PciFindClass( PCI_CLASS_SERIAL, PCI_SERIAL_USB, Index, &Pci ); Index++)
+    {
+        if ((Pci.ProgIf == PCI_USB_XHCI) && (PciGetBar( &Pci, 0 ) != 0))
+        {
+            RegisterController( &Pci, XhciStart );
+        }
+    }
+}